@@ -7,6 +7,12 @@
 
 #include <linux/pci.h>
 #include <linux/cdev.h>
+#include <linux/completion.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-mapping.h>
 #include "ahci_lld_reg.h"
 #include "ahci_lld_ioctl.h"
 
@@ -23,6 +29,29 @@
 #define AHCI_CMD_DEFAULT_TIMEOUT_MS     5000    /* Default command completion timeout */
 #define AHCI_PHY_READY_TIMEOUT_MS       1000    /* PHY communication ready timeout */
 #define AHCI_DEVICE_READY_TIMEOUT_MS    1000    /* Device BSY/DRQ clear timeout */
+#define AHCI_IRQ_RECHECK_MS             1       /* PxCI re-check interval while waiting for IRQ */
+
+/* Completion wait policy of ahci_port_issue_cmd() (sysfs poll_mode) */
+enum ahci_poll_mode {
+    AHCI_POLL_MODE_IRQ,                         /* Sleep until DHRS/SDBS (short sleeps without IRQ) */
+    AHCI_POLL_MODE_POLL,                        /* Busy-poll PxCI until completion or timeout */
+    AHCI_POLL_MODE_HYBRID,                      /* Busy-poll for part of the mean service time, then sleep */
+};
+
+/* Service time classes learned by ahci_port_wait_ci() */
+enum ahci_svc_class {
+    AHCI_SVC_READ,                              /* Non-NCQ with read data */
+    AHCI_SVC_WRITE,                             /* Non-NCQ with write data */
+    AHCI_SVC_NODATA,                            /* Non-NCQ without data */
+    AHCI_SVC_NCQ,                               /* NCQ: until the device accepts the command */
+    AHCI_SVC_CLASSES,
+};
+
+#define AHCI_HYBRID_SPIN_PCT            125     /* Hybrid: spin up to 125% of the mean service time */
+#define AHCI_HYBRID_SPIN_MAX_NS         200000  /* ...but never longer than 200us (HDD: sleep right away) */
+#define AHCI_SVC_EWMA_SHIFT             3       /* Mean += (sample - mean) / 8 */
+#define AHCI_POLL_SLEEP_MIN_US          10      /* Sleep interval bounds without IRQ (mean / 2) */
+#define AHCI_POLL_SLEEP_MAX_US          1000
 
 /* ========================================================================
  * DMA Buffer Configuration (Scatter-Gather)
@@ -31,13 +60,53 @@
 #define AHCI_SG_BUFFER_SIZE     (128 * 1024)    /* 128KB per buffer (optimal for large transfers) */
 #define AHCI_SG_BUFFER_COUNT    2048            /* Max 2048 buffers = 256MB max transfer */
 #define AHCI_MAX_TRANSFER_SIZE  (AHCI_SG_BUFFER_SIZE * AHCI_SG_BUFFER_COUNT)
+#define AHCI_SG_CHUNK_BUFFERS   32              /* SG buffers per contiguous chunk (4MB = 1 PRDT entry) */
+#define AHCI_SG_CHUNK_SIZE      (AHCI_SG_BUFFER_SIZE * AHCI_SG_CHUNK_BUFFERS)
+#define AHCI_SG_CHUNK_COUNT     (AHCI_SG_BUFFER_COUNT / AHCI_SG_CHUNK_BUFFERS)
+#define AHCI_DIO_ALIGN          4               /* Direct I/O buffer/length alignment (DBA/DBC) */
+#define AHCI_MAX_FIXED_BUFS     1024            /* Max registered (fixed) buffers per port */
+
+/* blk-mq frontend (ahci_lld_blk.c) */
+#define AHCI_BLK_SECTOR_SIZE    512             /* Logical block size */
+#define AHCI_BLK_MAX_SECTORS    65535           /* FPDMA sector count is 16 bits (Features) */
+#define AHCI_BLK_MAX_SEGMENTS   168             /* Scatterlist entries in each request PDU */
+
+/* read_iter/write_iter on the port device (ahci_lld_cmd.c) */
+#define AHCI_RW_SECTOR_SIZE     512             /* File offset = LBA * AHCI_RW_SECTOR_SIZE */
+#define AHCI_RW_MAX_SECTORS     32768           /* Sectors per READ/WRITE DMA EXT (16MB) */
 
 /* AHCI Command Table sizes (AHCI 1.3.1 Section 4.2.3) */
 #define AHCI_CMD_LIST_SIZE      1024            /* Command List: 32 slots × 32 bytes */
 #define AHCI_FIS_AREA_SIZE      256             /* Received FIS area */
-#define AHCI_CMD_TABLE_SIZE     4096            /* Command Table (simplified) */
 #define AHCI_MAX_PRDT_ENTRIES   65535           /* Max PRDT entries per command */
 
+/* Max bytes of one PRDT entry (DBC 22 bits = 4MB, needs ahci_lld_fis.h) */
+#define AHCI_PRDT_MAX_BYTES     (AHCI_PRDT_DBC_MASK + 1)
+
+/*
+ * Per-slot Command Tables (needs ahci_lld_fis.h)
+ * - small: 常時確保。4K〜数MBの I/O (PRDT 24 エントリ) はこれで足りる
+ * - large: PRDT が溢れる場合のみプールから取得。SGバッファを最大数使い、
+ *          かつ先頭がバッファ境界に揃っていない場合 (+1) まで収まる
+ */
+#define AHCI_CMD_TABLE_ALIGN        128             /* CTBA alignment */
+#define AHCI_CMD_TABLE_SMALL_PRDT   24
+#define AHCI_CMD_TABLE_SMALL_SIZE \
+    (offsetof(struct ahci_cmd_table, prdt) + AHCI_CMD_TABLE_SMALL_PRDT * sizeof(struct ahci_prdt_entry))
+#define AHCI_CMD_TABLE_MAX_PRDT     (AHCI_SG_BUFFER_COUNT + 1)
+#define AHCI_CMD_TABLE_LARGE_SIZE \
+    ALIGN(offsetof(struct ahci_cmd_table, prdt) + AHCI_CMD_TABLE_MAX_PRDT * sizeof(struct ahci_prdt_entry), \
+          AHCI_CMD_TABLE_ALIGN)
+
+/*
+ * Per-port DMA arena: Command List, Received FIS, 32 small Command Tables
+ * を1つの連続領域から切り出す (各オフセットは要求アライメントの倍数)
+ */
+#define AHCI_ARENA_CMD_LIST_OFF     0
+#define AHCI_ARENA_FIS_OFF          (AHCI_ARENA_CMD_LIST_OFF + AHCI_CMD_LIST_SIZE)
+#define AHCI_ARENA_CMD_TBL_OFF      (AHCI_ARENA_FIS_OFF + AHCI_FIS_AREA_SIZE)
+#define AHCI_ARENA_SIZE             (AHCI_ARENA_CMD_TBL_OFF + 32 * AHCI_CMD_TABLE_SMALL_SIZE)
+
 /* Sector size constants */
 #define ATA_SECTOR_SIZE         512             /* Standard ATA sector size */
 #define ATA_SECTOR_SIZE_4K      4096            /* Advanced Format 4K sector */
@@ -46,6 +115,17 @@
 struct ahci_hba;
 struct ahci_port_device;
 struct ahci_ghc_device;
+struct eventfd_ctx;
+struct io_uring_cmd;
+struct ahci_prdt_entry;
+struct vm_area_struct;
+struct dma_pool;
+struct shrinker;
+struct iov_iter;
+struct kiocb;
+struct request;
+struct ahci_port_blk;
+struct ahci_cmd_table;
 
 /* HBA構造体 */
 struct ahci_hba {
@@ -55,26 +135,78 @@ struct ahci_hba {
     
     u32 ports_impl;
     int n_ports;
+    int node;                   /* NUMA node of the HBA (dev_to_node, may be NUMA_NO_NODE) */
+    bool dma_64bit;             /* CAP.S64A: 64-bit DMA mask set */
     
     struct ahci_port_device *ports[AHCI_MAX_PORTS];
     struct ahci_ghc_device *ghc_dev;  /* GHC制御用デバイス */
     
     dev_t dev_base;
     struct class *class;
+    
+    /* 割り込み (MSI-X/MSI/INTx) */
+    int irq;                    /* Linux IRQ番号 (vector 0) */
+    bool irq_enabled;           /* false の場合はポーリングで完了待ち */
+    
+    /* Command Completion Coalescing (CAP.CCCS) */
+    struct mutex ccc_lock;      /* Serializes CCC_CTL/CCC_PORTS/PxIE updates */
+    u32 ccc_ports;              /* Ports in the CCC set while CCC_CTL.EN=1 (read by IRQ handler) */
+    u32 ccc_irq_bit;            /* CCC_CTL.INT */
+    u64 ccc_interrupts;         /* CCC interrupts serviced */
+};
+
+/* Direct I/O (pinned user pages mapped into the PRDT) */
+struct ahci_dio {
+    struct sg_table sgt;            /* DMA-mapped user pages */
+    struct page **pages;            /* Pinned pages */
+    int nr_pages;
+    int prdt_count;                 /* PRDT entries needed */
+    enum dma_data_direction dir;
+};
+
+/* Registered (fixed) buffer, pinned and mapped once by AHCI_IOC_REGISTER_BUFFERS */
+struct ahci_fixed_buf {
+    struct ahci_dio dio;            /* Long-term pinned, DMA_BIDIRECTIONAL */
+    u64 len;                        /* Buffer length */
+    struct ahci_prdt_entry *segs;   /* Precomputed PRDT entries for the whole buffer */
+    int nr_segs;
 };
 
 /* NCQ Slot Information */
 struct ahci_cmd_slot {
     struct ahci_cmd_request req;    /* Command request (stored copy) */
-    void *buffer;                   /* Kernel buffer */
+    bool bounce;                    /* Data staged in SG buffers (READ: copied to req.buffer) */
     u32 buffer_len;                 /* Buffer length */
     bool is_write;                  /* Write direction flag */
     bool completed;                 /* Completion flag */
+    bool finish_pending;            /* Completed, needs process context (copy/release) */
+    bool finishing;                 /* Being finished by ahci_check_slot_completion() */
+    bool from_ring;                 /* Submitted through the SQ ring, released on completion */
+    bool waiter;                    /* Issuer waits in ahci_port_issue_cmd(), frees it on error */
+    bool reaping;                   /* Collected by AHCI_IOC_REAP_CMD, which frees it */
+    struct io_uring_cmd *ioucmd;    /* io_uring passthrough, completed by task work */
+    struct request *rq;             /* blk-mq request, completed through blk_mq_complete_request() */
+    struct kiocb *iocb;             /* Async read_iter/write_iter, completed with ki_complete() */
+    struct ahci_dio *dio;           /* Direct I/O mapping (instead of SG buffers) */
+    bool fixed;                     /* Transfers to/from a registered buffer */
     int result;                     /* Result code */
     
-    /* SG buffer allocation */
+    /* Deferred completion */
+    struct mm_struct *mm;           /* Issuer's mm for the read data copy (mmgrab) */
+    ktime_t issue_time;             /* PxCI write time */
+    u64 latency_ns;                 /* Issue to completion detection */
+    
+    /* SG buffer allocation (private extent of port->sg_buffers) */
     int sg_start_idx;               /* Starting SG buffer index */
-    int sg_count;                   /* Number of SG buffers used */
+    int sg_count;                   /* Number of SG buffers used (0 = none) */
+    
+    /* mmap'd SG pool range referenced by the command (AHCI_CMD_FLAG_POOL) */
+    int pool_start;                 /* Starting SG buffer index */
+    int pool_count;                 /* Number of SG buffers referenced (0 = none) */
+    
+    /* Large Command Table (from cmd_tbl_large_pool, NULL = port->cmd_tables[slot]) */
+    struct ahci_cmd_table *large_tbl;
+    dma_addr_t large_tbl_dma;
 };
 
 /* Port構造体 */
@@ -85,32 +217,54 @@ struct ahci_port_device {
     int port_no;
     void __iomem *port_mmio;
     struct ahci_hba *hba;
+    int node;                   /* hba->node: driver state, rings and completion work */
+    
+    /* DMA buffers (carved out of one coherent arena, AHCI_ARENA_SIZE) */
+    void *arena;
+    dma_addr_t arena_dma;
     
-    /* DMA buffers */
     void *cmd_list;             /* Command List (1KB, 1KB-aligned) */
     dma_addr_t cmd_list_dma;
     
     void *fis_area;             /* Received FIS (256 bytes, 256-byte-aligned) */
     dma_addr_t fis_area_dma;
     
-    void *cmd_table;            /* Command Table (4KB for simplicity) - slot 0 only */
-    dma_addr_t cmd_table_dma;
-    
-    /* NCQ: Command Tables for 32 slots */
+    /* Command Tables for 32 slots (small, 128-byte-aligned in the arena) */
     void *cmd_tables[32];
     dma_addr_t cmd_tables_dma[32];
+    struct dma_pool *cmd_tbl_large_pool;    /* AHCI_CMD_TABLE_LARGE_SIZE, on demand */
     
     /* Scatter-Gather buffers (128KB each) */
     void *sg_buffers[AHCI_SG_BUFFER_COUNT];
     dma_addr_t sg_buffers_dma[AHCI_SG_BUFFER_COUNT];
     int sg_buffer_count;        /* Number of allocated SG buffers */
-    struct mutex sg_lock;       /* Lock for SG buffer allocation */
+    DECLARE_BITMAP(sg_map, AHCI_SG_BUFFER_COUNT);  /* SG buffers owned by a command or a mapping */
+    DECLARE_BITMAP(sg_pool_map, AHCI_SG_BUFFER_COUNT);  /* SG buffers mmap'd by user space */
+    u8 sg_pool_refs[AHCI_SG_BUFFER_COUNT];  /* In-flight commands using each pool buffer */
+    DECLARE_BITMAP(sg_chunk_map, AHCI_SG_CHUNK_COUNT);  /* Chunks allocated as one contiguous block */
+    struct mutex sg_lock;       /* Lock for SG buffer allocation and sg_map */
+    
+    /* SG buffer reclaim (shrinker / idle timer, above sg_low_water) */
+    struct shrinker *sg_shrinker;
+    struct delayed_work sg_reclaim_work;
+    int sg_peak;                /* High-water mark of sg_buffer_count */
+    u64 sg_reclaim_events;      /* Reclaim passes that freed buffers */
+    u64 sg_reclaimed;           /* Total SG buffers freed by reclaim */
+    
+    atomic64_t dma_bounced;     /* Streaming DMA mappings bounced through swiotlb */
     
     /* NCQ: Slot management */
     unsigned long slots_in_use;     /* Bitmap of used slots (32 bits) */
     unsigned long slots_completed;  /* Bitmap of completed slots */
+    unsigned long slots_issued;     /* Bitmap of NCQ slots written to PxSACT */
     spinlock_t slot_lock;           /* Slot allocation lock */
     struct ahci_cmd_slot slots[32]; /* Per-slot information */
+    bool ncq_frozen;                /* Port stopped or in recovery, PxSACT not trusted (slot_lock) */
+    
+    /* NCQ: Error handling */
+    struct mutex eh_lock;           /* Serializes recovery and PORT_RESET/START/STOP */
+    struct work_struct eh_work;     /* Recovers the port after an NCQ error interrupt */
+    bool eh_pending;                /* Error interrupt not yet handled by eh_work (slot_lock) */
     
     /* NCQ: Statistics */
     bool ncq_enabled;               /* NCQ enabled flag */
@@ -118,6 +272,47 @@ struct ahci_port_device {
     atomic_t active_slots;          /* Number of active slots */
     u64 ncq_issued;                 /* Number of NCQ commands issued */
     u64 ncq_completed;              /* Number of NCQ commands completed */
+    
+    /* Interrupt handling */
+    struct completion cmd_done;     /* Non-NCQ (slot 0) completion */
+    wait_queue_head_t ncq_wq;       /* NCQ completion waiters */
+    u32 irq_status;                 /* PxIS accumulated by IRQ handler (slot_lock) */
+    u64 irq_count;                  /* Number of port interrupts serviced */
+    
+    /* Completion notification */
+    struct eventfd_ctx *completion_eventfd; /* Signalled per NCQ completion (slot_lock) */
+    struct file *eventfd_owner;     /* File that registered the eventfd */
+    struct ahci_cq_ring *cq_ring;   /* mmap'd completion ring (1 page, lazily allocated) */
+    u32 cq_tail;                    /* Kernel copy of cq_ring->tail (slot_lock) */
+    u32 cq_overflow;                /* Kernel copy of cq_ring->overflow (slot_lock) */
+    struct work_struct complete_work; /* Copies read data of completed slots */
+    
+    /* Submission ring */
+    struct ahci_sq_ring *sq_ring;   /* mmap'd submission ring (1 page, lazily allocated) */
+    u32 sq_head;                    /* Kernel copy of sq_ring->head (sq_lock) */
+    struct mutex sq_lock;           /* Serializes SQ consumers */
+    struct task_struct *sq_thread;  /* SQ polling thread (sq_lock) */
+    struct mm_struct *sq_mm;        /* Address space of sq_thread's submitter (mmgrab) */
+    struct file *sq_owner;          /* File that started sq_thread */
+    unsigned long sq_idle;          /* Idle time before sq_thread sleeps (jiffies) */
+    
+    /* Registered (fixed) buffers */
+    struct ahci_fixed_buf *fixed_bufs;  /* Array of nr_fixed_bufs entries (fixed_lock) */
+    u32 nr_fixed_bufs;
+    struct mutex fixed_lock;        /* Protects fixed_bufs/nr_fixed_bufs */
+    struct file *fixed_owner;       /* File that registered the buffers */
+    
+    /* Completion wait policy (ahci_port_wait_ci) */
+    int poll_mode;                  /* enum ahci_poll_mode (sysfs poll_mode) */
+    u64 svc_mean_ns[AHCI_SVC_CLASSES];  /* EWMA of issue to PxCI clear per class */
+    u64 poll_spin_hits;             /* Waits that completed while busy-polling */
+    u64 poll_sleeps;                /* Waits that slept at least once */
+    
+    /* read_iter/write_iter */
+    struct mutex rw_lock;           /* Serializes read/write on slot 0 and NCQ kiocb issue */
+    
+    /* blk-mq frontend (NULL unless blk_frontend=1 and an NCQ device is attached) */
+    struct ahci_port_blk *blk;
 };
 
 /* GHC (Global HBA Control) デバイス構造体 */
@@ -133,6 +328,31 @@ struct ahci_ghc_device {
 int ahci_hba_reset(struct ahci_hba *hba);
 int ahci_hba_enable(struct ahci_hba *hba);
 
+/* ahci_lld_irq.c からエクスポートされる割り込み処理関数 */
+int ahci_hba_setup_irq(struct ahci_hba *hba);
+void ahci_hba_free_irq(struct ahci_hba *hba);
+void ahci_port_handle_irq(struct ahci_port_device *port);
+u32 ahci_port_irq_mask(struct ahci_port_device *port);
+int ahci_hba_set_ccc(struct ahci_hba *hba, const struct ahci_ccc_config *cfg);
+void ahci_hba_get_ccc(struct ahci_hba *hba, struct ahci_ccc_config *cfg);
+
+/* ahci_lld_ring.c からエクスポートされるリング関数 */
+void *ahci_port_get_ring(struct ahci_port_device *port, unsigned long offset);
+void ahci_port_free_rings(struct ahci_port_device *port);
+int ahci_port_sq_submit(struct ahci_port_device *port);
+int ahci_port_sq_doorbell(struct ahci_port_device *port);
+int ahci_port_submit_batch(struct ahci_port_device *port, struct ahci_submit_batch *batch);
+int ahci_port_sq_start_thread(struct ahci_port_device *port, u32 idle_ms);
+void ahci_port_sq_stop_thread(struct ahci_port_device *port);
+int ahci_port_uring_cmd(struct ahci_port_device *port, struct io_uring_cmd *ioucmd,
+                        unsigned int issue_flags);
+void ahci_port_uring_complete(struct ahci_port_device *port, int slot);
+
+/* ahci_lld_blk.c からエクスポートされる blk-mq フロントエンド関数 */
+int ahci_port_blk_add(struct ahci_port_device *port);
+void ahci_port_blk_remove(struct ahci_port_device *port);
+void ahci_port_blk_complete(struct ahci_port_device *port, u32 tags);
+
 /* ahci_lld_port.c からエクスポートされる関数 */
 int ahci_port_init(struct ahci_port_device *port);
 void ahci_port_cleanup(struct ahci_port_device *port);
@@ -150,21 +370,72 @@ int ahci_port_init(struct ahci_port_device *port);
 int ahci_port_comreset(struct ahci_port_device *port);
 int ahci_port_stop(struct ahci_port_device *port);
 int ahci_port_start(struct ahci_port_device *port);
+int ahci_port_halt(struct ahci_port_device *port, bool reset);
+int ahci_port_recover(struct ahci_port_device *port, int slot);
+void ahci_port_eh_work(struct work_struct *work);
 
 /* ahci_lld_buffer.c からエクスポートされるDMAバッファ管理関数 */
 int ahci_port_alloc_dma_buffers(struct ahci_port_device *port);
 void ahci_port_free_dma_buffers(struct ahci_port_device *port);
 int ahci_port_setup_dma(struct ahci_port_device *port);
 int ahci_port_ensure_sg_buffers(struct ahci_port_device *port, int needed);
+int ahci_port_sg_alloc(struct ahci_port_device *port, int count);
+void ahci_port_sg_free(struct ahci_port_device *port, int start, int count);
+int ahci_port_sg_copy_from_iter(struct ahci_port_device *port, int start,
+                                struct iov_iter *from, u32 len);
+int ahci_port_sg_copy_to_iter(struct ahci_port_device *port, int start,
+                              struct iov_iter *to, u32 len);
+int ahci_port_pool_mmap(struct ahci_port_device *port, struct vm_area_struct *vma);
+int ahci_prdt_append(struct ahci_prdt_entry *prdt, int count, int max,
+                     dma_addr_t addr, u32 len);
+int ahci_port_pool_build_prdt(struct ahci_port_device *port, int slot,
+                              struct ahci_cmd_request *req,
+                              struct ahci_prdt_entry *prdt, int max);
+void ahci_port_pool_put(struct ahci_port_device *port, int start, int count);
+struct ahci_cmd_table *ahci_port_get_cmd_table(struct ahci_port_device *port, int slot,
+                                               int prdt_count, dma_addr_t *dma, int *max);
+void ahci_port_put_cmd_table(struct ahci_port_device *port, struct ahci_cmd_table *tbl,
+                             dma_addr_t dma);
+
+/* ahci_lld_dio.c からエクスポートされる Direct I/O 関数 */
+struct ahci_dio *ahci_port_dio_map(struct ahci_port_device *port,
+                                   struct ahci_cmd_request *req);
+void ahci_port_dio_unmap(struct ahci_port_device *port, struct ahci_dio *dio);
+int ahci_dio_prdt_count(struct ahci_dio *dio);
+int ahci_dio_build_prdt(struct ahci_dio *dio, struct ahci_prdt_entry *prdt);
+int ahci_port_register_buffers(struct ahci_port_device *port, struct ahci_buf_register *reg);
+int ahci_port_unregister_buffers(struct ahci_port_device *port);
+int ahci_port_fixed_build_prdt(struct ahci_port_device *port, struct ahci_cmd_request *req,
+                               struct ahci_prdt_entry *prdt, int max);
+void ahci_port_fixed_sync_for_cpu(struct ahci_port_device *port, int slot);
 
 /* ahci_lld_cmd.c からエクスポートされるコマンド実行関数 */
 int ahci_port_issue_cmd(struct ahci_port_device *port, 
-                        struct ahci_cmd_request *req, void *buf);
+                        struct ahci_cmd_request *req, struct iov_iter *iter,
+                        struct ahci_dio *dio);
+int ahci_port_prep_ncq(struct ahci_port_device *port,
+                       struct ahci_cmd_request *req, struct iov_iter *iter,
+                       struct ahci_dio *dio);
+void ahci_port_fire_ncq(struct ahci_port_device *port, u32 tags);
+ssize_t ahci_port_rw_iter(struct ahci_port_device *port, loff_t pos,
+                          struct iov_iter *iter, bool is_write, bool direct);
+ssize_t ahci_port_rw_queue(struct ahci_port_device *port, struct kiocb *iocb,
+                           struct iov_iter *iter, bool is_write);
 
 /* ahci_lld_slot.c からエクスポートされるスロット管理関数 */
 int ahci_alloc_slot(struct ahci_port_device *port);
 void ahci_free_slot(struct ahci_port_device *port, int slot);
+int ahci_port_release_slot(struct ahci_port_device *port, int slot);
 void ahci_mark_slot_completed(struct ahci_port_device *port, int slot, int result);
 u32 ahci_check_slot_completion(struct ahci_port_device *port);
+u32 ahci_peek_slot_completion(struct ahci_port_device *port);
+u32 ahci_port_complete_ncq(struct ahci_port_device *port);
+u32 ahci_port_ncq_freeze(struct ahci_port_device *port);
+void ahci_port_ncq_thaw(struct ahci_port_device *port);
+void ahci_port_ncq_fail(struct ahci_port_device *port, u32 tags);
+int ahci_port_set_eventfd(struct ahci_port_device *port, int fd);
+void ahci_port_complete_work(struct work_struct *work);
+void ahci_port_post_completion(struct ahci_port_device *port,
+                               const struct ahci_cq_entry *entry);
 
 #endif /* AHCI_LLD_H */
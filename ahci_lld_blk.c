@@ -0,0 +1,472 @@
+/*
+ * AHCI Low Level Driver - blk-mq Block Device Frontend
+ *
+ * NCQ 対応デバイスが接続されたポートを /dev/ahci_lldNn として公開する
+ * （モジュールパラメータ blk_frontend=1 の場合のみ）。
+ * blk-mq のタグは NCQ タグ (= スロット番号) にそのまま対応し、
+ * REQ_OP_READ/WRITE を READ/WRITE FPDMA QUEUED として
+ * ahci_port_prep_ncq() / ahci_port_fire_ncq() で発行する。
+ * データはリクエストのページを DMA マップして PRDT に直接載せる。
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-mapping.h>
+#include <linux/uio.h>
+#include "ahci_lld.h"
+#include "ahci_lld_fis.h"
+
+static bool blk_frontend;
+module_param(blk_frontend, bool, 0444);
+MODULE_PARM_DESC(blk_frontend, "Expose ports with an NCQ device as blk-mq disks /dev/ahci_lldNn (default off)");
+
+/* ポートごとの blk-mq 状態 */
+struct ahci_port_blk {
+    struct blk_mq_tag_set tag_set;
+    struct gendisk *disk;
+    spinlock_t lock;                /* pending */
+    u32 pending;                    /* 準備済みで PxSACT/PxCI 未発行のタグ */
+};
+
+/* リクエストごとの PDU: DMA マップ（ページは blk-mq が所有するので pin しない） */
+struct ahci_blk_cmd {
+    struct ahci_dio dio;            /* dio.pages は NULL */
+    blk_status_t status;
+    struct scatterlist sgl[AHCI_BLK_MAX_SEGMENTS];
+};
+
+/**
+ * ahci_blk_fire_pending - 準備済みのタグをまとめて発行する
+ * @port: ポートデバイス構造体
+ * @blk: blk-mq 状態
+ */
+static void ahci_blk_fire_pending(struct ahci_port_device *port, struct ahci_port_blk *blk)
+{
+    u32 tags;
+    
+    spin_lock(&blk->lock);
+    tags = blk->pending;
+    blk->pending = 0;
+    spin_unlock(&blk->lock);
+    
+    if (tags)
+        ahci_port_fire_ncq(port, tags);
+}
+
+/**
+ * ahci_blk_queue_rq - blk-mq リクエストを NCQ コマンドとして準備する
+ * @hctx: ハードウェアキューコンテキスト
+ * @bd: キューデータ
+ *
+ * bd->last までは PxSACT/PxCI を書かずに溜め、プラグされた複数の
+ * リクエストを ahci_port_fire_ncq() 1回で発行する。
+ *
+ * Return: BLK_STS_OK、タグが ioctl 側で使用中の場合 BLK_STS_RESOURCE
+ */
+static blk_status_t ahci_blk_queue_rq(struct blk_mq_hw_ctx *hctx,
+                                      const struct blk_mq_queue_data *bd)
+{
+    struct ahci_port_device *port = hctx->queue->queuedata;
+    struct ahci_port_blk *blk = port->blk;
+    struct request *rq = bd->rq;
+    struct ahci_blk_cmd *cmd = blk_mq_rq_to_pdu(rq);
+    struct device *dev = &port->hba->pdev->dev;
+    struct ahci_cmd_request req;
+    unsigned long flags;
+    bool is_write;
+    int ret;
+    
+    switch (req_op(rq)) {
+    case REQ_OP_READ:
+        is_write = false;
+        break;
+    case REQ_OP_WRITE:
+        is_write = true;
+        break;
+    default:
+        return BLK_STS_NOTSUPP;
+    }
+    
+    /* リクエストのセグメントを DMA マップ */
+    sg_init_table(cmd->sgl, AHCI_BLK_MAX_SEGMENTS);
+    cmd->dio.sgt.sgl = cmd->sgl;
+    cmd->dio.sgt.orig_nents = blk_rq_map_sg(hctx->queue, rq, cmd->sgl);
+    cmd->dio.dir = is_write ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+    if (dma_map_sgtable(dev, &cmd->dio.sgt, cmd->dio.dir, 0))
+        return BLK_STS_RESOURCE;
+    cmd->dio.prdt_count = ahci_dio_prdt_count(&cmd->dio);
+    cmd->status = BLK_STS_OK;
+    
+    /* READ/WRITE FPDMA QUEUED: セクタ数は Features、タグは Count[7:3] */
+    memset(&req, 0, sizeof(req));
+    req.command = is_write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+    req.features = blk_rq_sectors(rq) & 0xFF;
+    req.features_exp = (blk_rq_sectors(rq) >> 8) & 0xFF;
+    req.count = rq->tag << 3;
+    req.device = ATA_DEV_LBA;
+    req.lba = blk_rq_pos(rq);
+    req.tag = rq->tag;
+    req.buffer_len = blk_rq_bytes(rq);
+    req.flags = AHCI_CMD_FLAG_NCQ | (is_write ? AHCI_CMD_FLAG_WRITE : 0);
+    
+    ret = ahci_port_prep_ncq(port, &req, NULL, &cmd->dio);
+    if (ret) {
+        dma_unmap_sgtable(dev, &cmd->dio.sgt, cmd->dio.dir, 0);
+        /* ioctl で同じタグが使われている: 空くまで再試行させる */
+        if (ret == -EBUSY)
+            return BLK_STS_RESOURCE;
+        dev_err(port->device, "blk: failed to prepare tag %d (%d)\n", rq->tag, ret);
+        return BLK_STS_IOERR;
+    }
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    port->slots[rq->tag].rq = rq;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    blk_mq_start_request(rq);
+    
+    spin_lock(&blk->lock);
+    blk->pending |= 1U << rq->tag;
+    spin_unlock(&blk->lock);
+    
+    if (bd->last)
+        ahci_blk_fire_pending(port, blk);
+    
+    return BLK_STS_OK;
+}
+
+/**
+ * ahci_blk_commit_rqs - bd->last を受け取らずに終わったバッチを発行する
+ * @hctx: ハードウェアキューコンテキスト
+ */
+static void ahci_blk_commit_rqs(struct blk_mq_hw_ctx *hctx)
+{
+    struct ahci_port_device *port = hctx->queue->queuedata;
+    
+    ahci_blk_fire_pending(port, port->blk);
+}
+
+/**
+ * ahci_blk_complete_rq - 完了したリクエストのスロットを解放して終了させる
+ * @rq: blk-mq リクエスト
+ *
+ * スロットの dio は PDU の一部なので、ahci_free_slot() に解放させないよう
+ * 先に外してからアンマップする。
+ */
+static void ahci_blk_complete_rq(struct request *rq)
+{
+    struct ahci_port_device *port = rq->q->queuedata;
+    struct ahci_blk_cmd *cmd = blk_mq_rq_to_pdu(rq);
+    unsigned long flags;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    port->slots[rq->tag].dio = NULL;
+    port->slots[rq->tag].rq = NULL;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    dma_unmap_sgtable(&port->hba->pdev->dev, &cmd->dio.sgt, cmd->dio.dir, 0);
+    ahci_free_slot(port, rq->tag);
+    
+    blk_mq_end_request(rq, cmd->status);
+}
+
+/**
+ * ahci_blk_timeout - リクエストのタイムアウト
+ * @rq: blk-mq リクエスト
+ *
+ * ahci_port_recover() でポートをリセットし、未完了のタグ（このリクエストを
+ * 含む）を失敗させる。リクエストは blk_mq_complete_request() で完了する。
+ * ポートを停止できなかった場合は DMA が実行中の可能性があるページを
+ * 返さないよう、タイマーを延長する。
+ */
+static enum blk_eh_timer_return ahci_blk_timeout(struct request *rq)
+{
+    struct ahci_port_device *port = rq->q->queuedata;
+    void __iomem *port_mmio = port->port_mmio;
+    unsigned long flags;
+    bool outstanding;
+    
+    dev_err(port->device, "blk: tag %d timed out (PxSACT=0x%08x PxCI=0x%08x PxIS=0x%08x)\n",
+            rq->tag, ioread32(port_mmio + AHCI_PORT_SACT), ioread32(port_mmio + AHCI_PORT_CI),
+            ioread32(port_mmio + AHCI_PORT_IS));
+    
+    ahci_port_recover(port, -1);
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    outstanding = port->slots[rq->tag].rq == rq &&
+                  !test_bit(rq->tag, &port->slots_completed);
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    return outstanding ? BLK_EH_RESET_TIMER : BLK_EH_DONE;
+}
+
+static const struct blk_mq_ops ahci_blk_mq_ops = {
+    .queue_rq = ahci_blk_queue_rq,
+    .commit_rqs = ahci_blk_commit_rqs,
+    .complete = ahci_blk_complete_rq,
+    .timeout = ahci_blk_timeout,
+};
+
+static const struct block_device_operations ahci_blk_fops = {
+    .owner = THIS_MODULE,
+};
+
+/**
+ * ahci_port_blk_complete - NCQ 完了を blk-mq に渡す
+ * @port: ポートデバイス構造体
+ * @tags: 完了した blk-mq 発行分のスロットのビットマップ
+ *
+ * ahci_port_complete_ncq() が slot_lock を外した後に呼ぶ。
+ * 割り込みコンテキストから呼ばれることがある。
+ */
+void ahci_port_blk_complete(struct ahci_port_device *port, u32 tags)
+{
+    int slot;
+    
+    for (slot = 0; slot < 32; slot++) {
+        struct request *rq;
+        struct ahci_blk_cmd *cmd;
+        
+        if (!(tags & (1U << slot)))
+            continue;
+        
+        rq = port->slots[slot].rq;
+        cmd = blk_mq_rq_to_pdu(rq);
+        if (port->slots[slot].req.status & ATA_STATUS_ERR)
+            cmd->status = BLK_STS_IOERR;
+        
+        blk_mq_complete_request(rq);
+    }
+}
+EXPORT_SYMBOL_GPL(ahci_port_blk_complete);
+
+/**
+ * ahci_blk_identify - IDENTIFY DEVICE を発行する
+ * @port: ポートデバイス構造体 (開始済み)
+ * @id: 256 ワードの出力バッファ (カーネルメモリ)
+ *
+ * Return: 成功時0、失敗時負のエラーコード
+ */
+static int ahci_blk_identify(struct ahci_port_device *port, u16 *id)
+{
+    struct ahci_cmd_request req;
+    struct kvec kvec = { .iov_base = id, .iov_len = ATA_IDENTIFY_SIZE };
+    struct iov_iter iter;
+    int ret;
+    
+    memset(&req, 0, sizeof(req));
+    req.command = ATA_CMD_IDENTIFY_DEVICE;
+    req.buffer_len = ATA_IDENTIFY_SIZE;
+    req.timeout_ms = AHCI_CMD_DEFAULT_TIMEOUT_MS;
+    
+    /* SGバッファからカーネルバッファへコピーする */
+    iov_iter_kvec(&iter, ITER_DEST, &kvec, 1, ATA_IDENTIFY_SIZE);
+    ret = ahci_port_issue_cmd(port, &req, &iter, NULL);
+    if (ret)
+        return ret;
+    
+    return (req.status & ATA_STATUS_ERR) ? -EIO : 0;
+}
+
+/**
+ * ahci_blk_disable_write_cache - デバイスの揮発性ライトキャッシュを無効にする
+ * @port: ポートデバイス構造体 (開始済み)
+ * @id: IDENTIFY DEVICE データ
+ *
+ * フロントエンドは FLUSH を実装していないので、キャッシュが有効なままだと
+ * fsync やジャーナルのバリアがメディアに届かない。SET FEATURES (0x82) で
+ * 無効にし、書き込みの完了をメディアへの書き込みの完了にする。
+ * 設定はエラー回復の COMRESET 後も、Software Settings Preservation
+ * （IDENTIFY ワード79 ビット6、通常は有効）により保持される。
+ *
+ * Return: 成功時（キャッシュがない・既に無効の場合を含む）0、失敗時負のエラーコード
+ */
+static int ahci_blk_disable_write_cache(struct ahci_port_device *port, const u16 *id)
+{
+    struct ahci_cmd_request req;
+    int ret;
+    
+    if (!(id[ATA_ID_CMD_SET_1] & ATA_ID_CMD_SET_1_WCACHE) ||
+        !(id[ATA_ID_CMD_SET_EN_1] & ATA_ID_CMD_SET_1_WCACHE))
+        return 0;
+    
+    memset(&req, 0, sizeof(req));
+    req.command = ATA_CMD_SET_FEATURES;
+    req.features = ATA_SET_FEATURES_WC_OFF;
+    req.timeout_ms = AHCI_CMD_DEFAULT_TIMEOUT_MS;
+    
+    ret = ahci_port_issue_cmd(port, &req, NULL, NULL);
+    if (ret)
+        return ret;
+    if (req.status & ATA_STATUS_ERR)
+        return -EIO;
+    
+    dev_info(port->device, "blk: volatile write cache disabled\n");
+    return 0;
+}
+
+/**
+ * ahci_port_blk_add - ポートを blk-mq ディスクとして登録する
+ * @port: ポートデバイス構造体
+ *
+ * blk_frontend=1 の場合のみ動作する。ポートをリセット・開始して
+ * IDENTIFY DEVICE で容量と NCQ キュー深さを取得し、タグ数 =
+ * min(デバイスのキュー深さ, HBA のコマンドスロット数) のタグセットで
+ * /dev/ahci_lld<port>n を作成する。FLUSH を実装しないため、デバイスの
+ * ライトキャッシュは無効にしてから登録する。デバイスがない、LBA48 / NCQ 非対応、
+ * 割り込みが使えない場合は登録しない（0 を返す）。
+ *
+ * 割り込み登録後に呼ぶこと（完了は SDBS 割り込みで検出する）。
+ *
+ * Return: 成功時（登録しない場合を含む）0、失敗時負のエラーコード
+ */
+int ahci_port_blk_add(struct ahci_port_device *port)
+{
+    struct queue_limits lim = {
+        .logical_block_size = AHCI_BLK_SECTOR_SIZE,
+        .max_hw_sectors = AHCI_BLK_MAX_SECTORS,
+        .max_segments = AHCI_BLK_MAX_SEGMENTS,
+        .max_segment_size = AHCI_PRDT_MAX_BYTES,
+        .dma_alignment = AHCI_DIO_ALIGN - 1,
+    };
+    struct ahci_hba *hba = port->hba;
+    struct ahci_port_blk *blk;
+    struct gendisk *disk;
+    u32 cap, ssts;
+    unsigned int depth;
+    u64 sectors;
+    u16 *id;
+    int ret;
+    
+    if (!blk_frontend)
+        return 0;
+    
+    cap = ioread32(hba->mmio + AHCI_CAP);
+    if (!hba->irq_enabled || !(cap & AHCI_CAP_SNCQ)) {
+        dev_warn(port->device, "blk: frontend needs interrupts and CAP.SNCQ, not registering\n");
+        return 0;
+    }
+    
+    ssts = ioread32(port->port_mmio + AHCI_PORT_SSTS);
+    if ((ssts & AHCI_PORT_SSTS_DET) != AHCI_PORT_DET_ESTABLISHED)
+        return 0;
+    
+    ret = ahci_port_comreset(port);
+    if (ret)
+        return ret;
+    ret = ahci_port_start(port);
+    if (ret)
+        return ret;
+    
+    id = kmalloc_node(ATA_IDENTIFY_SIZE, GFP_KERNEL, port->node);
+    if (!id)
+        return -ENOMEM;
+    
+    ret = ahci_blk_identify(port, id);
+    if (ret) {
+        dev_err(port->device, "blk: IDENTIFY DEVICE failed (%d)\n", ret);
+        goto out_free_id;
+    }
+    
+    if (!(id[ATA_ID_CMD_SET_2] & ATA_ID_CMD_SET_2_LBA48) ||
+        !(id[ATA_ID_SATA_CAP] & ATA_ID_SATA_CAP_NCQ)) {
+        dev_warn(port->device, "blk: device lacks LBA48 or NCQ, not registering\n");
+        goto out_free_id;
+    }
+    
+    ret = ahci_blk_disable_write_cache(port, id);
+    if (ret) {
+        dev_err(port->device, "blk: failed to disable the write cache (%d)\n", ret);
+        goto out_free_id;
+    }
+    
+    sectors = (u64)id[ATA_ID_LBA48_SECTORS] |
+              ((u64)id[ATA_ID_LBA48_SECTORS + 1] << 16) |
+              ((u64)id[ATA_ID_LBA48_SECTORS + 2] << 32) |
+              ((u64)id[ATA_ID_LBA48_SECTORS + 3] << 48);
+    depth = min_t(unsigned int, (id[ATA_ID_NCQ_DEPTH] & 0x1F) + 1,
+                  ((cap & AHCI_CAP_NCS) >> 8) + 1);
+    
+    blk = kzalloc_node(sizeof(*blk), GFP_KERNEL, port->node);
+    if (!blk) {
+        ret = -ENOMEM;
+        goto out_free_id;
+    }
+    spin_lock_init(&blk->lock);
+    
+    /* Command Table の確保 (dma_pool_alloc) で sleep するため BLOCKING */
+    blk->tag_set.ops = &ahci_blk_mq_ops;
+    blk->tag_set.nr_hw_queues = 1;
+    blk->tag_set.queue_depth = depth;
+    blk->tag_set.numa_node = port->node;
+    blk->tag_set.cmd_size = sizeof(struct ahci_blk_cmd);
+    blk->tag_set.flags = BLK_MQ_F_BLOCKING;
+    blk->tag_set.driver_data = port;
+    
+    ret = blk_mq_alloc_tag_set(&blk->tag_set);
+    if (ret)
+        goto out_free_blk;
+    
+    disk = blk_mq_alloc_disk(&blk->tag_set, &lim, port);
+    if (IS_ERR(disk)) {
+        ret = PTR_ERR(disk);
+        goto out_free_tag_set;
+    }
+    
+    disk->fops = &ahci_blk_fops;
+    disk->private_data = port;
+    snprintf(disk->disk_name, DISK_NAME_LEN, "ahci_lld%dn", port->port_no);
+    set_capacity(disk, sectors);
+    blk->disk = disk;
+    
+    /* add_disk() のパーティション読み込みから I/O が来る */
+    port->blk = blk;
+    
+    ret = device_add_disk(&hba->pdev->dev, disk, NULL);
+    if (ret) {
+        port->blk = NULL;
+        goto out_put_disk;
+    }
+    
+    dev_info(port->device, "blk: %s: %llu sectors, queue depth %u\n",
+             disk->disk_name, sectors, depth);
+    kfree(id);
+    return 0;
+    
+out_put_disk:
+    put_disk(disk);
+out_free_tag_set:
+    blk_mq_free_tag_set(&blk->tag_set);
+out_free_blk:
+    kfree(blk);
+out_free_id:
+    kfree(id);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(ahci_port_blk_add);
+
+/**
+ * ahci_port_blk_remove - blk-mq ディスクを削除する
+ * @port: ポートデバイス構造体
+ *
+ * del_gendisk() は実行中の I/O の完了を待つので、割り込みの解放前に呼ぶこと。
+ */
+void ahci_port_blk_remove(struct ahci_port_device *port)
+{
+    struct ahci_port_blk *blk = port->blk;
+    
+    if (!blk)
+        return;
+    
+    del_gendisk(blk->disk);
+    put_disk(blk->disk);
+    blk_mq_free_tag_set(&blk->tag_set);
+    
+    port->blk = NULL;
+    kfree(blk);
+}
+EXPORT_SYMBOL_GPL(ahci_port_blk_remove);
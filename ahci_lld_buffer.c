@@ -7,18 +7,272 @@
 #include <linux/dma-mapping.h>
 #include <linux/slab.h>
 #include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/dmapool.h>
+#include <linux/module.h>
+#include <linux/shrinker.h>
+#include <linux/uio.h>
 #include "ahci_lld.h"
 #include "ahci_lld_fis.h"
 
+/* SGバッファの回収: low-water mark より上のバッファだけを解放する */
+static unsigned int sg_low_water = 8;
+module_param(sg_low_water, uint, 0644);
+MODULE_PARM_DESC(sg_low_water, "SG buffers (128KB) kept per port when reclaiming (default 8)");
+
+static unsigned int sg_idle_ms = 10000;
+module_param(sg_idle_ms, uint, 0644);
+MODULE_PARM_DESC(sg_idle_ms, "Reclaim SG buffers after this many ms without I/O, 0 = shrinker only (default 10000)");
+
+/**
+ * ahci_port_grow_sg_buffers - SGバッファを needed 個まで確保する
+ * @port: ポートデバイス構造体
+ * @needed: 必要なバッファ数
+ *
+ * チャンク (AHCI_SG_CHUNK_BUFFERS 個) の先頭から確保する場合は、まず 4MB の
+ * 連続領域を1回の dma_alloc_coherent() で確保して 128KB ずつに割り当てる。
+ * 隣接するSGバッファの DMA アドレスが連続するので、PRDT は 4MB まで
+ * 1エントリにまとめられる。連続領域が取れない場合は 128KB 単位で確保する。
+ *
+ * Context: sg_lock held (or port not yet visible)
+ * Return: 成功時0、確保失敗時-ENOMEM
+ */
+static int ahci_port_grow_sg_buffers(struct ahci_port_device *port, int needed)
+{
+    struct device *dev = &port->hba->pdev->dev;
+    
+    while (port->sg_buffer_count < needed) {
+        int i = port->sg_buffer_count;
+        
+        if (i % AHCI_SG_CHUNK_BUFFERS == 0) {
+            dma_addr_t dma;
+            void *virt;
+            int j;
+            
+            virt = dma_alloc_coherent(dev, AHCI_SG_CHUNK_SIZE, &dma,
+                                      GFP_KERNEL | __GFP_NOWARN);
+            if (virt) {
+                for (j = 0; j < AHCI_SG_CHUNK_BUFFERS; j++) {
+                    port->sg_buffers[i + j] = (u8 *)virt + j * AHCI_SG_BUFFER_SIZE;
+                    port->sg_buffers_dma[i + j] = dma + j * AHCI_SG_BUFFER_SIZE;
+                }
+                set_bit(i / AHCI_SG_CHUNK_BUFFERS, port->sg_chunk_map);
+                port->sg_buffer_count += AHCI_SG_CHUNK_BUFFERS;
+                port->sg_peak = max(port->sg_peak, port->sg_buffer_count);
+                continue;
+            }
+            
+            dev_dbg(port->device, "No contiguous %d KB chunk, falling back to %d KB buffers\n",
+                    AHCI_SG_CHUNK_SIZE / 1024, AHCI_SG_BUFFER_SIZE / 1024);
+        }
+        
+        port->sg_buffers[i] = dma_alloc_coherent(dev, AHCI_SG_BUFFER_SIZE,
+                                                  &port->sg_buffers_dma[i], GFP_KERNEL);
+        if (!port->sg_buffers[i]) {
+            dev_err(port->device, "Failed to allocate SG buffer %d\n", i);
+            return -ENOMEM;
+        }
+        port->sg_buffer_count++;
+        port->sg_peak = max(port->sg_peak, port->sg_buffer_count);
+    }
+    
+    return 0;
+}
+
+/**
+ * ahci_port_release_sg_buffers - SGバッファをすべて解放する
+ * @port: ポートデバイス構造体
+ */
+static void ahci_port_release_sg_buffers(struct ahci_port_device *port)
+{
+    struct device *dev = &port->hba->pdev->dev;
+    int i = 0;
+    
+    while (i < port->sg_buffer_count) {
+        int chunk = i / AHCI_SG_CHUNK_BUFFERS;
+        
+        /* 連続チャンクは先頭バッファのアドレスでまとめて解放 */
+        if (i % AHCI_SG_CHUNK_BUFFERS == 0 && test_bit(chunk, port->sg_chunk_map)) {
+            dma_free_coherent(dev, AHCI_SG_CHUNK_SIZE,
+                              port->sg_buffers[i], port->sg_buffers_dma[i]);
+            memset(&port->sg_buffers[i], 0, AHCI_SG_CHUNK_BUFFERS * sizeof(port->sg_buffers[0]));
+            clear_bit(chunk, port->sg_chunk_map);
+            i += AHCI_SG_CHUNK_BUFFERS;
+            continue;
+        }
+        
+        if (port->sg_buffers[i]) {
+            dma_free_coherent(dev, AHCI_SG_BUFFER_SIZE,
+                              port->sg_buffers[i], port->sg_buffers_dma[i]);
+            port->sg_buffers[i] = NULL;
+        }
+        i++;
+    }
+    port->sg_buffer_count = 0;
+}
+
+/**
+ * ahci_port_shrink_sg_buffers - 末尾の未使用SGバッファを解放する
+ * @port: ポートデバイス構造体
+ * @floor: 残すバッファ数の下限 (low-water mark)
+ * @nr: 解放するバッファ数の目安
+ *
+ * SGバッファはインデックス 0..sg_buffer_count-1 に詰めて確保されているため、
+ * 末尾からのみ解放できる。sg_map（コマンド・mmap 中のプール）で使用中の
+ * 最後のバッファより下は解放しない。連続チャンクは一部だけ解放できないので、
+ * チャンク全体が下限より上にある場合のみまとめて解放する。
+ *
+ * Context: sg_lock held
+ * Return: 解放したバッファ数
+ */
+static int ahci_port_shrink_sg_buffers(struct ahci_port_device *port, int floor,
+                                       unsigned long nr)
+{
+    struct device *dev = &port->hba->pdev->dev;
+    unsigned long last;
+    int freed = 0;
+    
+    last = find_last_bit(port->sg_map, port->sg_buffer_count);
+    if (last < port->sg_buffer_count)
+        floor = max_t(int, floor, last + 1);
+    
+    while (port->sg_buffer_count > floor && freed < nr) {
+        int i = port->sg_buffer_count - 1;
+        int chunk = i / AHCI_SG_CHUNK_BUFFERS;
+        
+        if (test_bit(chunk, port->sg_chunk_map)) {
+            int first = chunk * AHCI_SG_CHUNK_BUFFERS;
+            
+            if (first < floor)
+                break;
+            dma_free_coherent(dev, AHCI_SG_CHUNK_SIZE,
+                              port->sg_buffers[first], port->sg_buffers_dma[first]);
+            memset(&port->sg_buffers[first], 0, AHCI_SG_CHUNK_BUFFERS * sizeof(port->sg_buffers[0]));
+            clear_bit(chunk, port->sg_chunk_map);
+            freed += port->sg_buffer_count - first;
+            port->sg_buffer_count = first;
+            continue;
+        }
+        
+        dma_free_coherent(dev, AHCI_SG_BUFFER_SIZE, port->sg_buffers[i], port->sg_buffers_dma[i]);
+        port->sg_buffers[i] = NULL;
+        port->sg_buffer_count--;
+        freed++;
+    }
+    
+    if (freed) {
+        port->sg_reclaim_events++;
+        port->sg_reclaimed += freed;
+        dev_dbg(port->device, "Reclaimed %d SG buffers (remaining %d)\n",
+                freed, port->sg_buffer_count);
+    }
+    
+    return freed;
+}
+
+/**
+ * ahci_port_sg_reclaim_work - I/O が途絶えたポートのSGバッファを回収する
+ * @work: sg_reclaim_work
+ *
+ * ahci_port_sg_free() のたびに sg_idle_ms 後へ延期されるため、
+ * sg_idle_ms の間SGバッファの返却がなかったときだけ実行される。
+ */
+static void ahci_port_sg_reclaim_work(struct work_struct *work)
+{
+    struct ahci_port_device *port = container_of(to_delayed_work(work),
+                                                 struct ahci_port_device, sg_reclaim_work);
+    
+    mutex_lock(&port->sg_lock);
+    ahci_port_shrink_sg_buffers(port, sg_low_water, ULONG_MAX);
+    mutex_unlock(&port->sg_lock);
+}
+
+/**
+ * ahci_port_sg_idle_kick - アイドル回収のタイマーを sg_idle_ms 後へ延期する
+ * @port: ポートデバイス構造体
+ *
+ * ポート破棄中 (sg_shrinker == NULL) は予約しない。
+ *
+ * Context: sg_lock held
+ */
+static void ahci_port_sg_idle_kick(struct ahci_port_device *port)
+{
+    if (sg_idle_ms && port->sg_shrinker)
+        mod_delayed_work(system_wq, &port->sg_reclaim_work, msecs_to_jiffies(sg_idle_ms));
+}
+
+/**
+ * ahci_port_sg_shrink_count - shrinker: 回収できるSGバッファ数
+ * @shrinker: ポートの sg_shrinker
+ * @sc: shrink control
+ */
+static unsigned long ahci_port_sg_shrink_count(struct shrinker *shrinker,
+                                               struct shrink_control *sc)
+{
+    struct ahci_port_device *port = shrinker->private_data;
+    int count = READ_ONCE(port->sg_buffer_count);
+    unsigned long last;
+    int floor = sg_low_water;
+    
+    /* ロックなしの概算 (scan で sg_lock 下に再計算する) */
+    last = find_last_bit(port->sg_map, count);
+    if (last < count)
+        floor = max_t(int, floor, last + 1);
+    
+    return count > floor ? count - floor : 0;
+}
+
+/**
+ * ahci_port_sg_shrink_scan - shrinker: 最大 nr_to_scan 個のSGバッファを解放
+ * @shrinker: ポートの sg_shrinker
+ * @sc: shrink control
+ */
+static unsigned long ahci_port_sg_shrink_scan(struct shrinker *shrinker,
+                                              struct shrink_control *sc)
+{
+    struct ahci_port_device *port = shrinker->private_data;
+    int freed;
+    
+    /* SGバッファの確保中 (sg_lock 保持) に直接回収から呼ばれた場合は諦める */
+    if (!mutex_trylock(&port->sg_lock))
+        return SHRINK_STOP;
+    freed = ahci_port_shrink_sg_buffers(port, sg_low_water, sc->nr_to_scan);
+    mutex_unlock(&port->sg_lock);
+    
+    return freed ? freed : SHRINK_STOP;
+}
+
+/**
+ * ahci_port_free_large_tables - スロットに残っている large Command Table とプールを解放する
+ * @port: ポートデバイス構造体
+ */
+static void ahci_port_free_large_tables(struct ahci_port_device *port)
+{
+    int i;
+    
+    for (i = 0; i < 32; i++) {
+        if (port->slots[i].large_tbl) {
+            dma_pool_free(port->cmd_tbl_large_pool, port->slots[i].large_tbl,
+                          port->slots[i].large_tbl_dma);
+            port->slots[i].large_tbl = NULL;
+        }
+    }
+    
+    dma_pool_destroy(port->cmd_tbl_large_pool);
+    port->cmd_tbl_large_pool = NULL;
+}
+
 /**
  * ahci_port_alloc_dma_buffers - ポート用のDMAバッファを割り当てる
  * @port: ポートデバイス構造体
  *
  * AHCI仕様に従って以下のバッファを割り当てる:
- * - Command List: 1KB (1KB-aligned) - 32 command slots × 32 bytes
- * - Received FIS: 256 bytes (256-byte-aligned)
- * - Command Table: 4KB (128-byte-aligned, 簡略化のため4KB確保)
- * - Scatter-Gather buffers: 初期8個 (128KB × 8 = 1MB)
+ * - Arena: 1回の dma_alloc_coherent() で確保し、先頭から切り出す
+ *   - Command List: 1KB (1KB-aligned) - 32 command slots × 32 bytes
+ *   - Received FIS: 256 bytes (256-byte-aligned)
+ *   - Command Tables: 32スロット分の small テーブル (各512バイト、128-byte-aligned)
+ * - large Command Table 用の dma_pool (テーブルは必要時に取得)
+ * - Scatter-Gather buffers: 初期8個 (連続チャンクが取れた場合は 4MB 分の32個)
  *
  * Return: 成功時0、失敗時負のエラーコード
  */
@@ -27,75 +281,85 @@ int ahci_port_alloc_dma_buffers(struct ahci_port_device *port)
     struct device *dev = &port->hba->pdev->dev;
     int i;
     
+    /* 各領域の先頭が要求アライメントに揃うこと */
+    BUILD_BUG_ON(AHCI_ARENA_FIS_OFF % 256);
+    BUILD_BUG_ON(AHCI_ARENA_CMD_TBL_OFF % AHCI_CMD_TABLE_ALIGN);
+    BUILD_BUG_ON(AHCI_CMD_TABLE_SMALL_SIZE % AHCI_CMD_TABLE_ALIGN);
+    
     dev_info(port->device, "Allocating DMA buffers for port %d\n", port->port_no);
     
     /* Initialize SG buffer arrays and lock */
     memset(port->sg_buffers, 0, sizeof(port->sg_buffers));
     memset(port->sg_buffers_dma, 0, sizeof(port->sg_buffers_dma));
     port->sg_buffer_count = 0;
+    bitmap_zero(port->sg_map, AHCI_SG_BUFFER_COUNT);
+    bitmap_zero(port->sg_chunk_map, AHCI_SG_CHUNK_COUNT);
     mutex_init(&port->sg_lock);
+    INIT_DELAYED_WORK(&port->sg_reclaim_work, ahci_port_sg_reclaim_work);
     
-    /* Command List: 1KB, 1KB-aligned */
-    port->cmd_list = dma_alloc_coherent(dev, 1024, &port->cmd_list_dma, GFP_KERNEL);
-    if (!port->cmd_list) {
-        dev_err(port->device, "Failed to allocate command list\n");
+    /* Arena: ページ境界から確保されるので Command List の 1KB アライメントも満たす */
+    port->arena = dma_alloc_coherent(dev, AHCI_ARENA_SIZE, &port->arena_dma, GFP_KERNEL);
+    if (!port->arena) {
+        dev_err(port->device, "Failed to allocate DMA arena (%zu bytes)\n", (size_t)AHCI_ARENA_SIZE);
         return -ENOMEM;
     }
-    memset(port->cmd_list, 0, 1024);
-    dev_info(port->device, "Command List: virt=%px dma=0x%llx\n",
-             port->cmd_list, (u64)port->cmd_list_dma);
+    memset(port->arena, 0, AHCI_ARENA_SIZE);
     
-    /* Received FIS: 256 bytes, 256-byte-aligned */
-    port->fis_area = dma_alloc_coherent(dev, 256, &port->fis_area_dma, GFP_KERNEL);
-    if (!port->fis_area) {
-        dev_err(port->device, "Failed to allocate FIS area\n");
-        goto err_free_cmd_list;
+    port->cmd_list = port->arena + AHCI_ARENA_CMD_LIST_OFF;
+    port->cmd_list_dma = port->arena_dma + AHCI_ARENA_CMD_LIST_OFF;
+    port->fis_area = port->arena + AHCI_ARENA_FIS_OFF;
+    port->fis_area_dma = port->arena_dma + AHCI_ARENA_FIS_OFF;
+    for (i = 0; i < 32; i++) {
+        port->cmd_tables[i] = port->arena + AHCI_ARENA_CMD_TBL_OFF +
+                              i * AHCI_CMD_TABLE_SMALL_SIZE;
+        port->cmd_tables_dma[i] = port->arena_dma + AHCI_ARENA_CMD_TBL_OFF +
+                                  i * AHCI_CMD_TABLE_SMALL_SIZE;
     }
-    memset(port->fis_area, 0, 256);
-    dev_info(port->device, "FIS Area: virt=%px dma=0x%llx\n",
-             port->fis_area, (u64)port->fis_area_dma);
+    dev_info(port->device, "DMA Arena: virt=%px dma=0x%llx size=%zu (CL +0x%x, FIS +0x%x, CT +0x%x)\n",
+             port->arena, (u64)port->arena_dma, (size_t)AHCI_ARENA_SIZE, AHCI_ARENA_CMD_LIST_OFF,
+             AHCI_ARENA_FIS_OFF, AHCI_ARENA_CMD_TBL_OFF);
     
-    /* Command Table: 4KB (128バイトアライメント必要、簡略化のため4KB確保) */
-    port->cmd_table = dma_alloc_coherent(dev, 4096, &port->cmd_table_dma, GFP_KERNEL);
-    if (!port->cmd_table) {
-        dev_err(port->device, "Failed to allocate command table\n");
-        goto err_free_fis;
+    /* large Command Table: PRDT が small テーブルに収まらないコマンドのときだけ取得 */
+    port->cmd_tbl_large_pool = dma_pool_create("ahci_lld_cmd_tbl_large", dev,
+                                               AHCI_CMD_TABLE_LARGE_SIZE,
+                                               AHCI_CMD_TABLE_ALIGN, 0);
+    if (!port->cmd_tbl_large_pool) {
+        dev_err(port->device, "Failed to create command table pool\n");
+        goto err_free_arena;
     }
-    memset(port->cmd_table, 0, 4096);
-    dev_info(port->device, "Command Table: virt=%px dma=0x%llx\n",
-             port->cmd_table, (u64)port->cmd_table_dma);
+    dev_info(port->device, "Command Tables: 32 x %zu bytes (%d PRDT), large %zu bytes (%d PRDT)\n",
+             (size_t)AHCI_CMD_TABLE_SMALL_SIZE, AHCI_CMD_TABLE_SMALL_PRDT,
+             (size_t)AHCI_CMD_TABLE_LARGE_SIZE, AHCI_CMD_TABLE_MAX_PRDT);
     
     /* Scatter-Gather buffers: 初期8個 (128KB each) */
-    for (i = 0; i < 8; i++) {
-        port->sg_buffers[i] = dma_alloc_coherent(dev, AHCI_SG_BUFFER_SIZE,
-                                                  &port->sg_buffers_dma[i], GFP_KERNEL);
-        if (!port->sg_buffers[i]) {
-            dev_err(port->device, "Failed to allocate SG buffer %d\n", i);
-            goto err_free_sg;
-        }
-        port->sg_buffer_count++;
+    if (ahci_port_grow_sg_buffers(port, 8))
+        goto err_free_sg;
+    dev_info(port->device, "Allocated %d SG buffers (128KB each, %s)\n", port->sg_buffer_count,
+             test_bit(0, port->sg_chunk_map) ? "contiguous" : "scattered");
+    
+    /* メモリ逼迫時に low-water mark より上のSGバッファを返す */
+    port->sg_shrinker = shrinker_alloc(0, "ahci_lld-p%d", port->port_no);
+    if (!port->sg_shrinker) {
+        dev_err(port->device, "Failed to allocate SG buffer shrinker\n");
+        goto err_free_sg;
     }
-    dev_info(port->device, "Allocated %d SG buffers (128KB each)\n", port->sg_buffer_count);
+    port->sg_shrinker->count_objects = ahci_port_sg_shrink_count;
+    port->sg_shrinker->scan_objects = ahci_port_sg_shrink_scan;
+    port->sg_shrinker->private_data = port;
+    shrinker_register(port->sg_shrinker);
     
     dev_info(port->device, "DMA buffers allocated successfully\n");
     return 0;
 
 err_free_sg:
-    for (i = 0; i < port->sg_buffer_count; i++) {
-        if (port->sg_buffers[i]) {
-            dma_free_coherent(dev, AHCI_SG_BUFFER_SIZE,
-                            port->sg_buffers[i], port->sg_buffers_dma[i]);
-            port->sg_buffers[i] = NULL;
-        }
-    }
-    dma_free_coherent(dev, 4096, port->cmd_table, port->cmd_table_dma);
-    port->cmd_table = NULL;
-err_free_fis:
-    dma_free_coherent(dev, 256, port->fis_area, port->fis_area_dma);
-    port->fis_area = NULL;
-err_free_cmd_list:
-    dma_free_coherent(dev, 1024, port->cmd_list, port->cmd_list_dma);
+    ahci_port_release_sg_buffers(port);
+    ahci_port_free_large_tables(port);
+err_free_arena:
+    dma_free_coherent(dev, AHCI_ARENA_SIZE, port->arena, port->arena_dma);
+    port->arena = NULL;
     port->cmd_list = NULL;
+    port->fis_area = NULL;
+    memset(port->cmd_tables, 0, sizeof(port->cmd_tables));
     return -ENOMEM;
 }
 
@@ -106,37 +370,32 @@ err_free_cmd_list:
 void ahci_port_free_dma_buffers(struct ahci_port_device *port)
 {
     struct device *dev = &port->hba->pdev->dev;
-    int i;
+    struct shrinker *shrinker;
     
-    if (!port->cmd_list)
+    if (!port->arena)
         return;
     
     dev_info(port->device, "Freeing DMA buffers for port %d\n", port->port_no);
     
-    /* Free all SG buffers */
-    for (i = 0; i < port->sg_buffer_count; i++) {
-        if (port->sg_buffers[i]) {
-            dma_free_coherent(dev, AHCI_SG_BUFFER_SIZE,
-                            port->sg_buffers[i], port->sg_buffers_dma[i]);
-            port->sg_buffers[i] = NULL;
-        }
-    }
-    port->sg_buffer_count = 0;
+    /* 回収処理を止めてから解放する（以降の sg_free はタイマーを予約しない） */
+    mutex_lock(&port->sg_lock);
+    shrinker = port->sg_shrinker;
+    port->sg_shrinker = NULL;
+    mutex_unlock(&port->sg_lock);
+    shrinker_free(shrinker);
+    cancel_delayed_work_sync(&port->sg_reclaim_work);
     
-    if (port->cmd_table) {
-        dma_free_coherent(dev, 4096, port->cmd_table, port->cmd_table_dma);
-        port->cmd_table = NULL;
-    }
+    /* Free all SG buffers */
+    ahci_port_release_sg_buffers(port);
     
-    if (port->fis_area) {
-        dma_free_coherent(dev, 256, port->fis_area, port->fis_area_dma);
-        port->fis_area = NULL;
-    }
+    ahci_port_free_large_tables(port);
     
-    if (port->cmd_list) {
-        dma_free_coherent(dev, 1024, port->cmd_list, port->cmd_list_dma);
-        port->cmd_list = NULL;
-    }
+    /* Command List / FIS / Command Tables はまとめて解放 */
+    dma_free_coherent(dev, AHCI_ARENA_SIZE, port->arena, port->arena_dma);
+    port->arena = NULL;
+    port->cmd_list = NULL;
+    port->fis_area = NULL;
+    memset(port->cmd_tables, 0, sizeof(port->cmd_tables));
     
     dev_info(port->device, "DMA buffers freed\n");
 }
@@ -150,8 +409,8 @@ void ahci_port_free_dma_buffers(struct ahci_port_device *port)
  */
 int ahci_port_ensure_sg_buffers(struct ahci_port_device *port, int needed)
 {
-    struct device *dev = &port->hba->pdev->dev;
-    int i;
+    int prev;
+    int ret;
     
     if (needed > AHCI_SG_BUFFER_COUNT) {
         dev_err(port->device, "Requested %d SG buffers exceeds max %d\n",
@@ -167,23 +426,524 @@ int ahci_port_ensure_sg_buffers(struct ahci_port_device *port, int needed)
     }
     
     /* Allocate additional buffers */
-    for (i = port->sg_buffer_count; i < needed; i++) {
-        port->sg_buffers[i] = dma_alloc_coherent(dev, AHCI_SG_BUFFER_SIZE,
-                                                  &port->sg_buffers_dma[i], GFP_KERNEL);
-        if (!port->sg_buffers[i]) {
-            dev_err(port->device, "Failed to allocate SG buffer %d\n", i);
-            mutex_unlock(&port->sg_lock);
-            return -ENOMEM;
+    prev = port->sg_buffer_count;
+    ret = ahci_port_grow_sg_buffers(port, needed);
+    
+    dev_info(port->device, "Allocated %d additional SG buffers (total: %d)\n",
+             port->sg_buffer_count - prev, port->sg_buffer_count);
+    
+    mutex_unlock(&port->sg_lock);
+    return ret;
+}
+
+/**
+ * ahci_port_sg_alloc - コマンド専用のSGバッファ範囲を割り当てる
+ * @port: ポートデバイス構造体
+ * @count: 必要なバッファ数
+ *
+ * sg_map（ビットマップ）から連続した空きインデックスを first-fit で探し、
+ * 実体のSGバッファが未確保であれば確保する。同時に実行中の NCQ コマンドが
+ * 同じSGバッファへDMAしないよう、スロットごとに専用の範囲を持たせる。
+ *
+ * Return: 先頭インデックス、空きがない場合-EBUSY、確保失敗時負のエラーコード
+ */
+int ahci_port_sg_alloc(struct ahci_port_device *port, int count)
+{
+    unsigned long start;
+    int ret;
+    
+    if (count <= 0 || count > AHCI_SG_BUFFER_COUNT)
+        return -EINVAL;
+    
+    mutex_lock(&port->sg_lock);
+    start = bitmap_find_next_zero_area(port->sg_map, AHCI_SG_BUFFER_COUNT, 0, count, 0);
+    if (start >= AHCI_SG_BUFFER_COUNT) {
+        mutex_unlock(&port->sg_lock);
+        dev_dbg(port->device, "No free SG extent for %d buffers\n", count);
+        return -EBUSY;
+    }
+    bitmap_set(port->sg_map, start, count);
+    mutex_unlock(&port->sg_lock);
+    
+    ret = ahci_port_ensure_sg_buffers(port, start + count);
+    if (ret) {
+        ahci_port_sg_free(port, start, count);
+        return ret;
+    }
+    
+    return start;
+}
+
+/**
+ * ahci_port_sg_free - SGバッファ範囲を返却する
+ * @port: ポートデバイス構造体
+ * @start: 先頭インデックス
+ * @count: バッファ数 (0 の場合は何もしない)
+ */
+void ahci_port_sg_free(struct ahci_port_device *port, int start, int count)
+{
+    if (count <= 0)
+        return;
+    
+    mutex_lock(&port->sg_lock);
+    bitmap_clear(port->sg_map, start, count);
+    ahci_port_sg_idle_kick(port);
+    mutex_unlock(&port->sg_lock);
+}
+
+/**
+ * ahci_port_sg_copy_from_iter - ユーザーデータをSGバッファ範囲へコピーする (Write)
+ * @port: ポートデバイス構造体
+ * @start: 先頭インデックス
+ * @from: コピー元 (ユーザーバッファの iov_iter)
+ * @len: バイト数
+ *
+ * SGバッファ1個 (128KB) ずつ直接コピーし、中間のカーネルバッファは使わない。
+ *
+ * Return: 成功時0、ユーザーバッファにアクセスできない場合-EFAULT
+ */
+int ahci_port_sg_copy_from_iter(struct ahci_port_device *port, int start,
+                                struct iov_iter *from, u32 len)
+{
+    u32 offset = 0;
+    int i;
+    
+    for (i = start; offset < len; i++) {
+        u32 chunk = min_t(u32, len - offset, AHCI_SG_BUFFER_SIZE);
+        if (copy_from_iter(port->sg_buffers[i], chunk, from) != chunk)
+            return -EFAULT;
+        offset += chunk;
+    }
+    return 0;
+}
+
+/**
+ * ahci_port_sg_copy_to_iter - SGバッファ範囲からユーザーバッファへコピーする (Read)
+ * @port: ポートデバイス構造体
+ * @start: 先頭インデックス
+ * @to: コピー先 (ユーザーバッファの iov_iter)
+ * @len: バイト数
+ *
+ * Return: 成功時0、ユーザーバッファにアクセスできない場合-EFAULT
+ */
+int ahci_port_sg_copy_to_iter(struct ahci_port_device *port, int start,
+                              struct iov_iter *to, u32 len)
+{
+    u32 offset = 0;
+    int i;
+    
+    for (i = start; offset < len; i++) {
+        u32 chunk = min_t(u32, len - offset, AHCI_SG_BUFFER_SIZE);
+        if (copy_to_iter(port->sg_buffers[i], chunk, to) != chunk)
+            return -EFAULT;
+        offset += chunk;
+    }
+    return 0;
+}
+
+/**
+ * ahci_port_pool_release - 参照も mmap もなくなったプールのバッファを返却する
+ * @port: ポートデバイス構造体
+ * @start: 先頭インデックス
+ * @count: バッファ数
+ *
+ * 返却後のバッファは再びコマンドのバウンスバッファとして使われ、
+ * アイドル回収・shrinker の対象にもなる。
+ *
+ * Context: sg_lock held
+ */
+static void ahci_port_pool_release(struct ahci_port_device *port, int start, int count)
+{
+    int i;
+    
+    for (i = start; i < start + count; i++) {
+        if (!port->sg_pool_refs[i] && !test_bit(i, port->sg_pool_map))
+            clear_bit(i, port->sg_map);
+    }
+    ahci_port_sg_idle_kick(port);
+}
+
+/**
+ * ahci_port_pool_put - コマンドが参照していたプール範囲を返す
+ * @port: ポートデバイス構造体
+ * @start: 先頭インデックス
+ * @count: バッファ数 (0 の場合は何もしない)
+ *
+ * 実行中に munmap された範囲は、最後の参照がなくなった時点で返却する。
+ */
+void ahci_port_pool_put(struct ahci_port_device *port, int start, int count)
+{
+    int i;
+    
+    if (count <= 0)
+        return;
+    
+    mutex_lock(&port->sg_lock);
+    for (i = start; i < start + count; i++)
+        port->sg_pool_refs[i]--;
+    ahci_port_pool_release(port, start, count);
+    mutex_unlock(&port->sg_lock);
+}
+
+/**
+ * ahci_port_pool_vma_close - SGバッファプールの munmap 時にバッファを返却する
+ * @vma: プールをマップしていた VMA
+ *
+ * 実行中のコマンドが参照しているバッファは sg_map に残し、
+ * ahci_port_pool_put() で参照がなくなったときに返却する。
+ */
+static void ahci_port_pool_vma_close(struct vm_area_struct *vma)
+{
+    struct ahci_port_device *port = vma->vm_private_data;
+    unsigned long offset = (vma->vm_pgoff << PAGE_SHIFT) - AHCI_SG_POOL_OFFSET;
+    int start = offset / AHCI_SG_BUFFER_SIZE;
+    int count = (vma->vm_end - vma->vm_start) / AHCI_SG_BUFFER_SIZE;
+    
+    mutex_lock(&port->sg_lock);
+    bitmap_clear(port->sg_pool_map, start, count);
+    ahci_port_pool_release(port, start, count);
+    mutex_unlock(&port->sg_lock);
+    
+    dev_dbg(port->device, "SG pool: unmapped buffers %d-%d\n", start, start + count - 1);
+}
+
+/* 予約範囲を VMA 単位で管理するため、部分 munmap による分割は許さない */
+static int ahci_port_pool_vma_may_split(struct vm_area_struct *vma, unsigned long addr)
+{
+    return -EINVAL;
+}
+
+static const struct vm_operations_struct ahci_port_pool_vm_ops = {
+    .close = ahci_port_pool_vma_close,
+    .may_split = ahci_port_pool_vma_may_split,
+};
+
+/**
+ * ahci_port_pool_remap - 同じ確保単位内の連続したSGバッファを VMA の一部にマップする
+ * @port: ポートデバイス構造体
+ * @vma: マップ先の VMA
+ * @addr: マップ先のユーザーアドレス (VMA 内)
+ * @idx: 先頭のSGバッファのインデックス
+ * @count: バッファ数 (idx と同じ連続チャンク、または 1)
+ *
+ * dma_mmap_coherent() は VMA 全体を1つの確保単位に対応付けるので、
+ * dma_get_sgtable() で確保単位のページを取り出し、必要な部分だけを
+ * remap_pfn_range() で VMA の途中にマップする。AHCI は DMA コヒーレントな
+ * PCI デバイスなので、vm_page_prot はそのまま使う。
+ *
+ * Context: sg_lock not held (the buffers are reserved in sg_map)
+ * Return: 成功時0、失敗時負のエラーコード
+ */
+static int ahci_port_pool_remap(struct ahci_port_device *port, struct vm_area_struct *vma,
+                                unsigned long addr, int idx, int count)
+{
+    struct device *dev = &port->hba->pdev->dev;
+    unsigned long len = (unsigned long)count * AHCI_SG_BUFFER_SIZE;
+    size_t alloc_size = AHCI_SG_BUFFER_SIZE;
+    struct scatterlist *sg;
+    struct sg_table sgt;
+    unsigned long skip;
+    int base = idx;
+    int ret;
+    int i;
+    
+    if (test_bit(idx / AHCI_SG_CHUNK_BUFFERS, port->sg_chunk_map)) {
+        base = round_down(idx, AHCI_SG_CHUNK_BUFFERS);
+        alloc_size = AHCI_SG_CHUNK_SIZE;
+    }
+    skip = (unsigned long)(idx - base) * AHCI_SG_BUFFER_SIZE;
+    
+    ret = dma_get_sgtable(dev, &sgt, port->sg_buffers[base], port->sg_buffers_dma[base],
+                          alloc_size);
+    if (ret)
+        return ret;
+    
+    for_each_sgtable_sg(&sgt, sg, i) {
+        unsigned long n;
+        
+        if (skip >= sg->length) {
+            skip -= sg->length;
+            continue;
         }
-        port->sg_buffer_count++;
+        
+        n = min_t(unsigned long, sg->length - skip, len);
+        ret = remap_pfn_range(vma, addr, page_to_pfn(sg_page(sg)) + (skip >> PAGE_SHIFT),
+                              n, vma->vm_page_prot);
+        if (ret)
+            break;
+        addr += n;
+        len -= n;
+        skip = 0;
+        if (!len)
+            break;
     }
     
-    dev_info(port->device, "Allocated %d additional SG buffers (total: %d)\n",
-             needed - (port->sg_buffer_count - (needed - port->sg_buffer_count)),
-             port->sg_buffer_count);
+    sg_free_table(&sgt);
+    return ret;
+}
+
+/**
+ * ahci_port_pool_mmap - SGバッファプールの一部をユーザー空間にマップする
+ * @port: ポートデバイス構造体
+ * @vma: マップ先の VMA (offset は AHCI_SG_POOL_OFFSET 以上)
+ *
+ * offset - AHCI_SG_POOL_OFFSET と長さは AHCI_SG_POOL_CHUNK 単位であること。
+ * 対応するSGバッファを sg_map で予約してコマンドのバウンス用途から外し、
+ * 確保単位ごとに ahci_port_pool_remap() でマップする。AHCI_CMD_FLAG_POOL 付きのコマンドは
+ * この範囲にデバイスから直接 DMA するため、コピーも pin も発生しない。
+ * 予約は munmap（VMA の close）で解除される。
+ *
+ * Return: 成功時0、範囲がコマンドまたは他のマップで使用中の場合-EBUSY、
+ *         その他負のエラーコード
+ */
+int ahci_port_pool_mmap(struct ahci_port_device *port, struct vm_area_struct *vma)
+{
+    unsigned long offset = (vma->vm_pgoff << PAGE_SHIFT) - AHCI_SG_POOL_OFFSET;
+    unsigned long size = vma->vm_end - vma->vm_start;
+    int start, count;
+    int ret = 0;
+    int i, n;
+    
+    BUILD_BUG_ON(AHCI_SG_POOL_CHUNK != AHCI_SG_BUFFER_SIZE);
+    BUILD_BUG_ON(AHCI_SG_POOL_SIZE != AHCI_MAX_TRANSFER_SIZE);
     
+    /* デバイスが書いたデータをそのまま見せるので MAP_SHARED のみ */
+    if (!(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
+    
+    if (!IS_ALIGNED(offset | size, AHCI_SG_BUFFER_SIZE) || size == 0 ||
+        offset + size > AHCI_SG_POOL_SIZE)
+        return -EINVAL;
+    
+    start = offset / AHCI_SG_BUFFER_SIZE;
+    count = size / AHCI_SG_BUFFER_SIZE;
+    
+    mutex_lock(&port->sg_lock);
+    if (find_next_bit(port->sg_map, start + count, start) < start + count) {
+        mutex_unlock(&port->sg_lock);
+        dev_dbg(port->device, "SG pool: buffers %d-%d busy\n", start, start + count - 1);
+        return -EBUSY;
+    }
+    bitmap_set(port->sg_map, start, count);
+    bitmap_set(port->sg_pool_map, start, count);
     mutex_unlock(&port->sg_lock);
+    
+    ret = ahci_port_ensure_sg_buffers(port, start + count);
+    if (ret)
+        goto err_release;
+    
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP | VM_DONTCOPY);
+    
+    /*
+     * SGバッファは連続チャンクまたは 128KB 単位で別々に確保されているので、
+     * 確保した単位ごとに VMA の該当部分へマップする
+     */
+    for (i = 0; i < count; i += n) {
+        int idx = start + i;
+        
+        n = 1;
+        if (test_bit(idx / AHCI_SG_CHUNK_BUFFERS, port->sg_chunk_map))
+            n = min(count - i, (int)(round_down(idx, AHCI_SG_CHUNK_BUFFERS) +
+                                     AHCI_SG_CHUNK_BUFFERS - idx));
+        
+        ret = ahci_port_pool_remap(port, vma,
+                                   vma->vm_start + (unsigned long)i * AHCI_SG_BUFFER_SIZE,
+                                   idx, n);
+        /* 途中までマップした分は mmap 失敗時にコア側で解除される */
+        if (ret)
+            goto err_release;
+    }
+    
+    vma->vm_ops = &ahci_port_pool_vm_ops;
+    vma->vm_private_data = port;
+    
+    dev_info(port->device, "SG pool: mapped buffers %d-%d (%lu bytes)\n",
+             start, start + count - 1, size);
     return 0;
+
+err_release:
+    mutex_lock(&port->sg_lock);
+    bitmap_clear(port->sg_pool_map, start, count);
+    bitmap_clear(port->sg_map, start, count);
+    mutex_unlock(&port->sg_lock);
+    dev_err(port->device, "SG pool: failed to map buffers %d-%d (%d)\n",
+            start, start + count - 1, ret);
+    return ret;
+}
+
+/**
+ * ahci_port_pool_build_prdt - mmap 済みプールの範囲から PRDT を構築する
+ * @port: ポートデバイス構造体
+ * @slot: スロット番号 (参照する範囲を記録する)
+ * @req: コマンドリクエスト構造体 (buffer = プール先頭からのオフセット)
+ * @prdt: PRDT
+ * @max: PRDT エントリ数の上限 (Command Table の容量)
+ *
+ * 範囲はすべて現在 mmap されているSGバッファ内にあること。
+ * DMA アドレスが連続するSGバッファ（同じ連続チャンク内）は1エントリにまとめる。
+ * 範囲の各バッファの参照カウントを増やしてスロットに記録するので、コマンドの
+ * 実行中に munmap されてもバッファは回収・再利用されない（ahci_free_slot() で返す）。
+ *
+ * Return: 構築した PRDT エントリ数、失敗時負のエラーコード
+ */
+int ahci_port_pool_build_prdt(struct ahci_port_device *port, int slot,
+                              struct ahci_cmd_request *req,
+                              struct ahci_prdt_entry *prdt, int max)
+{
+    u64 offset = req->buffer;
+    u32 remaining = req->buffer_len;
+    unsigned long flags;
+    int first, last;
+    int count = 0;
+    int i;
+    
+    if (!IS_ALIGNED(offset | remaining, AHCI_DIO_ALIGN) || remaining == 0 ||
+        offset >= AHCI_SG_POOL_SIZE || remaining > AHCI_SG_POOL_SIZE - offset)
+        return -EINVAL;
+    
+    first = offset / AHCI_SG_BUFFER_SIZE;
+    last = (offset + remaining - 1) / AHCI_SG_BUFFER_SIZE;
+    
+    /* munmap・回収と競合しないよう、参照を取るまで sg_lock を保持する */
+    mutex_lock(&port->sg_lock);
+    if (find_next_zero_bit(port->sg_pool_map, last + 1, first) <= last) {
+        mutex_unlock(&port->sg_lock);
+        return -EINVAL;
+    }
+    
+    while (remaining > 0) {
+        int idx = offset / AHCI_SG_BUFFER_SIZE;
+        u32 off = offset % AHCI_SG_BUFFER_SIZE;
+        u32 chunk = min_t(u32, remaining, AHCI_SG_BUFFER_SIZE - off);
+        
+        count = ahci_prdt_append(prdt, count, max, port->sg_buffers_dma[idx] + off, chunk);
+        if (count < 0) {
+            mutex_unlock(&port->sg_lock);
+            return count;
+        }
+        offset += chunk;
+        remaining -= chunk;
+    }
+    
+    for (i = first; i <= last; i++)
+        port->sg_pool_refs[i]++;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    port->slots[slot].pool_start = first;
+    port->slots[slot].pool_count = last - first + 1;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    mutex_unlock(&port->sg_lock);
+    
+    return count;
+}
+
+/**
+ * ahci_port_get_cmd_table - PRDT 数に合った Command Table を選ぶ
+ * @port: ポートデバイス構造体
+ * @slot: スロット番号
+ * @prdt_count: 必要な PRDT エントリ数の上限
+ * @dma: Command Table の DMA アドレス (CTBA) を返す
+ * @max: Command Table に入る PRDT エントリ数を返す
+ *
+ * AHCI_CMD_TABLE_SMALL_PRDT 以下なら事前確保済みの small テーブルを返す。
+ * 超える場合は large プールから取得し、スロットに記録する（ahci_free_slot()
+ * または ahci_port_put_cmd_table() で返却）。返すテーブルは CFIS/ACMD 部分のみ
+ * ゼロクリア済みで、PRDT は呼び出し元が使う分だけ書き込む。
+ *
+ * Return: Command Table、large テーブルの確保に失敗した場合NULL
+ */
+struct ahci_cmd_table *ahci_port_get_cmd_table(struct ahci_port_device *port, int slot,
+                                               int prdt_count, dma_addr_t *dma, int *max)
+{
+    struct ahci_cmd_slot *cmd_slot = &port->slots[slot];
+    struct ahci_cmd_table *tbl;
+    unsigned long flags;
+    
+    if (prdt_count <= AHCI_CMD_TABLE_SMALL_PRDT) {
+        tbl = port->cmd_tables[slot];
+        *dma = port->cmd_tables_dma[slot];
+        *max = AHCI_CMD_TABLE_SMALL_PRDT;
+    } else {
+        if (!cmd_slot->large_tbl) {
+            dma_addr_t large_dma;
+            
+            tbl = dma_pool_alloc(port->cmd_tbl_large_pool, GFP_KERNEL, &large_dma);
+            if (!tbl)
+                return NULL;
+            
+            spin_lock_irqsave(&port->slot_lock, flags);
+            cmd_slot->large_tbl = tbl;
+            cmd_slot->large_tbl_dma = large_dma;
+            spin_unlock_irqrestore(&port->slot_lock, flags);
+        }
+        tbl = cmd_slot->large_tbl;
+        *dma = cmd_slot->large_tbl_dma;
+        *max = AHCI_CMD_TABLE_MAX_PRDT;
+    }
+    
+    memset(tbl, 0, offsetof(struct ahci_cmd_table, prdt));
+    return tbl;
+}
+
+/**
+ * ahci_port_put_cmd_table - large Command Table をプールへ返却する
+ * @port: ポートデバイス構造体
+ * @tbl: large テーブル (NULL の場合は何もしない)
+ * @dma: large テーブルの DMA アドレス
+ */
+void ahci_port_put_cmd_table(struct ahci_port_device *port, struct ahci_cmd_table *tbl,
+                             dma_addr_t dma)
+{
+    if (tbl)
+        dma_pool_free(port->cmd_tbl_large_pool, tbl, dma);
+}
+
+/**
+ * ahci_prdt_append - PRDT に DMA 範囲を追加する
+ * @prdt: PRDT
+ * @count: 現在のエントリ数
+ * @max: エントリ数の上限
+ * @addr: DMA アドレス
+ * @len: バイト数
+ *
+ * 直前のエントリの終端と addr が連続していれば、そのエントリを
+ * AHCI_PRDT_MAX_BYTES (DBC 22 bits = 4MB) まで伸ばす。残りは新しいエントリに
+ * 4MB ずつ分割して追加する。
+ *
+ * Return: 追加後のエントリ数、max を超える場合-EINVAL
+ */
+int ahci_prdt_append(struct ahci_prdt_entry *prdt, int count, int max,
+                     dma_addr_t addr, u32 len)
+{
+    while (len > 0) {
+        u32 chunk;
+        
+        if (count > 0) {
+            struct ahci_prdt_entry *last = &prdt[count - 1];
+            u32 last_len = (last->dbc & AHCI_PRDT_DBC_MASK) + 1;
+            
+            if (last->dba + last_len == addr && last_len < AHCI_PRDT_MAX_BYTES) {
+                chunk = min_t(u32, len, AHCI_PRDT_MAX_BYTES - last_len);
+                last->dbc = last_len + chunk - 1;  /* 0-based */
+                addr += chunk;
+                len -= chunk;
+                continue;
+            }
+        }
+        
+        if (count >= max)
+            return -EINVAL;
+        
+        chunk = min_t(u32, len, AHCI_PRDT_MAX_BYTES);
+        prdt[count].dba = addr;
+        prdt[count].reserved = 0;
+        prdt[count].dbc = chunk - 1;  /* 0-based */
+        addr += chunk;
+        len -= chunk;
+        count++;
+    }
+    
+    return count;
 }
 
 /**
@@ -221,4 +981,13 @@ int ahci_port_setup_dma(struct ahci_port_device *port)
 EXPORT_SYMBOL_GPL(ahci_port_alloc_dma_buffers);
 EXPORT_SYMBOL_GPL(ahci_port_free_dma_buffers);
 EXPORT_SYMBOL_GPL(ahci_port_ensure_sg_buffers);
+EXPORT_SYMBOL_GPL(ahci_port_sg_alloc);
+EXPORT_SYMBOL_GPL(ahci_port_sg_free);
+EXPORT_SYMBOL_GPL(ahci_port_sg_copy_from_iter);
+EXPORT_SYMBOL_GPL(ahci_port_sg_copy_to_iter);
+EXPORT_SYMBOL_GPL(ahci_port_pool_mmap);
+EXPORT_SYMBOL_GPL(ahci_port_pool_build_prdt);
+EXPORT_SYMBOL_GPL(ahci_port_get_cmd_table);
+EXPORT_SYMBOL_GPL(ahci_port_put_cmd_table);
+EXPORT_SYMBOL_GPL(ahci_prdt_append);
 EXPORT_SYMBOL_GPL(ahci_port_setup_dma);
@@ -4,88 +4,325 @@
 
 #include <linux/kernel.h>
 #include <linux/delay.h>
+#include <linux/completion.h>
+#include <linux/wait.h>
+#include <linux/sched/mm.h>
+#include <linux/uio.h>
 #include "ahci_lld.h"
 #include "ahci_lld_fis.h"
 
 /**
- * ahci_port_issue_cmd - ATA コマンドを発行（NCQ/Non-NCQ両対応）
+ * ahci_port_ci_done - PxCI の該当スロットビットを1回確認する
  * @port: ポートデバイス構造体
- * @req: コマンドリクエスト構造体 (入出力)
- * @buf: データバッファ (read時は出力、write時は入力)
+ * @slot_bit: スロットのビット
+ * @is_out: 観測した PxIS（割り込みハンドラがクリアした分を含む）
  *
- * ATAコマンドを発行する。NCQフラグにより動作が変わる：
- * - NCQフラグなし: slot 0でコマンド発行、完了まで待機、D2H FIS読み取り
- * - NCQフラグあり: req->tagでスロット指定、PxSACT+PxCI使用、キューイング完了まで待機
- * 
- * Return: 成功時0、失敗時負のエラーコード
+ * Return: 完了時1、未完了時0、エラー割り込み時-EIO
  */
-int ahci_port_issue_cmd(struct ahci_port_device *port, 
-                        struct ahci_cmd_request *req, void *buf)
+static int ahci_port_ci_done(struct ahci_port_device *port, u32 slot_bit, u32 *is_out)
 {
     void __iomem *port_mmio = port->port_mmio;
-    struct ahci_cmd_header *cmd_hdr;
-    struct ahci_cmd_table *cmd_tbl;
-    struct fis_reg_h2d *fis;
-    struct ahci_fis_area *fis_area;
-    struct fis_reg_d2h *d2h_fis;
-    u32 cmd_stat;
-    int timeout;
-    bool is_write;
-    bool is_ncq;
-    int slot;
+    u32 ci = ioread32(port_mmio + AHCI_PORT_CI);
+    u32 is = ioread32(port_mmio + AHCI_PORT_IS);
     unsigned long flags;
     
-    is_ncq = (req->flags & AHCI_CMD_FLAG_NCQ) ? true : false;
+    spin_lock_irqsave(&port->slot_lock, flags);
+    is |= port->irq_status;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    *is_out = is;
     
-    dev_info(port->device, "Issuing ATA command 0x%02x (%s)\n", 
-             req->command, is_ncq ? "NCQ" : "Non-NCQ");
+    /* PxCI の該当スロットビットがクリアされたら完了 */
+    if (!(ci & slot_bit))
+        return 1;
     
-    /* ポートが開始状態であることを確認 */
-    cmd_stat = ioread32(port_mmio + AHCI_PORT_CMD);
-    if (!(cmd_stat & AHCI_PORT_CMD_ST)) {
-        dev_err(port->device, "Port not started (PxCMD=0x%08x)\n", cmd_stat);
-        return -EINVAL;
-    }
+    /* エラー時は HBA がコマンド処理を停止するため PxCI は落ちない */
+    if (is & AHCI_PORT_INT_ERROR)
+        return -EIO;
     
-    /* Write direction check */
-    is_write = (req->flags & AHCI_CMD_FLAG_WRITE) ? true : false;
+    return 0;
+}
+
+/**
+ * ahci_port_svc_class - 完了待ち時間を学習するコマンド種別
+ * @req: コマンドリクエスト構造体
+ */
+static enum ahci_svc_class ahci_port_svc_class(const struct ahci_cmd_request *req)
+{
+    if (req->flags & AHCI_CMD_FLAG_NCQ)
+        return AHCI_SVC_NCQ;
+    if (!req->buffer_len)
+        return AHCI_SVC_NODATA;
+    return (req->flags & AHCI_CMD_FLAG_WRITE) ? AHCI_SVC_WRITE : AHCI_SVC_READ;
+}
+
+/**
+ * ahci_port_wait_ci - PxCI の該当スロットビットがクリアされるまで待機
+ * @port: ポートデバイス構造体
+ * @slot: スロット番号
+ * @cls: コマンド種別 (平均完了時間の学習単位)
+ * @issued: PxCI を書いた時刻
+ * @timeout_ms: タイムアウト（ミリ秒）
+ * @is_out: 観測した PxIS（割り込みハンドラがクリアした分を含む）
+ *
+ * port->poll_mode によって待ち方が変わる:
+ * - POLL: タイムアウトまで PxCI をビジーポーリングする
+ * - HYBRID: 種別ごとの平均完了時間の AHCI_HYBRID_SPIN_PCT%
+ *   (最大 AHCI_HYBRID_SPIN_MAX_NS) だけビジーポーリングし、
+ *   終わらなければ IRQ と同じ待ち方に切り替える
+ * - IRQ: Non-NCQ は cmd_done、NCQ は ncq_wq で待機し、DHRS/SDBS 割り込みで
+ *   起床する。PIO Data-In のように最後のデータ転送後に割り込みが来ない
+ *   コマンドに備え、AHCI_IRQ_RECHECK_MS ごとに PxCI を再確認する。
+ *   割り込みが無効な場合は平均完了時間の半分ずつ sleep して確認する。
+ *
+ * 完了した場合は発行からの経過時間で平均完了時間を更新する。
+ *
+ * Return: 0 on completion, -EIO on error interrupt, -ETIMEDOUT on timeout
+ */
+static int ahci_port_wait_ci(struct ahci_port_device *port, int slot,
+                             enum ahci_svc_class cls, ktime_t issued,
+                             int timeout_ms, u32 *is_out)
+{
+    void __iomem *port_mmio = port->port_mmio;
+    unsigned long deadline = jiffies + msecs_to_jiffies(timeout_ms);
+    unsigned long recheck = msecs_to_jiffies(AHCI_IRQ_RECHECK_MS);
+    int mode = READ_ONCE(port->poll_mode);
+    u64 mean = READ_ONCE(port->svc_mean_ns[cls]);
+    u32 slot_bit = 1U << slot;
+    u64 spin_ns = 0;
+    u64 sample;
+    bool slept = false;
+    int ret;
     
-    /* スロット番号決定 */
-    slot = is_ncq ? req->tag : 0;
+    if (mode == AHCI_POLL_MODE_POLL)
+        spin_ns = (u64)timeout_ms * NSEC_PER_MSEC;
+    else if (mode == AHCI_POLL_MODE_HYBRID)
+        spin_ns = min_t(u64, mean * AHCI_HYBRID_SPIN_PCT / 100, AHCI_HYBRID_SPIN_MAX_NS);
     
-    /* スロット検証 */
-    if (slot < 0 || slot >= 32) {
-        dev_err(port->device, "Invalid slot: %d\n", slot);
-        return -EINVAL;
+    /* ビジーポーリング（POLL はタイムアウトまで、HYBRID は学習した時間まで） */
+    while (ktime_to_ns(ktime_sub(ktime_get(), issued)) < spin_ns) {
+        ret = ahci_port_ci_done(port, slot_bit, is_out);
+        if (ret)
+            goto out;
+        if (mode == AHCI_POLL_MODE_POLL)
+            cond_resched();
+        else
+            cpu_relax();
     }
     
-    /* スロット空き確認と割り当て（NCQのみ） */
-    if (is_ncq) {
-        spin_lock_irqsave(&port->slot_lock, flags);
-        if (test_bit(slot, &port->slots_in_use)) {
-            spin_unlock_irqrestore(&port->slot_lock, flags);
-            dev_err(port->device, "Slot %d already in use\n", slot);
-            return -EBUSY;
-        }
-        set_bit(slot, &port->slots_in_use);
-        atomic_inc(&port->active_slots);
+    for (;;) {
+        ret = ahci_port_ci_done(port, slot_bit, is_out);
+        if (ret)
+            goto out;
         
-        /* スロット情報保存 */
-        port->slots[slot].req = *req;
-        port->slots[slot].buffer = buf;
-        port->slots[slot].buffer_len = req->buffer_len;
-        port->slots[slot].is_write = is_write;
-        port->slots[slot].completed = false;
-        port->slots[slot].result = 0;
-        spin_unlock_irqrestore(&port->slot_lock, flags);
+        if (time_after(jiffies, deadline))
+            return -ETIMEDOUT;
         
-        /* NCQモード有効化 */
-        if (!port->ncq_enabled) {
-            dev_info(port->device, "Enabling NCQ mode\n");
-            port->ncq_enabled = true;
+        slept = true;
+        if (!port->hba->irq_enabled) {
+            /* 割り込みなし: 平均完了時間の半分ずつ sleep */
+            unsigned long us = clamp_t(u64, mean / (2 * NSEC_PER_USEC),
+                                       AHCI_POLL_SLEEP_MIN_US, AHCI_POLL_SLEEP_MAX_US);
+            
+            usleep_range(us, us * 2);
+        } else if (cls == AHCI_SVC_NCQ) {
+            wait_event_timeout(port->ncq_wq,
+                               !(ioread32(port_mmio + AHCI_PORT_CI) & slot_bit),
+                               recheck);
+        } else {
+            wait_for_completion_timeout(&port->cmd_done, recheck);
         }
     }
     
+out:
+    if (ret < 0)
+        return ret;
+    
+    /* 種別ごとの平均完了時間 (EWMA) を更新 */
+    sample = ktime_to_ns(ktime_sub(ktime_get(), issued));
+    if (!mean)
+        mean = sample;
+    else
+        mean = mean - (mean >> AHCI_SVC_EWMA_SHIFT) + (sample >> AHCI_SVC_EWMA_SHIFT);
+    WRITE_ONCE(port->svc_mean_ns[cls], mean);
+    
+    if (slept)
+        port->poll_sleeps++;
+    else
+        port->poll_spin_hits++;
+    
+    return 0;
+}
+
+/**
+ * ahci_port_ncq_idle - 実行中の NCQ コマンドがないか調べる
+ * @port: ポートデバイス構造体
+ *
+ * Context: slot_lock 保持
+ */
+static bool ahci_port_ncq_idle(struct ahci_port_device *port)
+{
+    return !(port->slots_issued & ~port->slots_completed);
+}
+
+/**
+ * ahci_port_ncq_idle_locked - slot_lock を取って ahci_port_ncq_idle() を呼ぶ
+ * @port: ポートデバイス構造体
+ */
+static bool ahci_port_ncq_idle_locked(struct ahci_port_device *port)
+{
+    unsigned long flags;
+    bool idle;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    idle = ahci_port_ncq_idle(port);
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    return idle;
+}
+
+/**
+ * ahci_port_non_ncq_active - slot 0 で Non-NCQ コマンドを実行中か
+ * @port: ポートデバイス構造体
+ *
+ * Non-NCQ コマンドは必ず slot 0 で確保され、解放まで req を保持する。
+ *
+ * Context: slot_lock 保持
+ */
+static bool ahci_port_non_ncq_active(struct ahci_port_device *port)
+{
+    return test_bit(0, &port->slots_in_use) &&
+           !(port->slots[0].req.flags & AHCI_CMD_FLAG_NCQ);
+}
+
+/**
+ * ahci_port_non_ncq_active_locked - slot_lock を取って ahci_port_non_ncq_active() を呼ぶ
+ * @port: ポートデバイス構造体
+ */
+static bool ahci_port_non_ncq_active_locked(struct ahci_port_device *port)
+{
+    unsigned long flags;
+    bool active;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    active = ahci_port_non_ncq_active(port);
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    return active;
+}
+
+/**
+ * ahci_port_claim_slot - スロットを確保してリクエストを保存
+ * @port: ポートデバイス構造体
+ * @slot: スロット番号 (NCQ は tag、Non-NCQ は 0)
+ * @req: コマンドリクエスト構造体
+ * @bounce: SGバッファ経由で転送する場合true
+ * @is_write: Write方向の場合true
+ *
+ * Non-NCQ コマンドと NCQ コマンドは同時に実行できないため、Non-NCQ は
+ * 実行中の NCQ コマンドがある場合、NCQ は slot 0 で Non-NCQ コマンドを
+ * 実行中の場合にも失敗する。
+ *
+ * Return: 成功時0、スロット使用中または他方のコマンドが実行中の場合-EBUSY
+ */
+static int ahci_port_claim_slot(struct ahci_port_device *port, int slot,
+                                struct ahci_cmd_request *req, bool bounce, bool is_write)
+{
+    bool is_ncq = (req->flags & AHCI_CMD_FLAG_NCQ) ? true : false;
+    unsigned long flags;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    if (test_bit(slot, &port->slots_in_use)) {
+        spin_unlock_irqrestore(&port->slot_lock, flags);
+        dev_err(port->device, "Slot %d already in use\n", slot);
+        return -EBUSY;
+    }
+    if (!is_ncq && !ahci_port_ncq_idle(port)) {
+        spin_unlock_irqrestore(&port->slot_lock, flags);
+        dev_err(port->device, "NCQ commands in flight (Non-NCQ needs an idle port)\n");
+        return -EBUSY;
+    }
+    if (is_ncq && ahci_port_non_ncq_active(port)) {
+        spin_unlock_irqrestore(&port->slot_lock, flags);
+        dev_err(port->device, "Non-NCQ command in flight on slot 0\n");
+        return -EBUSY;
+    }
+    set_bit(slot, &port->slots_in_use);
+    atomic_inc(&port->active_slots);
+    
+    /* スロット情報保存 */
+    port->slots[slot].req = *req;
+    port->slots[slot].bounce = bounce;
+    port->slots[slot].buffer_len = req->buffer_len;
+    port->slots[slot].is_write = is_write;
+    port->slots[slot].fixed = (req->flags & AHCI_CMD_FLAG_FIXED) ? true : false;
+    port->slots[slot].completed = false;
+    port->slots[slot].result = 0;
+    
+    /* NCQ の READ データは完了ワーカーから発行元のアドレス空間へコピーする */
+    if (is_ncq && !is_write && bounce && req->buffer_len > 0) {
+        port->slots[slot].mm = current->mm;
+        mmgrab(current->mm);
+    }
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    /* NCQモード有効化 */
+    if (is_ncq && !port->ncq_enabled) {
+        dev_info(port->device, "Enabling NCQ mode\n");
+        port->ncq_enabled = true;
+    }
+    
+    return 0;
+}
+
+/**
+ * ahci_port_prdt_bound - コマンドが使う PRDT エントリ数の上限を求める
+ * @port: ポートデバイス構造体
+ * @req: コマンドリクエスト構造体
+ * @dio: Direct I/O 情報 (NULL の場合は SG バッファ経由)
+ *
+ * Command Table のサイズクラスを選ぶための値で、結合により実際の数は
+ * これより少なくなることがある。登録済みバッファは正確な数を数える。
+ *
+ * Return: PRDT エントリ数の上限、登録済みバッファの範囲が不正な場合負のエラーコード
+ */
+static int ahci_port_prdt_bound(struct ahci_port_device *port, struct ahci_cmd_request *req,
+                                struct ahci_dio *dio)
+{
+    if (dio)
+        return dio->prdt_count;
+    if (req->flags & AHCI_CMD_FLAG_FIXED)
+        return ahci_port_fixed_build_prdt(port, req, NULL, AHCI_CMD_TABLE_MAX_PRDT);
+    if (req->buffer_len == 0)
+        return 0;
+    /* プールの範囲はバッファ境界をまたぐ分だけ1つ増える */
+    if (req->flags & AHCI_CMD_FLAG_POOL)
+        return (req->buffer_len + AHCI_SG_BUFFER_SIZE - 1) / AHCI_SG_BUFFER_SIZE + 1;
+    return (req->buffer_len + AHCI_SG_BUFFER_SIZE - 1) / AHCI_SG_BUFFER_SIZE;
+}
+
+/**
+ * ahci_port_build_cmd - Command Header / Command Table / PRDT を構築
+ * @port: ポートデバイス構造体
+ * @slot: スロット番号
+ * @req: コマンドリクエスト構造体
+ * @iter: ユーザーバッファ (write時はSGバッファへ直接コピー)
+ * @dio: Direct I/O 情報 (NULL の場合は SG バッファ経由)
+ * @is_write: Write方向の場合true
+ *
+ * PxSACT/PxCI には書き込まない。失敗時のスロット解放は呼び出し元が行う。
+ *
+ * Return: 成功時0、失敗時負のエラーコード
+ */
+static int ahci_port_build_cmd(struct ahci_port_device *port, int slot,
+                               struct ahci_cmd_request *req, struct iov_iter *iter,
+                               struct ahci_dio *dio, bool is_write)
+{
+    struct ahci_cmd_header *cmd_hdr;
+    struct ahci_cmd_table *cmd_tbl;
+    struct fis_reg_h2d *fis;
+    dma_addr_t cmd_tbl_dma;
+    int prdt_bound, prdt_max;
+    
     /* Command Header の設定 */
     cmd_hdr = &((struct ahci_cmd_header *)port->cmd_list)[slot];
     memset(cmd_hdr, 0, sizeof(*cmd_hdr));
@@ -96,28 +333,24 @@ int ahci_port_issue_cmd(struct ahci_port_device *port,
         cmd_hdr->flags |= AHCI_CMD_WRITE;  /* AHCI Command Header Write bit (bit 6) */
     cmd_hdr->prdtl = (req->buffer_len > 0) ? 1 : 0;  /* 1 or 0 PRDT entry */
     
-    /* Command Table アドレス設定（共通化） */
-    if (!port->cmd_tables[slot]) {
-        port->cmd_tables[slot] = dma_alloc_coherent(&port->hba->pdev->dev,
-                                                     AHCI_CMD_TABLE_SIZE,
-                                                     &port->cmd_tables_dma[slot],
-                                                     GFP_KERNEL);
-        if (!port->cmd_tables[slot]) {
-            dev_err(port->device, "Failed to allocate command table for slot %d\n", slot);
-            if (is_ncq)
-                ahci_free_slot(port, slot);
-            return -ENOMEM;
-        }
+    /* PRDT 数の上限から Command Table (small/large) を選ぶ */
+    prdt_bound = ahci_port_prdt_bound(port, req, dio);
+    if (prdt_bound < 0) {
+        dev_err(port->device, "Invalid fixed buffer range (index %u, offset 0x%llx, %u bytes)\n",
+                req->buf_index, req->buffer, req->buffer_len);
+        return prdt_bound;
+    }
+    cmd_tbl = ahci_port_get_cmd_table(port, slot, prdt_bound, &cmd_tbl_dma, &prdt_max);
+    if (!cmd_tbl) {
+        dev_err(port->device, "Failed to allocate %d-entry command table for slot %d\n",
+                prdt_bound, slot);
+        return -ENOMEM;
     }
-    cmd_hdr->ctba = port->cmd_tables_dma[slot];
-    cmd_tbl = port->cmd_tables[slot];
+    cmd_hdr->ctba = cmd_tbl_dma;
     
     dev_info(port->device, "Command Header (slot %d): flags=0x%04x prdtl=%u ctba=0x%llx\n",
              slot, cmd_hdr->flags, cmd_hdr->prdtl, cmd_hdr->ctba);
     
-    /* Command Table の設定 */
-    memset(cmd_tbl, 0, AHCI_CMD_TABLE_SIZE);
-    
     /* Command FIS (Register H2D) の構築 */
     fis = (struct fis_reg_h2d *)cmd_tbl->cfis;
     fis->fis_type = FIS_TYPE_REG_H2D;
@@ -134,8 +367,8 @@ int ahci_port_issue_cmd(struct ahci_port_device *port,
     fis->lba_high_exp = (req->lba >> 40) & 0xFF;
     
     /* Features and Count */
-    fis->features = req->features & 0xFF;
-    fis->features_exp = (req->features >> 8) & 0xFF;
+    fis->features = req->features;
+    fis->features_exp = req->features_exp;
     fis->count = req->count & 0xFF;
     fis->count_exp = (req->count >> 8) & 0xFF;
     
@@ -149,13 +382,55 @@ int ahci_port_issue_cmd(struct ahci_port_device *port,
     dev_info(port->device, "Command FIS: type=0x%02x cmd=0x%02x lba=0x%llx count=%u\n",
              fis->fis_type, fis->command, req->lba, req->count);
     
+    /* Direct I/O: pin したユーザーページから PRDT を構築 */
+    if (dio) {
+        cmd_hdr->prdtl = ahci_dio_build_prdt(dio, cmd_tbl->prdt);
+        
+        dev_info(port->device, "PRDT: %u entries for %u bytes (direct)\n",
+                 cmd_hdr->prdtl, req->buffer_len);
+        return 0;
+    }
+    
+    /* 登録済みバッファ: 登録時に計算した PRDT から範囲を切り出す */
+    if (req->flags & AHCI_CMD_FLAG_FIXED) {
+        int prdt_count = ahci_port_fixed_build_prdt(port, req, cmd_tbl->prdt, prdt_max);
+        
+        if (prdt_count < 0) {
+            dev_err(port->device, "Invalid fixed buffer range (index %u, offset 0x%llx, %u bytes)\n",
+                    req->buf_index, req->buffer, req->buffer_len);
+            return prdt_count;
+        }
+        cmd_hdr->prdtl = prdt_count;
+        
+        dev_info(port->device, "PRDT: %d entries for %u bytes (fixed buffer %u)\n",
+                 prdt_count, req->buffer_len, req->buf_index);
+        return 0;
+    }
+    
+    /* mmap 済みSGバッファプール: ユーザーがマップしている範囲へ直接 DMA */
+    if (req->flags & AHCI_CMD_FLAG_POOL) {
+        int prdt_count = ahci_port_pool_build_prdt(port, slot, req, cmd_tbl->prdt, prdt_max);
+        
+        if (prdt_count < 0) {
+            dev_err(port->device, "Invalid SG pool range (offset 0x%llx, %u bytes)\n",
+                    req->buffer, req->buffer_len);
+            return prdt_count;
+        }
+        cmd_hdr->prdtl = prdt_count;
+        
+        dev_info(port->device, "PRDT: %d entries for %u bytes (SG pool)\n",
+                 prdt_count, req->buffer_len);
+        return 0;
+    }
+    
     /* PRDT Entry の設定 (buffer_len > 0 の場合のみ) */
     if (req->buffer_len > 0) {
         struct ahci_prdt_entry *prdt;
         u32 remaining = req->buffer_len;
-        u32 offset = 0;
+        unsigned long flags;
         int prdt_count = 0;
         int sg_needed;
+        int sg_start;
         int ret;
         
         /* 必要なSGバッファ数を計算 */
@@ -163,43 +438,44 @@ int ahci_port_issue_cmd(struct ahci_port_device *port,
         if (sg_needed > AHCI_SG_BUFFER_COUNT) {
             dev_err(port->device, "Transfer size %u exceeds max (%u)\n",
                     req->buffer_len, AHCI_SG_BUFFER_COUNT * AHCI_SG_BUFFER_SIZE);
-            if (is_ncq)
-                ahci_free_slot(port, slot);
             return -EINVAL;
         }
         
-        /* SGバッファを確保 */
-        ret = ahci_port_ensure_sg_buffers(port, sg_needed);
-        if (ret) {
-            dev_err(port->device, "Failed to ensure %d SG buffers\n", sg_needed);
-            if (is_ncq)
-                ahci_free_slot(port, slot);
-            return ret;
+        /* このコマンド専用のSGバッファ範囲を確保（完了・解放まで保持） */
+        sg_start = ahci_port_sg_alloc(port, sg_needed);
+        if (sg_start < 0) {
+            dev_err(port->device, "Failed to allocate %d SG buffers (%d)\n", sg_needed, sg_start);
+            return sg_start;
         }
         
-        /* Write時: user buffer → SG buffers */
+        spin_lock_irqsave(&port->slot_lock, flags);
+        port->slots[slot].sg_start_idx = sg_start;
+        port->slots[slot].sg_count = sg_needed;
+        spin_unlock_irqrestore(&port->slot_lock, flags);
+        
+        /* Write時: user buffer → SG buffers（128KB ずつ、カーネルバッファを介さない） */
         if (is_write) {
-            int i;
-            for (i = 0; i < sg_needed && remaining > 0; i++) {
-                u32 chunk = remaining > AHCI_SG_BUFFER_SIZE ? AHCI_SG_BUFFER_SIZE : remaining;
-                memcpy(port->sg_buffers[i], (u8 *)buf + offset, chunk);
-                offset += chunk;
-                remaining -= chunk;
+            ret = ahci_port_sg_copy_from_iter(port, sg_start, iter, req->buffer_len);
+            if (ret) {
+                dev_err(port->device, "Failed to copy write buffer from user\n");
+                return ret;
             }
-            remaining = req->buffer_len;
-            offset = 0;
         }
         
-        /* PRDT entries構築 */
+        /* PRDT entries構築（連続チャンク内のSGバッファは 4MB まで1エントリ） */
         {
             int i;
             prdt = cmd_tbl->prdt;
             for (i = 0; i < sg_needed && remaining > 0; i++) {
                 u32 chunk = remaining > AHCI_SG_BUFFER_SIZE ? AHCI_SG_BUFFER_SIZE : remaining;
-                prdt[i].dba = port->sg_buffers_dma[i];
-                prdt[i].dbc = chunk - 1;  /* 0-based */
+                prdt_count = ahci_prdt_append(prdt, prdt_count, prdt_max,
+                                              port->sg_buffers_dma[sg_start + i], chunk);
+                if (prdt_count < 0) {
+                    dev_err(port->device, "Transfer size %u needs more than %d PRDT entries\n",
+                            req->buffer_len, prdt_max);
+                    return prdt_count;
+                }
                 remaining -= chunk;
-                prdt_count++;
             }
         }
         
@@ -209,20 +485,237 @@ int ahci_port_issue_cmd(struct ahci_port_device *port,
                  prdt_count, req->buffer_len);
     }
     
-    /* PxIS をクリア */
-    iowrite32(0xFFFFFFFF, port_mmio + AHCI_PORT_IS);
+    return 0;
+}
+
+/**
+ * ahci_port_prep_ncq - NCQコマンドを発行直前まで準備
+ * @port: ポートデバイス構造体
+ * @req: コマンドリクエスト構造体 (req->tag でスロット指定)
+ * @iter: SGバッファ経由の場合のユーザーバッファ (Direct I/O / 登録済みバッファ / SGプールは NULL)
+ * @dio: Direct I/O 情報 (成功時はスロットが所有し、完了時に解放される)
+ *
+ * スロットを確保して Command Header / Command Table / PRDT を構築する。
+ * 複数コマンドを準備した後、ahci_port_fire_ncq() でまとめて発行する。
+ *
+ * Return: 成功時0、失敗時負のエラーコード
+ */
+int ahci_port_prep_ncq(struct ahci_port_device *port,
+                       struct ahci_cmd_request *req, struct iov_iter *iter,
+                       struct ahci_dio *dio)
+{
+    bool is_write = (req->flags & AHCI_CMD_FLAG_WRITE) ? true : false;
+    int slot = req->tag;
+    unsigned long flags;
+    int ret;
     
-    /* コマンド発行 */
-    wmb();  /* Ensure all writes are visible */
+    if (!(req->flags & AHCI_CMD_FLAG_NCQ))
+        return -EINVAL;
     
-    /* NCQの場合はPxSACT書き込み */
+    if (!(ioread32(port->port_mmio + AHCI_PORT_CMD) & AHCI_PORT_CMD_ST)) {
+        dev_err(port->device, "Port not started\n");
+        return -EINVAL;
+    }
+    
+    if (slot < 0 || slot >= 32) {
+        dev_err(port->device, "Invalid slot: %d\n", slot);
+        return -EINVAL;
+    }
+    
+    ret = ahci_port_claim_slot(port, slot, req, iter != NULL, is_write);
+    if (ret)
+        return ret;
+    
+    ret = ahci_port_build_cmd(port, slot, req, iter, dio, is_write);
+    if (ret) {
+        ahci_free_slot(port, slot);
+        return ret;
+    }
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    port->slots[slot].dio = dio;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    return 0;
+}
+EXPORT_SYMBOL_GPL(ahci_port_prep_ncq);
+
+/**
+ * ahci_port_fire_ncq - 準備済みのNCQコマンドをまとめて発行
+ * @port: ポートデバイス構造体
+ * @tags: 発行するスロットのビットマップ
+ *
+ * PxSACT と PxCI をそれぞれ1回だけ書き込む。ポートが凍結中（停止・リカバリ中）
+ * の場合はレジスタに書き込まず、ahci_port_ncq_fail() で失敗として完了させる。
+ */
+void ahci_port_fire_ncq(struct ahci_port_device *port, u32 tags)
+{
+    void __iomem *port_mmio = port->port_mmio;
+    unsigned long flags;
+    ktime_t now;
+    int slot;
+    
+    /* Ensure all writes are visible */
+    wmb();
+    
+    /*
+     * 凍結の判定とレジスタ書き込みを slot_lock 内で行い、停止したポートや
+     * リカバリ後に再利用されたスロットへ書き込まないようにする
+     */
+    now = ktime_get();
+    spin_lock_irqsave(&port->slot_lock, flags);
+    if (!port->ncq_frozen) {
+        iowrite32(tags, port_mmio + AHCI_PORT_SACT);
+        port->ncq_issued += hweight32(tags);
+    }
+    
+    /* 完了検出の対象にする */
+    for (slot = 0; slot < 32; slot++) {
+        if (!(tags & (1U << slot)))
+            continue;
+        port->slots[slot].issue_time = now;
+        set_bit(slot, &port->slots_issued);
+    }
+    
+    if (!port->ncq_frozen) {
+        iowrite32(tags, port_mmio + AHCI_PORT_CI);
+        tags = 0;
+    }
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    if (tags)
+        ahci_port_ncq_fail(port, tags);
+}
+EXPORT_SYMBOL_GPL(ahci_port_fire_ncq);
+
+/**
+ * ahci_port_abort_slot - 発行に失敗した NCQ スロットを解放
+ * @port: ポートデバイス構造体
+ * @slot: スロット番号
+ *
+ * 失敗時の Direct I/O 情報は呼び出し元が解放するため、スロットから外してから解放する。
+ */
+static void ahci_port_abort_slot(struct ahci_port_device *port, int slot)
+{
+    unsigned long flags;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    port->slots[slot].dio = NULL;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    ahci_free_slot(port, slot);
+}
+
+/**
+ * ahci_port_issue_cmd - ATA コマンドを発行（NCQ/Non-NCQ両対応）
+ * @port: ポートデバイス構造体
+ * @req: コマンドリクエスト構造体 (入出力)
+ * @iter: SGバッファ経由の場合のユーザーバッファ (read時は出力、write時は入力)。
+ *        NCQ の READ データは完了処理で req->buffer へコピーされる。
+ * @dio: Direct I/O 情報 (NULL の場合は iter を使用)。NCQ で成功した場合はスロットが
+ *       所有し完了時に解放される。それ以外は呼び出し元が解放する。
+ *
+ * ATAコマンドを発行する。NCQフラグにより動作が変わる：
+ * - NCQフラグなし: slot 0を確保してコマンド発行、完了まで待機、D2H FIS読み取り。
+ *   slot 0 が使用中、または NCQ コマンドの実行中は -EBUSY
+ * - NCQフラグあり: req->tagでスロット指定、PxSACT+PxCI使用、キューイング完了まで待機
+ * 
+ * Return: 成功時0、失敗時負のエラーコード
+ */
+int ahci_port_issue_cmd(struct ahci_port_device *port, 
+                        struct ahci_cmd_request *req, struct iov_iter *iter,
+                        struct ahci_dio *dio)
+{
+    void __iomem *port_mmio = port->port_mmio;
+    struct ahci_fis_area *fis_area;
+    struct fis_reg_d2h *d2h_fis;
+    u32 cmd_stat;
+    u32 is = 0;
+    ktime_t issued;
+    int timeout;
+    int ret;
+    bool is_write;
+    bool is_ncq;
+    int slot;
+    unsigned long flags;
+    
+    is_ncq = (req->flags & AHCI_CMD_FLAG_NCQ) ? true : false;
+    
+    dev_info(port->device, "Issuing ATA command 0x%02x (%s)\n", 
+             req->command, is_ncq ? "NCQ" : "Non-NCQ");
+    
+    /* ポートが開始状態であることを確認 */
+    cmd_stat = ioread32(port_mmio + AHCI_PORT_CMD);
+    if (!(cmd_stat & AHCI_PORT_CMD_ST)) {
+        dev_err(port->device, "Port not started (PxCMD=0x%08x)\n", cmd_stat);
+        return -EINVAL;
+    }
+    
+    /* Write direction check */
+    is_write = (req->flags & AHCI_CMD_FLAG_WRITE) ? true : false;
+    
+    /* スロット番号決定 */
+    slot = is_ncq ? req->tag : 0;
+    
+    /* スロット検証 */
+    if (slot < 0 || slot >= 32) {
+        dev_err(port->device, "Invalid slot: %d\n", slot);
+        return -EINVAL;
+    }
+    
+    /* 登録済みバッファは NCQ のみ（完了時の dma_sync をスロット単位で行うため） */
+    if ((req->flags & AHCI_CMD_FLAG_FIXED) && !is_ncq) {
+        dev_err(port->device, "Fixed buffers require NCQ\n");
+        return -EINVAL;
+    }
+    
+    /* スロット空き確認と割り当て */
+    ret = ahci_port_claim_slot(port, slot, req, iter != NULL, is_write);
+    if (ret)
+        return ret;
+    
+    /* Command Header / Command Table / PRDT の構築 */
+    ret = ahci_port_build_cmd(port, slot, req, iter, dio, is_write);
+    if (ret) {
+        ahci_free_slot(port, slot);
+        return ret;
+    }
+    
+    /*
+     * NCQ: 完了処理で DMA アンマップできるようにスロットへ記録。
+     * キューイング完了までは発行元が待つので、エラーリカバリはこのスロットを
+     * 完了させずにデバイスから外すだけにする（ahci_port_ncq_fail()）
+     */
     if (is_ncq) {
-        iowrite32(1 << slot, port_mmio + AHCI_PORT_SACT);
-        port->ncq_issued++;
+        spin_lock_irqsave(&port->slot_lock, flags);
+        port->slots[slot].dio = dio;
+        port->slots[slot].waiter = true;
+        spin_unlock_irqrestore(&port->slot_lock, flags);
     }
     
-    /* PxCI書き込み（共通） */
-    iowrite32(1 << slot, port_mmio + AHCI_PORT_CI);
+    /* PxIS をクリア（NCQ は実行中の他スロットの SDBS を消さないようにクリアしない） */
+    if (!is_ncq)
+        iowrite32(0xFFFFFFFF, port_mmio + AHCI_PORT_IS);
+    
+    /*
+     * 割り込みハンドラが蓄積した PxIS と完了通知をリセット（Non-NCQ のみ）。
+     * NCQ では並行する他コマンドの待機者がまだ見ていないエラーを消してしまう
+     */
+    if (!is_ncq) {
+        spin_lock_irqsave(&port->slot_lock, flags);
+        port->irq_status = 0;
+        spin_unlock_irqrestore(&port->slot_lock, flags);
+        reinit_completion(&port->cmd_done);
+    }
+    
+    /* コマンド発行: NCQ は PxSACT+PxCI、Non-NCQ は PxCI のみ */
+    if (is_ncq) {
+        ahci_port_fire_ncq(port, 1U << slot);
+    } else {
+        wmb();  /* Ensure all writes are visible */
+        iowrite32(1 << slot, port_mmio + AHCI_PORT_CI);
+    }
+    issued = ktime_get();
     
     dev_info(port->device, "%s command issued (slot %d, PxCI=0x%08x%s)\n",
              is_ncq ? "NCQ" : "Non-NCQ", slot, 
@@ -232,105 +725,325 @@ int ahci_port_issue_cmd(struct ahci_port_device *port,
         pr_cont("%08x", ioread32(port_mmio + AHCI_PORT_SACT));
     
     /* キューイング完了待機 */
-    timeout = req->timeout_ms > 0 ? req->timeout_ms : 5000;
-    while (timeout > 0) {
-        u32 ci = ioread32(port_mmio + AHCI_PORT_CI);
-        u32 is = ioread32(port_mmio + AHCI_PORT_IS);
+    timeout = req->timeout_ms > 0 ? req->timeout_ms : AHCI_CMD_DEFAULT_TIMEOUT_MS;
+    ret = ahci_port_wait_ci(port, slot, ahci_port_svc_class(req), issued, timeout, &is);
+    if (ret == -ETIMEDOUT) {
+        dev_err(port->device, "Command timeout (slot %d, PxCI=0x%08x PxIS=0x%08x)\n",
+                slot, ioread32(port_mmio + AHCI_PORT_CI), is);
+        
+        /* NCQ: HBA から外してから解放する（他の未完了スロットは失敗になる） */
+        if (is_ncq) {
+            ahci_port_recover(port, slot);
+            ahci_port_abort_slot(port, slot);
+        } else {
+            ahci_free_slot(port, slot);
+        }
+        
+        return -ETIMEDOUT;
+    }
+    
+    /* エラーチェック */
+    if (is & AHCI_PORT_INT_ERROR) {
         u32 tfd = ioread32(port_mmio + AHCI_PORT_TFD);
+        u32 serr = ioread32(port_mmio + AHCI_PORT_SERR);
+        dev_err(port->device, "Command error: PxIS=0x%08x PxTFD=0x%08x PxSERR=0x%08x\n",
+                is, tfd, serr);
+        /* Clear error bits */
+        iowrite32(is, port_mmio + AHCI_PORT_IS);
+        iowrite32(serr, port_mmio + AHCI_PORT_SERR);
         
-        /* PxCI の該当スロットビットがクリアされたらキューイング完了 */
-        if (!(ci & (1 << slot))) {
-            dev_info(port->device, "Command queued (slot %d, PxIS=0x%08x PxTFD=0x%08x)\n", 
-                     slot, is, tfd);
-            
-            /* NCQ: キューイング完了時点でリターン（転送完了は非同期） */
-            if (is_ncq) {
-                dev_info(port->device, "NCQ command 0x%02x queued on slot %d\n", 
-                         req->command, slot);
-                req->tag = slot;
-                return 0;
-            }
-            
-            /* Non-NCQ: 転送完了済み、D2H FISから結果を取得 */
-            fis_area = (struct ahci_fis_area *)port->fis_area;
-            d2h_fis = &fis_area->rfis;
-            
-            /* D2H FIS の生データをダンプ (DWORD単位、5 DWORDs = 20バイト) */
-            {
-                u32 *dwords = (u32 *)d2h_fis;
-                dev_info(port->device, "D2H FIS: [0]=0x%08x [1]=0x%08x [2]=0x%08x [3]=0x%08x [4]=0x%08x\n",
-                         dwords[0], dwords[1], dwords[2], dwords[3], dwords[4]);
+        if (is_ncq) {
+            /* HBA は停止している: リセットして再開し、このスロットを外す */
+            ahci_port_recover(port, slot);
+            ahci_port_abort_slot(port, slot);
+        } else {
+            /* 報告したエラーは後続の NCQ 発行に持ち越さない */
+            spin_lock_irqsave(&port->slot_lock, flags);
+            port->irq_status &= ~AHCI_PORT_INT_ERROR;
+            spin_unlock_irqrestore(&port->slot_lock, flags);
+            ahci_free_slot(port, slot);
+        }
+        
+        return -EIO;
+    }
+    
+    dev_info(port->device, "Command queued (slot %d, PxIS=0x%08x PxTFD=0x%08x)\n", 
+             slot, is, ioread32(port_mmio + AHCI_PORT_TFD));
+    
+    /* NCQ: キューイング完了時点でリターン（転送完了は非同期） */
+    if (is_ncq) {
+        bool aborted;
+        
+        /* 待機中に他のスロットのエラーでリカバリされた場合は失敗 */
+        spin_lock_irqsave(&port->slot_lock, flags);
+        port->slots[slot].waiter = false;
+        aborted = !test_bit(slot, &port->slots_issued);
+        spin_unlock_irqrestore(&port->slot_lock, flags);
+        if (aborted) {
+            dev_err(port->device, "NCQ command on slot %d aborted by port recovery\n", slot);
+            ahci_port_abort_slot(port, slot);
+            return -EIO;
+        }
+        
+        dev_info(port->device, "NCQ command 0x%02x queued on slot %d\n", 
+                 req->command, slot);
+        req->tag = slot;
+        return 0;
+    }
+    
+    /* Non-NCQ: 転送完了済み、D2H FISから結果を取得 */
+    fis_area = (struct ahci_fis_area *)port->fis_area;
+    d2h_fis = &fis_area->rfis;
+    
+    /* D2H FIS の生データをダンプ (DWORD単位、5 DWORDs = 20バイト) */
+    {
+        u32 *dwords = (u32 *)d2h_fis;
+        dev_info(port->device, "D2H FIS: [0]=0x%08x [1]=0x%08x [2]=0x%08x [3]=0x%08x [4]=0x%08x\n",
+                 dwords[0], dwords[1], dwords[2], dwords[3], dwords[4]);
+    }
+    
+    /* D2H FISから直接取得 */
+    req->status = d2h_fis->status;
+    req->error = d2h_fis->error;
+    req->device_out = d2h_fis->device;
+    
+    /* LBA結果の再構築 */
+    req->lba_out = ((u64)d2h_fis->lba_high_exp << 40) |
+                  ((u64)d2h_fis->lba_mid_exp << 32) |
+                  ((u64)d2h_fis->lba_low_exp << 24) |
+                  ((u64)d2h_fis->lba_high << 16) |
+                  ((u64)d2h_fis->lba_mid << 8) |
+                  ((u64)d2h_fis->lba_low);
+    
+    /* Count結果の再構築 */
+    req->count_out = ((u16)d2h_fis->count_exp << 8) | d2h_fis->count;
+    
+    dev_info(port->device, "D2H FIS: status=0x%02x error=0x%02x device=0x%02x lba=0x%llx count=%u\n",
+             req->status, req->error, req->device_out, req->lba_out, req->count_out);
+    
+    /* 正常完了: Read時はSG buffers → user buffer（Direct I/O / SGプールは不要） */
+    ret = 0;
+    if (!is_write && iter && req->buffer_len > 0) {
+        ret = ahci_port_sg_copy_to_iter(port, port->slots[slot].sg_start_idx, iter,
+                                        req->buffer_len);
+        if (ret)
+            dev_err(port->device, "Failed to copy result to user\n");
+    }
+    
+    /* PxIS をクリア */
+    iowrite32(is, port_mmio + AHCI_PORT_IS);
+    
+    /* Non-NCQ: Slot 0を解放してNCQが使えるようにする */
+    ahci_free_slot(port, slot);
+    
+    dev_info(port->device, "Non-NCQ command 0x%02x completed successfully\n", req->command);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(ahci_port_issue_cmd);
+
+/**
+ * ahci_port_rw_iter - ファイルオフセット指定のセクタ読み書き
+ * @port: ポートデバイス構造体 (開始済み)
+ * @pos: ファイルオフセット (= LBA * AHCI_RW_SECTOR_SIZE)
+ * @iter: 転送するデータ (read は出力、write は入力)
+ * @is_write: WRITE DMA EXT の場合 true
+ * @direct: O_DIRECT。iter がユーザーバッファ 1 つで AHCI_DIO_ALIGN に
+ *          揃っていればユーザーページを直接 DMA する
+ *
+ * read_iter/write_iter の本体。iter を AHCI_RW_MAX_SECTORS ごとに区切り、
+ * slot 0 で READ/WRITE DMA EXT を同期発行する。SGバッファ経由の場合は
+ * iov_iter の種類を問わない（preadv の複数 iovec もそのまま扱える）。
+ * 各コマンドの前に実行中の NCQ コマンドの完了を待つ。slot 0 を ioctl 側が
+ * 保持している場合は -EBUSY。呼び出し元が rw_lock を保持すること。
+ *
+ * Return: 転送したバイト数。最初のコマンドが失敗した場合は負のエラーコード
+ */
+ssize_t ahci_port_rw_iter(struct ahci_port_device *port, loff_t pos,
+                          struct iov_iter *iter, bool is_write, bool direct)
+{
+    struct ahci_cmd_request req;
+    struct ahci_dio *dio;
+    size_t count = iov_iter_count(iter);
+    size_t done = 0;
+    int ret = 0;
+    
+    if ((pos | count) & (AHCI_RW_SECTOR_SIZE - 1))
+        return -EINVAL;
+    
+    while (done < count) {
+        u32 len = min_t(size_t, count - done, AHCI_RW_MAX_SECTORS * AHCI_RW_SECTOR_SIZE);
+        
+        /* Non-NCQ コマンドは NCQ 実行中に発行できない（完了は ncq_wq で通知される） */
+        ret = wait_event_interruptible(port->ncq_wq, ahci_port_ncq_idle_locked(port));
+        if (ret)
+            break;
+        
+        memset(&req, 0, sizeof(req));
+        req.command = is_write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+        req.device = ATA_DEV_LBA;
+        req.lba = (pos + done) / AHCI_RW_SECTOR_SIZE;
+        req.count = len / AHCI_RW_SECTOR_SIZE;
+        req.buffer_len = len;
+        req.timeout_ms = AHCI_CMD_DEFAULT_TIMEOUT_MS;
+        req.flags = is_write ? AHCI_CMD_FLAG_WRITE : 0;
+        
+        /* O_DIRECT: ユーザーページを直接 DMA（条件を満たさなければ NULL でバウンス） */
+        dio = NULL;
+        if (direct && iter_is_ubuf(iter)) {
+            req.buffer = (u64)(uintptr_t)(iter->ubuf + iter->iov_offset);
+            req.flags |= AHCI_CMD_FLAG_DIRECT;
+            dio = ahci_port_dio_map(port, &req);
+            if (IS_ERR(dio)) {
+                ret = PTR_ERR(dio);
+                break;
             }
-            
-            /* D2H FISから直接取得 */
-            req->status = d2h_fis->status;
-            req->error = d2h_fis->error;
-            req->device_out = d2h_fis->device;
-            
-            /* LBA結果の再構築 */
-            req->lba_out = ((u64)d2h_fis->lba_high_exp << 40) |
-                          ((u64)d2h_fis->lba_mid_exp << 32) |
-                          ((u64)d2h_fis->lba_low_exp << 24) |
-                          ((u64)d2h_fis->lba_high << 16) |
-                          ((u64)d2h_fis->lba_mid << 8) |
-                          ((u64)d2h_fis->lba_low);
-            
-            /* Count結果の再構築 */
-            req->count_out = ((u16)d2h_fis->count_exp << 8) | d2h_fis->count;
-            
-            dev_info(port->device, "D2H FIS: status=0x%02x error=0x%02x device=0x%02x lba=0x%llx count=%u\n",
-                     req->status, req->error, req->device_out, req->lba_out, req->count_out);
-            
-            /* エラーチェック */
-            if (is & (AHCI_PORT_INT_TFES | AHCI_PORT_INT_HBFS | 
-                      AHCI_PORT_INT_HBDS | AHCI_PORT_INT_IFS)) {
-                u32 tfd = ioread32(port_mmio + AHCI_PORT_TFD);
-                u32 serr = ioread32(port_mmio + AHCI_PORT_SERR);
-                dev_err(port->device, "Command error: PxIS=0x%08x PxTFD=0x%08x PxSERR=0x%08x\n",
-                        is, tfd, serr);
-                /* Clear error bits */
-                iowrite32(is, port_mmio + AHCI_PORT_IS);
-                iowrite32(serr, port_mmio + AHCI_PORT_SERR);
-                return -EIO;
+        }
+        
+        ret = ahci_port_issue_cmd(port, &req, dio ? NULL : iter, dio);
+        ahci_port_dio_unmap(port, dio);
+        if (ret)
+            break;
+        
+        if (req.status & ATA_STATUS_ERR) {
+            dev_err(port->device, "%s at LBA 0x%llx failed: status=0x%02x error=0x%02x\n",
+                    is_write ? "WRITE" : "READ", req.lba, req.status, req.error);
+            ret = -EIO;
+            break;
+        }
+        
+        /* Direct I/O は iter を消費しないので進める */
+        if (dio)
+            iov_iter_advance(iter, len);
+        done += len;
+    }
+    
+    return done ? done : ret;
+}
+EXPORT_SYMBOL_GPL(ahci_port_rw_iter);
+
+/**
+ * ahci_port_rw_queue - 非同期 kiocb を NCQ コマンドとして発行する
+ * @port: ポートデバイス構造体 (開始済み)
+ * @iocb: 非同期 kiocb (O_DIRECT, ki_pos = LBA * AHCI_RW_SECTOR_SIZE)
+ * @iter: ユーザーバッファ
+ * @is_write: WRITE FPDMA QUEUED の場合 true
+ *
+ * iter がユーザーバッファ 1 つで Direct I/O の条件を満たし、
+ * AHCI_RW_MAX_SECTORS 以下の場合、ユーザーページを DMA マップして
+ * 空いている NCQ タグで READ/WRITE FPDMA QUEUED を発行し、完了を待たずに返る。
+ * 完了時は ahci_check_slot_completion() がアンマップとスロット解放の後に
+ * ki_complete() を呼ぶ。空きタグがなければ rw_lock を外して解放を待つ。
+ * IOCB_NOWAIT の場合は、ページの pin より前に空きタグを確認し、空きがないか
+ * rw_lock が使用中なら -EAGAIN を返す。
+ *
+ * Return: 発行した場合 -EIOCBQUEUED、NCQ で発行できない要求の場合 0
+ *         (呼び出し元は ahci_port_rw_iter() で同期発行する)、失敗時負のエラーコード
+ */
+ssize_t ahci_port_rw_queue(struct ahci_port_device *port, struct kiocb *iocb,
+                           struct iov_iter *iter, bool is_write)
+{
+    struct ahci_cmd_request req;
+    struct ahci_dio *dio;
+    unsigned long flags;
+    size_t count = iov_iter_count(iter);
+    u32 cap;
+    int depth;
+    int tag;
+    int ret;
+    
+    cap = ioread32(port->hba->mmio + AHCI_CAP);
+    if (!(cap & AHCI_CAP_SNCQ) || !iter_is_ubuf(iter) ||
+        count > AHCI_RW_MAX_SECTORS * AHCI_RW_SECTOR_SIZE)
+        return 0;
+    
+    if ((iocb->ki_pos | count) & (AHCI_RW_SECTOR_SIZE - 1))
+        return -EINVAL;
+    
+    memset(&req, 0, sizeof(req));
+    req.command = is_write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+    req.device = ATA_DEV_LBA;
+    req.lba = iocb->ki_pos / AHCI_RW_SECTOR_SIZE;
+    req.features = (count / AHCI_RW_SECTOR_SIZE) & 0xFF;
+    req.features_exp = ((count / AHCI_RW_SECTOR_SIZE) >> 8) & 0xFF;
+    req.buffer = (u64)(uintptr_t)(iter->ubuf + iter->iov_offset);
+    req.buffer_len = count;
+    req.flags = AHCI_CMD_FLAG_NCQ | AHCI_CMD_FLAG_DIRECT |
+                (is_write ? AHCI_CMD_FLAG_WRITE : 0);
+    
+    /* 揃っていないバッファはバウンスが必要なので同期発行に回す */
+    if (!IS_ALIGNED(req.buffer | req.buffer_len, AHCI_DIO_ALIGN))
+        return 0;
+    
+    /* IOCB_NOWAIT: ページを pin する前に、空きタグがなければ諦める */
+    depth = ((cap & AHCI_CAP_NCS) >> 8) + 1;
+    if ((iocb->ki_flags & IOCB_NOWAIT) &&
+        find_first_zero_bit(&port->slots_in_use, depth) >= depth)
+        return -EAGAIN;
+    
+    dio = ahci_port_dio_map(port, &req);
+    if (IS_ERR(dio))
+        return PTR_ERR(dio);
+    if (!dio)
+        return 0;
+    
+    /* slot 0 の Non-NCQ read/write と排他。空きタグは rw_lock を外して待つ */
+    for (;;) {
+        if (iocb->ki_flags & IOCB_NOWAIT) {
+            if (!mutex_trylock(&port->rw_lock)) {
+                ret = -EAGAIN;
+                goto out_unmap;
             }
-            
-            /* 正常完了: Read時はSG buffers → user buffer */
-            if (!is_write && req->buffer_len > 0) {
-                u32 remaining = req->buffer_len;
-                u32 offset = 0;
-                int sg_needed = (req->buffer_len + AHCI_SG_BUFFER_SIZE - 1) / AHCI_SG_BUFFER_SIZE;
-                int i;
-                
-                for (i = 0; i < sg_needed && remaining > 0; i++) {
-                    u32 chunk = remaining > AHCI_SG_BUFFER_SIZE ? AHCI_SG_BUFFER_SIZE : remaining;
-                    memcpy((u8 *)buf + offset, port->sg_buffers[i], chunk);
-                    offset += chunk;
-                    remaining -= chunk;
-                }
+        } else {
+            mutex_lock(&port->rw_lock);
+        }
+        
+        tag = find_first_zero_bit(&port->slots_in_use, depth);
+        if (tag < depth) {
+            req.tag = tag;
+            req.count = tag << 3;
+            ret = ahci_port_prep_ncq(port, &req, NULL, dio);
+            if (ret == 0)
+                break;
+            mutex_unlock(&port->rw_lock);
+            if (ret != -EBUSY)
+                goto out_unmap;
+            /*
+             * ioctl 側に同じタグを取られた場合は選び直す。ioctl の Non-NCQ
+             * コマンドが slot 0 で実行中の場合は、その解放を待つ
+             */
+            if (iocb->ki_flags & IOCB_NOWAIT) {
+                ret = -EAGAIN;
+                goto out_unmap;
             }
-            
-            /* PxIS をクリア */
-            iowrite32(is, port_mmio + AHCI_PORT_IS);
-            
-            /* Non-NCQ: Slot 0を解放してNCQが使えるようにする */
-            ahci_free_slot(port, 0);
-            
-            dev_info(port->device, "Non-NCQ command 0x%02x completed successfully\n", req->command);
-            return 0;
+            ret = wait_event_interruptible(port->ncq_wq,
+                                           !ahci_port_non_ncq_active_locked(port));
+            if (ret)
+                goto out_unmap;
+            continue;
         }
+        mutex_unlock(&port->rw_lock);
         
-        msleep(1);
-        timeout--;
+        if (iocb->ki_flags & IOCB_NOWAIT) {
+            ret = -EAGAIN;
+            goto out_unmap;
+        }
+        ret = wait_event_interruptible(port->ncq_wq,
+                                       find_first_zero_bit(&port->slots_in_use, depth) < depth);
+        if (ret)
+            goto out_unmap;
     }
     
-    /* タイムアウト */
-    dev_err(port->device, "Command timeout (slot %d, PxCI=0x%08x PxIS=0x%08x)\n",
-            slot, ioread32(port_mmio + AHCI_PORT_CI),
-            ioread32(port_mmio + AHCI_PORT_IS));
+    spin_lock_irqsave(&port->slot_lock, flags);
+    port->slots[tag].iocb = iocb;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
     
-    if (is_ncq)
-        ahci_free_slot(port, slot);
+    ahci_port_fire_ncq(port, 1U << tag);
+    mutex_unlock(&port->rw_lock);
     
-    return -ETIMEDOUT;
+    return -EIOCBQUEUED;
+    
+out_unmap:
+    ahci_port_dio_unmap(port, dio);
+    return ret;
 }
-EXPORT_SYMBOL_GPL(ahci_port_issue_cmd);
+EXPORT_SYMBOL_GPL(ahci_port_rw_queue);
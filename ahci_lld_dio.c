@@ -0,0 +1,517 @@
+/*
+ * AHCI Low Level Driver - Direct I/O (Zero-copy)
+ *
+ * ユーザーバッファのページを pin して DMA マップし、PRDT を直接構築する。
+ * SG バウンスバッファと kmalloc バッファへのコピーを行わない。
+ *
+ * 登録済みバッファ (AHCI_IOC_REGISTER_BUFFERS) は登録時に一度だけ pin / DMA
+ * マップしておき、コマンドごとには PRDT の切り出しと dma_sync のみを行う。
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-mapping.h>
+#include <linux/swiotlb.h>
+#include "ahci_lld.h"
+#include "ahci_lld_fis.h"
+
+/**
+ * ahci_dio_prdt_count - DMA マップ済みセグメントに必要な PRDT エントリ数
+ * @dio: Direct I/O 情報
+ *
+ * 隣接セグメントの結合は考慮しない上限値を返す。
+ */
+int ahci_dio_prdt_count(struct ahci_dio *dio)
+{
+    struct scatterlist *sg;
+    int count = 0;
+    int i;
+    
+    for_each_sgtable_dma_sg(&dio->sgt, sg, i)
+        count += DIV_ROUND_UP(sg_dma_len(sg), AHCI_PRDT_MAX_BYTES);
+    
+    return count;
+}
+EXPORT_SYMBOL_GPL(ahci_dio_prdt_count);
+
+/**
+ * ahci_dio_bounced - DMA マップが swiotlb のバウンスバッファ経由になったか
+ * @dev: DMA デバイス
+ * @dio: Direct I/O 情報 (DMA マップ済み)
+ *
+ * swiotlb が有効なデバイスでは、バウンスされたセグメントは dma_need_sync()
+ * が真になる（dma-direct・IOMMU のどちらでも、DMA API 自身が swiotlb の
+ * 領域かを判定する）。DMA コヒーレントでないプラットフォームではキャッシュ
+ * 同期が必要なセグメントも真になるため、その場合は多めに数える。
+ */
+static bool ahci_dio_bounced(struct device *dev, struct ahci_dio *dio)
+{
+    struct scatterlist *sg;
+    int i;
+    
+    if (!is_swiotlb_active(dev))
+        return false;
+    
+    for_each_sgtable_dma_sg(&dio->sgt, sg, i) {
+        if (dma_need_sync(dev, sg_dma_address(sg)))
+            return true;
+    }
+    
+    return false;
+}
+
+/**
+ * ahci_dio_pin_map - ユーザー範囲を pin して DMA マップする
+ * @port: ポートデバイス構造体
+ * @dio: Direct I/O 情報 (dir は設定済みであること)
+ * @addr: ユーザー仮想アドレス
+ * @len: バイト数
+ * @gup_flags: pin_user_pages_fast() に渡すフラグ
+ *
+ * 失敗時は途中まで確保したリソースをすべて解放する。
+ *
+ * Return: 成功時0、失敗時負のエラーコード
+ */
+static int ahci_dio_pin_map(struct ahci_port_device *port, struct ahci_dio *dio,
+                            unsigned long addr, u32 len, unsigned int gup_flags)
+{
+    struct device *dev = &port->hba->pdev->dev;
+    unsigned int offset = offset_in_page(addr);
+    int pinned;
+    int ret;
+    
+    dio->nr_pages = DIV_ROUND_UP(offset + len, PAGE_SIZE);
+    dio->pages = kvmalloc_node(array_size(dio->nr_pages, sizeof(*dio->pages)), GFP_KERNEL,
+                               port->node);
+    if (!dio->pages)
+        return -ENOMEM;
+    
+    pinned = pin_user_pages_fast(addr & PAGE_MASK, dio->nr_pages, gup_flags, dio->pages);
+    if (pinned != dio->nr_pages) {
+        if (pinned > 0)
+            unpin_user_pages(dio->pages, pinned);
+        ret = pinned < 0 ? pinned : -EFAULT;
+        goto err_free_pages;
+    }
+    
+    ret = sg_alloc_table_from_pages(&dio->sgt, dio->pages, dio->nr_pages,
+                                    offset, len, GFP_KERNEL);
+    if (ret)
+        goto err_unpin;
+    
+    ret = dma_map_sgtable(dev, &dio->sgt, dio->dir, 0);
+    if (ret)
+        goto err_free_sgt;
+    
+    /* DMA マスク外のページは swiotlb でコピーされる（隠れた memcpy） */
+    if (ahci_dio_bounced(dev, dio)) {
+        atomic64_inc(&port->dma_bounced);
+        dev_dbg(port->device, "Direct I/O: mapping of %u bytes bounced through swiotlb\n", len);
+    }
+    
+    dio->prdt_count = ahci_dio_prdt_count(dio);
+    return 0;
+    
+err_free_sgt:
+    sg_free_table(&dio->sgt);
+err_unpin:
+    unpin_user_pages(dio->pages, dio->nr_pages);
+err_free_pages:
+    kvfree(dio->pages);
+    dio->pages = NULL;
+    return ret;
+}
+
+/**
+ * ahci_dio_release - ahci_dio_pin_map() で確保したリソースを解放する
+ * @port: ポートデバイス構造体
+ * @dio: Direct I/O 情報
+ */
+static void ahci_dio_release(struct ahci_port_device *port, struct ahci_dio *dio)
+{
+    dma_unmap_sgtable(&port->hba->pdev->dev, &dio->sgt, dio->dir, 0);
+    sg_free_table(&dio->sgt);
+    
+    /* デバイスが書き込んだ可能性のあるページは dirty にする */
+    unpin_user_pages_dirty_lock(dio->pages, dio->nr_pages, dio->dir != DMA_TO_DEVICE);
+    
+    kvfree(dio->pages);
+}
+
+/**
+ * ahci_port_dio_map - ユーザーバッファを pin して DMA マップする
+ * @port: ポートデバイス構造体
+ * @req: コマンドリクエスト構造体
+ *
+ * AHCI_CMD_FLAG_DIRECT が指定され、buffer / buffer_len が AHCI_DIO_ALIGN に
+ * 揃っている場合のみ Direct I/O を使う。条件を満たさない場合や、
+ * セグメント数が Command Table に収まらない場合は NULL を返し、
+ * 呼び出し元は従来のバウンスバッファ経由で転送する。
+ * AHCI_CMD_FLAG_FIXED / AHCI_CMD_FLAG_POOL の場合はユーザーページを使わないので
+ * 常に NULL を返す。
+ *
+ * Return: Direct I/O 情報、バウンスバッファを使う場合 NULL、失敗時 ERR_PTR
+ */
+struct ahci_dio *ahci_port_dio_map(struct ahci_port_device *port,
+                                   struct ahci_cmd_request *req)
+{
+    bool is_write = (req->flags & AHCI_CMD_FLAG_WRITE) ? true : false;
+    struct ahci_dio *dio;
+    int ret;
+    
+    if (!(req->flags & AHCI_CMD_FLAG_DIRECT) ||
+        (req->flags & (AHCI_CMD_FLAG_FIXED | AHCI_CMD_FLAG_POOL)) || req->buffer_len == 0)
+        return NULL;
+    
+    if (!IS_ALIGNED(req->buffer | req->buffer_len, AHCI_DIO_ALIGN)) {
+        dev_dbg(port->device, "Direct I/O: unaligned buffer 0x%llx/%u, using bounce buffers\n",
+                req->buffer, req->buffer_len);
+        return NULL;
+    }
+    
+    dio = kzalloc_node(sizeof(*dio), GFP_KERNEL, port->node);
+    if (!dio)
+        return ERR_PTR(-ENOMEM);
+    
+    dio->dir = is_write ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+    
+    /* READ はデバイスがユーザーページへ書き込む */
+    ret = ahci_dio_pin_map(port, dio, req->buffer, req->buffer_len,
+                           is_write ? 0 : FOLL_WRITE);
+    if (ret) {
+        kfree(dio);
+        dev_err(port->device, "Direct I/O: failed to map user buffer (%d)\n", ret);
+        return ERR_PTR(ret);
+    }
+    
+    if (dio->prdt_count > AHCI_CMD_TABLE_MAX_PRDT) {
+        dev_dbg(port->device, "Direct I/O: %d segments exceed %d PRDT entries, using bounce buffers\n",
+                dio->prdt_count, AHCI_CMD_TABLE_MAX_PRDT);
+        ahci_port_dio_unmap(port, dio);
+        return NULL;
+    }
+    
+    dev_dbg(port->device, "Direct I/O: %d pages, %d PRDT entries for %u bytes\n",
+            dio->nr_pages, dio->prdt_count, req->buffer_len);
+    
+    return dio;
+}
+EXPORT_SYMBOL_GPL(ahci_port_dio_map);
+
+/**
+ * ahci_port_dio_unmap - Direct I/O の DMA マップを解除してページを解放する
+ * @port: ポートデバイス構造体
+ * @dio: Direct I/O 情報 (NULL 可)
+ *
+ * DMA 完了後、プロセスコンテキストから呼び出すこと。
+ */
+void ahci_port_dio_unmap(struct ahci_port_device *port, struct ahci_dio *dio)
+{
+    if (!dio)
+        return;
+    
+    ahci_dio_release(port, dio);
+    kfree(dio);
+}
+EXPORT_SYMBOL_GPL(ahci_port_dio_unmap);
+
+/**
+ * ahci_dio_build_prdt - DMA マップ済みセグメントから PRDT を構築する
+ * @dio: Direct I/O 情報
+ * @prdt: PRDT (dio->prdt_count 個のエントリが必要)
+ *
+ * DMA アドレスが連続するセグメントは 4MB まで1エントリにまとめ、
+ * 4MB を超えるセグメントは複数のエントリに分割する。
+ *
+ * Return: 構築した PRDT エントリ数
+ */
+int ahci_dio_build_prdt(struct ahci_dio *dio, struct ahci_prdt_entry *prdt)
+{
+    struct scatterlist *sg;
+    int count = 0;
+    int i;
+    
+    /* dio->prdt_count は結合なしの上限なので溢れない */
+    for_each_sgtable_dma_sg(&dio->sgt, sg, i)
+        count = ahci_prdt_append(prdt, count, dio->prdt_count,
+                                 sg_dma_address(sg), sg_dma_len(sg));
+    
+    return count;
+}
+EXPORT_SYMBOL_GPL(ahci_dio_build_prdt);
+
+/**
+ * ahci_port_fixed_release_all - 登録済みバッファをすべて解放する
+ * @port: ポートデバイス構造体
+ *
+ * Context: fixed_lock held
+ */
+static void ahci_port_fixed_release_all(struct ahci_port_device *port)
+{
+    u32 i;
+    
+    for (i = 0; i < port->nr_fixed_bufs; i++) {
+        ahci_dio_release(port, &port->fixed_bufs[i].dio);
+        kvfree(port->fixed_bufs[i].segs);
+    }
+    
+    kvfree(port->fixed_bufs);
+    port->fixed_bufs = NULL;
+    port->nr_fixed_bufs = 0;
+}
+
+/**
+ * ahci_port_register_buffers - AHCI_IOC_REGISTER_BUFFERS の処理
+ * @port: ポートデバイス構造体
+ * @reg: 登録要求 (nr == 0 の場合は登録解除)
+ *
+ * 各バッファのページを FOLL_LONGTERM で pin して DMA マップし、
+ * バッファ全体の PRDT エントリ列を事前に計算しておく。以後のコマンドは
+ * buf_index とオフセットでバッファを指定し、pin / dma_map を行わない。
+ *
+ * Return: 成功時0、既に登録済みの場合-EBUSY、その他負のエラーコード
+ */
+int ahci_port_register_buffers(struct ahci_port_device *port, struct ahci_buf_register *reg)
+{
+    struct ahci_buf_vec *vecs;
+    struct ahci_fixed_buf *bufs;
+    u32 i;
+    int ret = 0;
+    
+    if (reg->nr == 0)
+        return ahci_port_unregister_buffers(port);
+    
+    if (reg->nr > AHCI_MAX_FIXED_BUFS)
+        return -EINVAL;
+    
+    vecs = memdup_user((void __user *)reg->iovs, reg->nr * sizeof(*vecs));
+    if (IS_ERR(vecs))
+        return PTR_ERR(vecs);
+    
+    bufs = kvmalloc_node(array_size(reg->nr, sizeof(*bufs)), GFP_KERNEL | __GFP_ZERO, port->node);
+    if (!bufs) {
+        kfree(vecs);
+        return -ENOMEM;
+    }
+    
+    mutex_lock(&port->fixed_lock);
+    
+    if (port->nr_fixed_bufs) {
+        ret = -EBUSY;
+        goto out_unlock;
+    }
+    
+    port->fixed_bufs = bufs;
+    
+    for (i = 0; i < reg->nr; i++) {
+        struct ahci_fixed_buf *fb = &bufs[i];
+        
+        if (vecs[i].len == 0 || vecs[i].len > AHCI_MAX_TRANSFER_SIZE ||
+            !IS_ALIGNED(vecs[i].addr | vecs[i].len, AHCI_DIO_ALIGN)) {
+            ret = -EINVAL;
+            break;
+        }
+        
+        /* 方向はコマンドごとに変わるので双方向でマップする */
+        fb->dio.dir = DMA_BIDIRECTIONAL;
+        ret = ahci_dio_pin_map(port, &fb->dio, vecs[i].addr, vecs[i].len,
+                               FOLL_WRITE | FOLL_LONGTERM);
+        if (ret)
+            break;
+        
+        fb->len = vecs[i].len;
+        fb->segs = kvmalloc_node(array_size(fb->dio.prdt_count, sizeof(*fb->segs)), GFP_KERNEL,
+                                 port->node);
+        if (!fb->segs) {
+            ahci_dio_release(port, &fb->dio);
+            ret = -ENOMEM;
+            break;
+        }
+        fb->nr_segs = ahci_dio_build_prdt(&fb->dio, fb->segs);
+        
+        port->nr_fixed_bufs = i + 1;
+    }
+    
+    /* 以後 bufs の所有権は port->fixed_bufs にある */
+    bufs = NULL;
+    if (ret) {
+        dev_err(port->device, "Failed to register fixed buffer %u (%d)\n", i, ret);
+        ahci_port_fixed_release_all(port);
+    } else {
+        dev_info(port->device, "Registered %u fixed buffers\n", reg->nr);
+    }
+    
+out_unlock:
+    mutex_unlock(&port->fixed_lock);
+    kvfree(bufs);
+    kfree(vecs);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(ahci_port_register_buffers);
+
+/**
+ * ahci_port_unregister_buffers - 登録済みバッファを解除する
+ * @port: ポートデバイス構造体
+ *
+ * NCQ スロットが使用中の間は、そのスロットが登録済みバッファを
+ * DMA 中の可能性があるため解除しない。
+ *
+ * Return: 成功時0、スロット使用中の場合-EBUSY
+ */
+int ahci_port_unregister_buffers(struct ahci_port_device *port)
+{
+    int ret = 0;
+    
+    mutex_lock(&port->fixed_lock);
+    if (port->nr_fixed_bufs && atomic_read(&port->active_slots)) {
+        ret = -EBUSY;
+    } else if (port->nr_fixed_bufs) {
+        dev_info(port->device, "Unregistering %u fixed buffers\n", port->nr_fixed_bufs);
+        ahci_port_fixed_release_all(port);
+    }
+    mutex_unlock(&port->fixed_lock);
+    
+    return ret;
+}
+EXPORT_SYMBOL_GPL(ahci_port_unregister_buffers);
+
+/**
+ * ahci_port_fixed_sync - 登録済みバッファの範囲を含む SG エントリを同期する
+ * @port: ポートデバイス構造体
+ * @fb: 登録済みバッファ
+ * @offset: バッファ先頭からのオフセット
+ * @len: バイト数
+ * @for_cpu: true = CPU 向け (READ 完了後)、false = デバイス向け (発行前)
+ *
+ * バッファは dma_map_sgtable() でマップされているので、dma_sync_single_*()
+ * ではなく、範囲に掛かる SG エントリ (CPU 側のページ列) を丸ごと
+ * dma_sync_sg_*() で同期する。スリープしない。
+ */
+static void ahci_port_fixed_sync(struct ahci_port_device *port, struct ahci_fixed_buf *fb,
+                                 u64 offset, u32 len, bool for_cpu)
+{
+    struct device *dev = &port->hba->pdev->dev;
+    struct scatterlist *first = NULL;
+    struct scatterlist *sg;
+    u64 pos = 0;
+    int nents = 0;
+    int i;
+    
+    for_each_sgtable_sg(&fb->dio.sgt, sg, i) {
+        if (pos >= offset + len)
+            break;
+        if (pos + sg->length > offset) {
+            if (!first)
+                first = sg;
+            nents++;
+        }
+        pos += sg->length;
+    }
+    
+    if (!first)
+        return;
+    
+    if (for_cpu)
+        dma_sync_sg_for_cpu(dev, first, nents, DMA_BIDIRECTIONAL);
+    else
+        dma_sync_sg_for_device(dev, first, nents, DMA_BIDIRECTIONAL);
+}
+
+/**
+ * ahci_port_fixed_build_prdt - 登録済みバッファの範囲から PRDT を構築する
+ * @port: ポートデバイス構造体
+ * @req: コマンドリクエスト構造体 (buf_index, buffer = オフセット, buffer_len)
+ * @prdt: PRDT (NULL の場合はエントリ数の計算のみ)
+ * @max: PRDT エントリ数の上限 (Command Table の容量)
+ *
+ * 事前計算済みの PRDT エントリ列から [offset, offset + buffer_len) に
+ * 当たる部分を切り出してコピーし、その範囲をデバイス向けに同期する。
+ * Command Table を選ぶ前に @prdt = NULL で呼び出して必要数を求める。
+ *
+ * Return: 構築した PRDT エントリ数、失敗時負のエラーコード
+ */
+int ahci_port_fixed_build_prdt(struct ahci_port_device *port, struct ahci_cmd_request *req,
+                               struct ahci_prdt_entry *prdt, int max)
+{
+    struct ahci_fixed_buf *fb;
+    u64 offset = req->buffer;
+    u32 remaining = req->buffer_len;
+    u64 pos = 0;
+    int count = 0;
+    int i;
+    
+    if (!IS_ALIGNED(offset | remaining, AHCI_DIO_ALIGN))
+        return -EINVAL;
+    
+    mutex_lock(&port->fixed_lock);
+    
+    if (req->buf_index >= port->nr_fixed_bufs) {
+        mutex_unlock(&port->fixed_lock);
+        return -EINVAL;
+    }
+    
+    fb = &port->fixed_bufs[req->buf_index];
+    if (offset > fb->len || remaining > fb->len - offset) {
+        mutex_unlock(&port->fixed_lock);
+        return -EINVAL;
+    }
+    
+    for (i = 0; i < fb->nr_segs && remaining > 0; i++) {
+        u32 seg_len = fb->segs[i].dbc + 1;
+        u64 skip;
+        u32 chunk;
+        
+        /* offset より前のセグメントは読み飛ばす */
+        if (pos + seg_len <= offset) {
+            pos += seg_len;
+            continue;
+        }
+        
+        if (count >= max) {
+            mutex_unlock(&port->fixed_lock);
+            return -EINVAL;
+        }
+        
+        skip = offset > pos ? offset - pos : 0;
+        chunk = min_t(u32, seg_len - skip, remaining);
+        
+        if (prdt) {
+            prdt[count].dba = fb->segs[i].dba + skip;
+            prdt[count].reserved = 0;
+            prdt[count].dbc = chunk - 1;  /* 0-based */
+        }
+        
+        remaining -= chunk;
+        pos += seg_len;
+        count++;
+    }
+    
+    if (prdt)
+        ahci_port_fixed_sync(port, fb, offset, req->buffer_len, false);
+    
+    mutex_unlock(&port->fixed_lock);
+    
+    return count;
+}
+EXPORT_SYMBOL_GPL(ahci_port_fixed_build_prdt);
+
+/**
+ * ahci_port_fixed_sync_for_cpu - 登録済みバッファへの READ 完了後の同期
+ * @port: ポートデバイス構造体
+ * @slot: スロット番号
+ *
+ * スロットに保存したリクエスト (buf_index, オフセット, 長さ) の範囲を
+ * CPU 向けに同期する。スロット使用中は登録解除されない
+ * (ahci_port_unregister_buffers() が -EBUSY) ので fixed_lock は取らない。
+ * スリープしないので割り込みハンドラから呼び出せる。
+ */
+void ahci_port_fixed_sync_for_cpu(struct ahci_port_device *port, int slot)
+{
+    struct ahci_cmd_request *req = &port->slots[slot].req;
+    
+    ahci_port_fixed_sync(port, &port->fixed_bufs[req->buf_index], req->buffer,
+                         req->buffer_len, true);
+}
+EXPORT_SYMBOL_GPL(ahci_port_fixed_sync_for_cpu);
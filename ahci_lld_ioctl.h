@@ -27,23 +27,48 @@
 /* Free Command Slot */
 #define AHCI_IOC_FREE_SLOT      _IOW(AHCI_LLD_IOC_MAGIC, 12, int)
 
+/* NCQ Command Completion Wait (blocking) */
+#define AHCI_IOC_WAIT_CMD       _IOWR(AHCI_LLD_IOC_MAGIC, 13, struct ahci_wait_cmd)
+
+/* NCQ Completion Notification (eventfd, -1 = unregister) */
+#define AHCI_IOC_SET_EVENTFD    _IOW(AHCI_LLD_IOC_MAGIC, 14, int)
+
+/* SQ Ring Doorbell (returns number of consumed SQ entries) */
+#define AHCI_IOC_SQ_DOORBELL    _IO(AHCI_LLD_IOC_MAGIC, 15)
+
+/* SQ Polling Thread (idle timeout in ms, 0 = stop) */
+#define AHCI_IOC_SQ_THREAD      _IOW(AHCI_LLD_IOC_MAGIC, 16, __u32)
+
+/* Batch Submit */
+#define AHCI_IOC_SUBMIT_BATCH   _IOWR(AHCI_LLD_IOC_MAGIC, 17, struct ahci_submit_batch)
+
+/* Reap Completed Commands (NCQ) */
+#define AHCI_IOC_REAP_CMD       _IOWR(AHCI_LLD_IOC_MAGIC, 18, struct ahci_reap_cmd)
+
+/* Registered (Fixed) Buffers (nr = 0 = unregister) */
+#define AHCI_IOC_REGISTER_BUFFERS _IOW(AHCI_LLD_IOC_MAGIC, 19, struct ahci_buf_register)
+
 /* Read Dump */
 #define AHCI_IOC_READ_REGS      _IOR(AHCI_LLD_IOC_MAGIC, 20, struct ahci_port_regs)
 
+/* GHC Device: Command Completion Coalescing (/dev/ahci_lld_ghc) */
+#define AHCI_IOC_GHC_SET_CCC    _IOW(AHCI_LLD_IOC_MAGIC, 30, struct ahci_ccc_config)
+#define AHCI_IOC_GHC_GET_CCC    _IOR(AHCI_LLD_IOC_MAGIC, 31, struct ahci_ccc_config)
+
 /* コマンド要求構造体 */
 struct ahci_cmd_request {
     __u8 command;           /* ATA command code */
     __u8 features;          /* Features register */
     __u8 device;            /* Device register */
-    __u8 reserved1;
+    __u8 features_exp;      /* Features (15:8), FPDMA: sector count high byte */
     
     __u64 lba;              /* LBA (Logical Block Address) */
     __u16 count;            /* Sector count */
-    __u16 reserved2;
+    __u16 buf_index;        /* Registered buffer index (AHCI_CMD_FLAG_FIXED) */
     
     __u32 flags;            /* Command flags (direction, etc.) */
     
-    __u64 buffer;           /* User buffer address */
+    __u64 buffer;           /* User buffer address (FIXED: offset into the registered buffer) */
     __u32 buffer_len;       /* Buffer length in bytes */
     __u32 timeout_ms;       /* Timeout in milliseconds */
     
@@ -63,6 +88,10 @@ struct ahci_cmd_request {
 #define AHCI_CMD_FLAG_ATAPI     (1 << 1)  /* ATAPI command */
 #define AHCI_CMD_FLAG_NCQ       (1 << 2)  /* NCQ (Native Command Queuing) */
 #define AHCI_CMD_FLAG_PREFETCH  (1 << 3)  /* Prefetchable */
+#define AHCI_CMD_FLAG_AUTO_TAG  (1 << 4)  /* Driver picks a free NCQ tag (SUBMIT_BATCH only) */
+#define AHCI_CMD_FLAG_DIRECT    (1 << 5)  /* Zero-copy DMA to/from the user buffer (4-byte aligned) */
+#define AHCI_CMD_FLAG_FIXED     (1 << 6)  /* DMA to/from registered buffer buf_index (NCQ only) */
+#define AHCI_CMD_FLAG_POOL      (1 << 7)  /* DMA to/from the mmap'd SG pool, buffer = pool offset */
 
 /* Set Device Bits 構造体 - NCQ完了情報 */
 struct ahci_sdb {
@@ -76,6 +105,158 @@ struct ahci_sdb {
     __u64 buffer[32];       /* Buffer pointer (valid for completed slots only) */
 };
 
+/* NCQ完了待ち構造体 - AHCI_IOC_WAIT_CMD */
+struct ahci_wait_cmd {
+    /* === Input === */
+    __u32 mask;             /* Slots to wait for (0 = all slots) */
+    __u32 min_complete;     /* Return once this many slots in mask completed (0 = 1) */
+    __u32 timeout_ms;       /* Timeout in milliseconds (0 = default) */
+    __u32 reserved;
+    
+    /* === Output === */
+    struct ahci_sdb sdb;    /* Same as AHCI_IOC_PROBE_CMD, limited to mask */
+};
+
+/* 回収エントリ - AHCI_IOC_REAP_CMD */
+struct ahci_reap_entry {
+    __u8 tag;               /* NCQ tag */
+    __u8 status;            /* ATA Status */
+    __u8 error;             /* ATA Error */
+    __u8 reserved;
+    __u16 count_out;        /* Count result */
+    __u16 reserved2;
+    __u64 lba_out;          /* LBA result */
+    __u64 latency_ns;       /* Issue to completion */
+};
+
+/* 完了回収構造体 - AHCI_IOC_REAP_CMD */
+struct ahci_reap_cmd {
+    /* === Input === */
+    __u32 mask;             /* Slots to reap (0 = all slots) */
+    __u32 max_entries;      /* Size of entries[] (1-32) */
+    __u32 min_complete;     /* Wait until this many slots in mask completed (0 = don't wait) */
+    __u32 timeout_ms;       /* Timeout in milliseconds (0 = default) */
+    __u64 entries;          /* User pointer to struct ahci_reap_entry[max_entries] */
+    
+    /* === Output === */
+    __u32 nr;               /* Number of entries filled (slots are freed) */
+    __u32 reserved;
+};
+
+/* バッチ発行構造体 - AHCI_IOC_SUBMIT_BATCH */
+struct ahci_submit_batch {
+    /* === Input === */
+    __u32 count;            /* Number of requests (1-32) */
+    __u32 reserved;
+    __u64 reqs;             /* User pointer to struct ahci_cmd_request[count] (tag written back) */
+    
+    /* === Output === */
+    __u32 submitted;        /* Number of issued requests (reqs[0..submitted-1]) */
+    __u32 tags;             /* Bitmap of issued tags */
+};
+
+/* 登録バッファ - AHCI_IOC_REGISTER_BUFFERS */
+struct ahci_buf_vec {
+    __u64 addr;             /* User address (4-byte aligned) */
+    __u64 len;              /* Length in bytes (4-byte aligned) */
+};
+
+/* バッファ登録構造体 - AHCI_IOC_REGISTER_BUFFERS */
+struct ahci_buf_register {
+    __u32 nr;               /* Number of buffers (0 = unregister, max 1024) */
+    __u32 reserved;
+    __u64 iovs;             /* User pointer to struct ahci_buf_vec[nr] */
+};
+
+/*
+ * 完了リング - mmap(fd, offset = AHCI_CQ_RING_OFFSET) でマップ
+ *
+ * Single producer (kernel) / single consumer (user):
+ * - kernel: cqes[tail % entries] に書き込み後、tail をインクリメント
+ * - user:   head != tail の間 cqes[head % entries] を読み、head をインクリメント
+ */
+#define AHCI_CQ_RING_OFFSET     0               /* mmap offset */
+#define AHCI_CQ_RING_ENTRIES    128             /* Power of 2 */
+
+/* 完了エントリ (16 bytes) */
+struct ahci_cq_entry {
+    __u8 tag;               /* NCQ tag (slot) */
+    __u8 status;            /* ATA Status */
+    __u8 error;             /* ATA Error */
+    __u8 reserved;
+    __u32 bytes;            /* Transferred bytes (buffer_len) */
+    __u64 latency_ns;       /* PxCI write to completion detection */
+};
+
+/* 完了リング (1 page) */
+struct ahci_cq_ring {
+    __u32 head;             /* Consumer index (written by user) */
+    __u32 tail;             /* Producer index (written by kernel) */
+    __u32 entries;          /* AHCI_CQ_RING_ENTRIES */
+    __u32 overflow;         /* Completions dropped because the ring was full */
+    __u32 reserved[12];
+    
+    struct ahci_cq_entry cqes[AHCI_CQ_RING_ENTRIES];
+};
+
+/*
+ * SQ リング - mmap(fd, offset = AHCI_SQ_RING_OFFSET) でマップ
+ *
+ * Single producer (user) / single consumer (kernel):
+ * - user:   sqes[tail % entries] に NCQ リクエストを書き込み後、tail をインクリメント
+ *           して AHCI_IOC_SQ_DOORBELL（SQ スレッド使用時は NEED_WAKEUP の場合のみ）
+ * - kernel: head から tail までをまとめて発行し、head を進める
+ *
+ * 完了は完了リングに投入され、スロットは自動的に解放される。
+ * mmap のオフセットはページ単位なので、どのアーキテクチャの PAGE_SIZE
+ * (4KB〜256KB) でも完了リングと別のページになる 512KB に置く。
+ */
+#define AHCI_SQ_RING_OFFSET     0x80000         /* mmap offset (multiple of PAGE_SIZE) */
+#define AHCI_SQ_RING_ENTRIES    32              /* Power of 2 */
+
+/* SQ リングフラグ */
+#define AHCI_SQ_NEED_WAKEUP     (1 << 0)        /* SQ thread sleeping, ring the doorbell */
+
+/* SQ リング (1 page) */
+struct ahci_sq_ring {
+    __u32 head;             /* Consumer index (written by kernel) */
+    __u32 tail;             /* Producer index (written by user) */
+    __u32 entries;          /* AHCI_SQ_RING_ENTRIES */
+    __u32 flags;            /* AHCI_SQ_* (written by kernel) */
+    __u32 reserved[12];
+    
+    struct ahci_cmd_request sqes[AHCI_SQ_RING_ENTRIES];
+};
+
+/*
+ * SG バッファプール - mmap(fd, offset = AHCI_SG_POOL_OFFSET + pool offset, MAP_SHARED)
+ *
+ * ドライバの DMA バッファ (AHCI_SG_POOL_CHUNK 単位) を直接マップする。
+ * pool offset と長さは AHCI_SG_POOL_CHUNK の倍数であること。
+ * AHCI_CMD_FLAG_POOL のコマンドは buffer にプール先頭からのオフセットを指定し、
+ * デバイスはマップ中の範囲へ直接 DMA する（コピーなし）。
+ */
+#define AHCI_SG_POOL_OFFSET     0x100000        /* mmap offset of pool offset 0 */
+#define AHCI_SG_POOL_CHUNK      (128 * 1024)    /* Mapping granularity (one SG buffer) */
+#define AHCI_SG_POOL_SIZE       (256 * 1024 * 1024)
+
+/*
+ * io_uring パススルー (IORING_OP_URING_CMD, IORING_SETUP_SQE128 が必要)
+ *
+ * sqe->cmd_op = AHCI_URING_CMD_ISSUE
+ * sqe->cmd    = struct ahci_cmd_request (NCQ のみ)
+ *
+ * CQE res:  0 = 成功, -EIO = ATA エラー (Status.ERR), その他は負のエラーコード
+ * CQE res2: AHCI_URING_RES2(tag, status, error) (IORING_SETUP_CQE32 の場合のみ)
+ */
+#define AHCI_URING_CMD_ISSUE    AHCI_IOC_ISSUE_CMD
+
+#define AHCI_URING_RES2(tag, status, error) \
+    (((__u64)(tag) << 16) | ((__u64)(error) << 8) | (__u64)(status))
+#define AHCI_URING_RES2_STATUS(res2)    ((__u8)(res2))
+#define AHCI_URING_RES2_ERROR(res2)     ((__u8)((res2) >> 8))
+#define AHCI_URING_RES2_TAG(res2)       ((__u8)((res2) >> 16))
+
 /* ポートレジスタダンプ構造体 */
 struct ahci_port_regs {
     __u32 clb;              /* 0x00: PxCLB - Command List Base Address */
@@ -98,4 +279,17 @@ struct ahci_port_regs {
     __u32 devslp;           /* 0x44: PxDEVSLP - Device Sleep */
 };
 
+/*
+ * Command Completion Coalescing 設定 (AHCI_IOC_GHC_SET_CCC / GET_CCC)
+ * ports のいずれかのポートで completions 個のコマンドが完了するか、
+ * 最初の完了から timeout_ms 経過すると CCC 割り込みが1回だけ発生する。
+ */
+struct ahci_ccc_config {
+    __u32 ports;            /* Coalesced ports (CCC_PORTS bitmap, 0 = disable CCC) */
+    __u16 timeout_ms;       /* CCC_CTL.TV: 1-65535 ms */
+    __u8 completions;       /* CCC_CTL.CC: 1-255 commands */
+    __u8 irq_bit;           /* CCC_CTL.INT: IS bit of the CCC interrupt (out) */
+    __u64 interrupts;       /* CCC interrupts serviced since load (out) */
+};
+
 #endif /* AHCI_LLD_IOCTL_H */
@@ -0,0 +1,362 @@
+/*
+ * AHCI Low Level Driver - Interrupt Handling
+ *
+ * HBA割り込み（MSI-X/MSI/INTx）の登録と、IS/PxIS のデマルチプレクスを担当
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/interrupt.h>
+#include <linux/topology.h>
+#include <linux/io.h>
+#include "ahci_lld.h"
+
+/**
+ * ahci_port_handle_irq - Service a port interrupt
+ * @port: Port device structure
+ *
+ * Reads and clears PxIS (RW1C) according to AHCI 1.3.1 Section 10.7.2.1,
+ * then wakes up the waiters depending on the reported events:
+ * - DHRS/PSS: Non-NCQ command finished (D2H Register / PIO Setup FIS)
+ * - SDBS:     NCQ commands finished (Set Device Bits FIS), the finished
+ *             slots are recorded by ahci_port_complete_ncq() so that the
+ *             registered eventfd is signalled without a PROBE/WAIT call
+ * - DPS:      PRD with I bit processed
+ * - TFES etc: Error, wake everybody so that the error is reported quickly.
+ *             With NCQ commands outstanding the HBA has stopped, so
+ *             eh_work is queued to reset the port and fail them
+ *
+ * PCS/PRCS are not cleared by writing PxIS, so PxSERR.DIAG.X/N are cleared
+ * here to deassert them.
+ *
+ * Called from the HBA interrupt handler (hard IRQ context).
+ */
+void ahci_port_handle_irq(struct ahci_port_device *port)
+{
+    void __iomem *port_mmio = port->port_mmio;
+    u32 status;
+
+    status = ioread32(port_mmio + AHCI_PORT_IS);
+    if (!status)
+        return;
+
+    /* PxIS をクリア */
+    iowrite32(status, port_mmio + AHCI_PORT_IS);
+
+    /* PCS/PRCS は PxSERR をクリアしないと落ちない */
+    if (status & (AHCI_PORT_INT_PCS | AHCI_PORT_INT_PRCS))
+        iowrite32(AHCI_PORT_SERR_DIAG_X | AHCI_PORT_SERR_DIAG_N,
+                  port_mmio + AHCI_PORT_SERR);
+
+    spin_lock(&port->slot_lock);
+    port->irq_status |= status;
+    port->irq_count++;
+    /* NCQ エラー: リカバリ（COMRESET）はスリープするのでワークで行う */
+    if ((status & AHCI_PORT_INT_ERROR) && !port->ncq_frozen &&
+        (port->slots_issued & ~port->slots_completed)) {
+        port->eh_pending = true;
+        queue_work(system_unbound_wq, &port->eh_work);
+    }
+    spin_unlock(&port->slot_lock);
+
+    if (status & AHCI_PORT_INT_ERROR)
+        dev_err_ratelimited(port->device, "Port error interrupt (PxIS=0x%08x PxTFD=0x%08x)\n",
+                            status, ioread32(port_mmio + AHCI_PORT_TFD));
+
+    /* Non-NCQ: slot 0 の待機者を起こす */
+    if (status & (AHCI_PORT_INT_DHRS | AHCI_PORT_INT_PSS | AHCI_PORT_INT_ERROR))
+        complete(&port->cmd_done);
+
+    /* NCQ: 完了スロットを記録（eventfd 通知） */
+    if (status & AHCI_PORT_INT_SDBS)
+        ahci_port_complete_ncq(port);
+
+    /* NCQ: PxSACT/PxCI の変化を待っている待機者を起こす */
+    if (status & (AHCI_PORT_INT_SDBS | AHCI_PORT_INT_DHRS |
+                  AHCI_PORT_INT_DPS | AHCI_PORT_INT_ERROR))
+        wake_up(&port->ncq_wq);
+}
+EXPORT_SYMBOL_GPL(ahci_port_handle_irq);
+
+/**
+ * ahci_port_irq_mask - PxIE value for a running port
+ * @port: Port device structure
+ *
+ * Ports in the CCC set do not raise an interrupt per completion; their
+ * DHRS/PSS/SDBS/DPS status is picked up when the CCC interrupt fires.
+ * Error and connect change interrupts are always enabled.
+ *
+ * Return: Value to program into PxIE
+ */
+u32 ahci_port_irq_mask(struct ahci_port_device *port)
+{
+    if (READ_ONCE(port->hba->ccc_ports) & (1U << port->port_no))
+        return AHCI_PORT_INT_DEFAULT & ~AHCI_PORT_INT_CCC_MASKED;
+
+    return AHCI_PORT_INT_DEFAULT;
+}
+EXPORT_SYMBOL_GPL(ahci_port_irq_mask);
+
+/**
+ * ahci_lld_irq_handler - HBA interrupt handler
+ * @irq: IRQ number
+ * @dev_instance: HBA structure
+ *
+ * Demultiplexes IS (Interrupt Status) to the ports according to
+ * AHCI 1.3.1 Section 10.7.2.1: each port's PxIS is cleared first,
+ * then the corresponding IS.IPS bit.
+ *
+ * When Command Completion Coalescing is enabled, IS bit CCC_CTL.INT
+ * reports that the completion count or timeout was reached; every port
+ * in the CCC set is serviced for it (Section 11.4).
+ *
+ * Return: IRQ_HANDLED if any port interrupt was pending, IRQ_NONE otherwise
+ */
+static irqreturn_t ahci_lld_irq_handler(int irq, void *dev_instance)
+{
+    struct ahci_hba *hba = dev_instance;
+    void __iomem *mmio = hba->mmio;
+    u32 ccc_ports = READ_ONCE(hba->ccc_ports);
+    u32 irq_stat;
+    int i;
+
+    irq_stat = ioread32(mmio + AHCI_IS);
+    if (!irq_stat)
+        return IRQ_NONE;
+
+    /* CCC 割り込み: CCC 対象ポートの PxIS をまとめて処理 */
+    if (ccc_ports && (irq_stat & (1U << hba->ccc_irq_bit))) {
+        hba->ccc_interrupts++;
+        for (i = 0; i < AHCI_MAX_PORTS; i++) {
+            if ((ccc_ports & (1U << i)) && hba->ports[i])
+                ahci_port_handle_irq(hba->ports[i]);
+        }
+    }
+
+    for (i = 0; i < AHCI_MAX_PORTS; i++) {
+        if (!(irq_stat & hba->ports_impl & (1U << i)))
+            continue;
+
+        if (hba->ports[i])
+            ahci_port_handle_irq(hba->ports[i]);
+        else
+            iowrite32(0xFFFFFFFF, mmio + AHCI_PORT_OFFSET(i) + AHCI_PORT_IS);
+    }
+
+    /* PxIS クリア後に IS をクリア */
+    iowrite32(irq_stat, mmio + AHCI_IS);
+
+    return IRQ_HANDLED;
+}
+
+/**
+ * ahci_hba_setup_irq - Allocate an interrupt vector and enable HBA interrupts
+ * @hba: HBA structure
+ *
+ * Requests a single vector, preferring MSI-X, then MSI, falling back to
+ * legacy INTx. After the handler is installed, pending IS bits are cleared
+ * and GHC.IE is set (AHCI 1.3.1 Section 10.1.2 step 7).
+ *
+ * Must be called after all port devices are created, since the handler
+ * dereferences hba->ports[].
+ *
+ * Return: 0 on success, negative error code on failure
+ */
+int ahci_hba_setup_irq(struct ahci_hba *hba)
+{
+    struct pci_dev *pdev = hba->pdev;
+    void __iomem *mmio = hba->mmio;
+    unsigned long irq_flags = 0;
+    u32 ghc;
+    int ret;
+
+    ret = pci_alloc_irq_vectors(pdev, 1, 1, PCI_IRQ_ALL_TYPES);
+    if (ret < 0) {
+        dev_err(&pdev->dev, "Failed to allocate IRQ vector (%d)\n", ret);
+        return ret;
+    }
+
+    hba->irq = pci_irq_vector(pdev, 0);
+
+    /* INTx は他デバイスと共有される可能性がある */
+    if (!pci_dev_msi_enabled(pdev))
+        irq_flags |= IRQF_SHARED;
+
+    ret = request_irq(hba->irq, ahci_lld_irq_handler, irq_flags, DRIVER_NAME, hba);
+    if (ret) {
+        dev_err(&pdev->dev, "Failed to request IRQ %d (%d)\n", hba->irq, ret);
+        pci_free_irq_vectors(pdev);
+        return ret;
+    }
+
+    /* 完了処理（ハンドラと完了ワーク）を HBA の NUMA ノードの CPU に寄せる */
+    if (hba->node != NUMA_NO_NODE)
+        irq_update_affinity_hint(hba->irq, cpumask_of_node(hba->node));
+
+    /* 保留中の割り込みをクリアしてから GHC.IE をセット */
+    iowrite32(ioread32(mmio + AHCI_IS), mmio + AHCI_IS);
+
+    ghc = ioread32(mmio + AHCI_GHC);
+    ghc |= AHCI_GHC_IE;
+    iowrite32(ghc, mmio + AHCI_GHC);
+
+    hba->irq_enabled = true;
+
+    dev_info(&pdev->dev, "IRQ %d enabled (%s, node %d)\n", hba->irq,
+             pdev->msix_enabled ? "MSI-X" : pdev->msi_enabled ? "MSI" : "INTx", hba->node);
+    return 0;
+}
+EXPORT_SYMBOL_GPL(ahci_hba_setup_irq);
+
+/**
+ * ahci_hba_free_irq - Disable HBA interrupts and release the vector
+ * @hba: HBA structure
+ *
+ * Command Completion Coalescing is turned off first.
+ */
+void ahci_hba_free_irq(struct ahci_hba *hba)
+{
+    void __iomem *mmio = hba->mmio;
+    struct ahci_ccc_config off = { .ports = 0 };
+    u32 ghc;
+
+    if (!hba->irq_enabled)
+        return;
+
+    if (hba->ccc_ports)
+        ahci_hba_set_ccc(hba, &off);
+
+    /* GHC.IE をクリア */
+    ghc = ioread32(mmio + AHCI_GHC);
+    ghc &= ~AHCI_GHC_IE;
+    iowrite32(ghc, mmio + AHCI_GHC);
+
+    hba->irq_enabled = false;
+
+    irq_update_affinity_hint(hba->irq, NULL);
+    free_irq(hba->irq, hba);
+    pci_free_irq_vectors(hba->pdev);
+
+    dev_info(&hba->pdev->dev, "IRQ %d released\n", hba->irq);
+}
+EXPORT_SYMBOL_GPL(ahci_hba_free_irq);
+
+/**
+ * ahci_hba_ccc_update_ports - Reprogram PxIE of the running ports
+ * @hba: HBA structure
+ * @changed: Ports that joined or left the CCC set
+ *
+ * Stopped ports (PxIE = 0) are left alone; ahci_port_start() programs
+ * ahci_port_irq_mask() when they are started.
+ */
+static void ahci_hba_ccc_update_ports(struct ahci_hba *hba, u32 changed)
+{
+    int i;
+
+    for (i = 0; i < AHCI_MAX_PORTS; i++) {
+        struct ahci_port_device *port = hba->ports[i];
+
+        if (!(changed & (1U << i)) || !port)
+            continue;
+
+        if (ioread32(port->port_mmio + AHCI_PORT_IE))
+            iowrite32(ahci_port_irq_mask(port), port->port_mmio + AHCI_PORT_IE);
+    }
+}
+
+/**
+ * ahci_hba_set_ccc - Configure Command Completion Coalescing
+ * @hba: HBA structure
+ * @cfg: Coalesced ports and thresholds (cfg->ports = 0 disables CCC)
+ *
+ * Follows AHCI 1.3.1 Section 11: CCC_CTL.EN is cleared before TV/CC and
+ * CCC_PORTS are written, then set again. Ports in the set stop raising
+ * per-completion interrupts (see ahci_port_irq_mask()); the HBA raises
+ * the CCC interrupt after cfg->completions commands completed on those
+ * ports, or cfg->timeout_ms after the first one.
+ *
+ * Return: 0 on success, -EOPNOTSUPP without CAP.CCCS, -EINVAL if the
+ *         configuration is invalid or interrupts are not enabled
+ */
+int ahci_hba_set_ccc(struct ahci_hba *hba, const struct ahci_ccc_config *cfg)
+{
+    void __iomem *mmio = hba->mmio;
+    struct device *dev = &hba->pdev->dev;
+    u32 old_ports, ctl;
+
+    if (!(ioread32(mmio + AHCI_CAP) & AHCI_CAP_CCCS))
+        return -EOPNOTSUPP;
+
+    if (cfg->ports) {
+        if (!hba->irq_enabled) {
+            dev_err(dev, "CCC: interrupts are not enabled\n");
+            return -EINVAL;
+        }
+        if ((cfg->ports & ~hba->ports_impl) || !cfg->completions || !cfg->timeout_ms) {
+            dev_err(dev, "CCC: invalid config (ports=0x%08x cc=%u tv=%u)\n",
+                    cfg->ports, cfg->completions, cfg->timeout_ms);
+            return -EINVAL;
+        }
+    }
+
+    mutex_lock(&hba->ccc_lock);
+
+    old_ports = hba->ccc_ports;
+
+    /* TV/CC/CCC_PORTS は EN=0 の間に書く */
+    ctl = ioread32(mmio + AHCI_CCC_CTL) & ~AHCI_CCC_CTL_EN;
+    iowrite32(ctl, mmio + AHCI_CCC_CTL);
+
+    /* 無効化時も閾値は保持しておき、sysfs で 1 項目ずつ設定できるようにする */
+    if (cfg->completions && cfg->timeout_ms) {
+        ctl &= ~(AHCI_CCC_CTL_TV | AHCI_CCC_CTL_CC);
+        ctl |= ((u32)cfg->timeout_ms << AHCI_CCC_CTL_TV_SHIFT) |
+               ((u32)cfg->completions << AHCI_CCC_CTL_CC_SHIFT);
+        iowrite32(ctl, mmio + AHCI_CCC_CTL);
+    }
+
+    if (cfg->ports) {
+        iowrite32(cfg->ports, mmio + AHCI_CCC_PORTS);
+        iowrite32(ctl | AHCI_CCC_CTL_EN, mmio + AHCI_CCC_CTL);
+
+        hba->ccc_irq_bit = (ctl & AHCI_CCC_CTL_INT) >> AHCI_CCC_CTL_INT_SHIFT;
+    } else {
+        iowrite32(0, mmio + AHCI_CCC_PORTS);
+    }
+
+    /* ハンドラが CCC 割り込みを処理するポートを更新してから PxIE を切り替える */
+    WRITE_ONCE(hba->ccc_ports, cfg->ports);
+    ahci_hba_ccc_update_ports(hba, old_ports ^ cfg->ports);
+
+    mutex_unlock(&hba->ccc_lock);
+
+    if (cfg->ports)
+        dev_info(dev, "CCC enabled: ports=0x%08x completions=%u timeout=%ums (IS bit %u)\n",
+                 cfg->ports, cfg->completions, cfg->timeout_ms, hba->ccc_irq_bit);
+    else
+        dev_info(dev, "CCC disabled\n");
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(ahci_hba_set_ccc);
+
+/**
+ * ahci_hba_get_ccc - Read the current Command Completion Coalescing setup
+ * @hba: HBA structure
+ * @cfg: Output; ports is 0 while CCC is disabled
+ *
+ * Thresholds are read back from CCC_CTL, so they show the hardware
+ * defaults until CCC has been configured.
+ */
+void ahci_hba_get_ccc(struct ahci_hba *hba, struct ahci_ccc_config *cfg)
+{
+    u32 ctl = ioread32(hba->mmio + AHCI_CCC_CTL);
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->ports = READ_ONCE(hba->ccc_ports);
+    cfg->timeout_ms = (ctl & AHCI_CCC_CTL_TV) >> AHCI_CCC_CTL_TV_SHIFT;
+    cfg->completions = (ctl & AHCI_CCC_CTL_CC) >> AHCI_CCC_CTL_CC_SHIFT;
+    cfg->irq_bit = (ctl & AHCI_CCC_CTL_INT) >> AHCI_CCC_CTL_INT_SHIFT;
+    cfg->interrupts = READ_ONCE(hba->ccc_interrupts);
+}
+EXPORT_SYMBOL_GPL(ahci_hba_get_ccc);
@@ -13,6 +13,13 @@
 #include <linux/slab.h>
 #include <linux/io.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
+#include <linux/mm.h>
+#include <linux/workqueue.h>
+#include <linux/io_uring/cmd.h>
 #include "ahci_lld.h"
 #include "ahci_lld_ioctl.h"
 #include "ahci_lld_fis.h"
@@ -35,8 +42,16 @@ static int ahci_lld_open(struct inode *inode, struct file *file)
     struct ahci_port_device *port_dev;
     
     port_dev = container_of(inode->i_cdev, struct ahci_port_device, cdev);
+    
+    /* blk-mq フロントエンドがスロットを所有しているポートは開けない */
+    if (port_dev->blk)
+        return -EBUSY;
+    
     file->private_data = port_dev;
     
+    /* io_uring は IOCB_NOWAIT で発行し、-EAGAIN ならワーカーで再発行する */
+    file->f_mode |= FMODE_NOWAIT;
+    
     pr_info("ahci_lld: opened port %d\n", port_dev->port_no);
     return 0;
 }
@@ -44,22 +59,298 @@ static int ahci_lld_open(struct inode *inode, struct file *file)
 static int ahci_lld_release(struct inode *inode, struct file *file)
 {
     struct ahci_port_device *port_dev = file->private_data;
+    
+    /* SQ ポーリングスレッドを起動したファイルが閉じられたら停止 */
+    if (port_dev->sq_owner == file)
+        ahci_port_sq_stop_thread(port_dev);
+    
+    /* 登録元のファイルが閉じられたら eventfd を解除 */
+    if (port_dev->eventfd_owner == file) {
+        ahci_port_set_eventfd(port_dev, -1);
+        port_dev->eventfd_owner = NULL;
+    }
+    
+    /* 登録元のファイルが閉じられたら登録済みバッファを解除（使用中なら残す） */
+    if (port_dev->fixed_owner == file && ahci_port_unregister_buffers(port_dev) == 0)
+        port_dev->fixed_owner = NULL;
+    
     pr_info("ahci_lld: closed port %d\n", port_dev->port_no);
     return 0;
 }
 
-static ssize_t ahci_lld_read(struct file *file, char __user *buf,
-                              size_t count, loff_t *ppos)
+/**
+ * ahci_lld_rw_iter - read_iter/write_iter 共通処理
+ * @iocb: カーネル I/O 制御ブロック (ki_pos = LBA * 512)
+ * @iter: 転送するデータ
+ * @is_write: 書き込みの場合 true
+ *
+ * O_DIRECT の非同期 kiocb (io_uring / libaio) は NCQ で発行して
+ * -EIOCBQUEUED を返す。それ以外は slot 0 で同期発行するため rw_lock で
+ * 直列化する（ahci_port_rw_iter() が実行中の NCQ コマンドの完了を待つ）。
+ * 同期発行は完了まで待つので IOCB_NOWAIT では -EAGAIN を返す。
+ */
+static ssize_t ahci_lld_rw_iter(struct kiocb *iocb, struct iov_iter *iter, bool is_write)
 {
-    /* 将来実装予定 */
-    return -EINVAL;
+    struct ahci_port_device *port_dev = iocb->ki_filp->private_data;
+    ssize_t ret;
+    
+    if (!iov_iter_count(iter))
+        return 0;
+    
+    if (!is_sync_kiocb(iocb) && (iocb->ki_flags & IOCB_DIRECT)) {
+        ret = ahci_port_rw_queue(port_dev, iocb, iter, is_write);
+        if (ret)
+            return ret;
+    }
+    
+    if (iocb->ki_flags & IOCB_NOWAIT)
+        return -EAGAIN;
+    
+    if (mutex_lock_interruptible(&port_dev->rw_lock))
+        return -ERESTARTSYS;
+    
+    ret = ahci_port_rw_iter(port_dev, iocb->ki_pos, iter, is_write,
+                            iocb->ki_flags & IOCB_DIRECT);
+    mutex_unlock(&port_dev->rw_lock);
+    
+    if (ret > 0)
+        iocb->ki_pos += ret;
+    return ret;
 }
 
-static ssize_t ahci_lld_write(struct file *file, const char __user *buf,
-                               size_t count, loff_t *ppos)
+static ssize_t ahci_lld_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    return ahci_lld_rw_iter(iocb, to, false);
+}
+
+static ssize_t ahci_lld_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    return ahci_lld_rw_iter(iocb, from, true);
+}
+
+/**
+ * ahci_lld_collect_sdb - 完了済みスロットの情報を回収する
+ * @port_dev: ポートデバイス構造体
+ * @sdb: 出力先
+ * @mask: 回収対象スロットのビットマップ
+ *
+ * 完了フラグの立っているスロットの status/error/buffer を sdb に格納し、
+ * 完了フラグをクリアする（同じスロットは一度しか報告されない）。
+ */
+static void ahci_lld_collect_sdb(struct ahci_port_device *port_dev,
+                                 struct ahci_sdb *sdb, u32 mask)
+{
+    unsigned long flags;
+    int tag;
+    
+    memset(sdb, 0, sizeof(*sdb));
+    
+    spin_lock_irqsave(&port_dev->slot_lock, flags);
+    
+    /* Read PxSACT (currently active slots) */
+    sdb->sactive = ioread32(port_dev->port_mmio + AHCI_PORT_SACT);
+    
+    for (tag = 0; tag < 32; tag++) {
+        if (!(mask & (1U << tag)) || !port_dev->slots[tag].completed)
+            continue;
+        
+        /* Mark as completed in SDB */
+        sdb->completed |= (1U << tag);
+        
+        /* Copy status/error from the slot's request structure */
+        sdb->status[tag] = port_dev->slots[tag].req.status;
+        sdb->error[tag] = port_dev->slots[tag].req.error;
+        
+        /* Buffer pointer (user space address) */
+        sdb->buffer[tag] = port_dev->slots[tag].req.buffer;
+        
+        /* Clear completed flag (so it won't be returned again) */
+        port_dev->slots[tag].completed = false;
+    }
+    
+    spin_unlock_irqrestore(&port_dev->slot_lock, flags);
+}
+
+/**
+ * ahci_lld_wait_slots - NCQコマンドの完了をスリープして待つ
+ * @port_dev: ポートデバイス構造体
+ * @mask: 対象スロットのビットマップ
+ * @target: 待つ完了数（使用中スロット数で頭打ち、0 なら待たない）
+ * @timeout_ms: タイムアウト（ミリ秒、0 = デフォルト）
+ *
+ * mask 内の使用中スロットのうち target 個が完了するか、タイムアウトする
+ * まで ncq_wq で待機する。起床は SDBS 割り込みで行われる。
+ * 割り込みが無効な場合は AHCI_IRQ_RECHECK_MS ごとに再確認する。
+ *
+ * Return: 成功時0、-ETIMEDOUT、シグナル受信時-ERESTARTSYS
+ */
+static int ahci_lld_wait_slots(struct ahci_port_device *port_dev, u32 mask,
+                               unsigned int target, unsigned int timeout_ms)
+{
+    unsigned long deadline;
+    unsigned int outstanding;
+    unsigned long flags;
+    long left;
+    
+    if (!timeout_ms)
+        timeout_ms = AHCI_CMD_DEFAULT_TIMEOUT_MS;
+    deadline = jiffies + msecs_to_jiffies(timeout_ms);
+    
+    /* 使用中スロット数より多くは待たない */
+    spin_lock_irqsave(&port_dev->slot_lock, flags);
+    outstanding = hweight32(mask & (u32)port_dev->slots_in_use);
+    spin_unlock_irqrestore(&port_dev->slot_lock, flags);
+    if (target > outstanding)
+        target = outstanding;
+    
+    while (target &&
+           hweight32(ahci_peek_slot_completion(port_dev) & mask) < target) {
+        left = (long)(deadline - jiffies);
+        if (left <= 0)
+            return -ETIMEDOUT;
+        
+        if (!port_dev->hba->irq_enabled)
+            left = min_t(long, left, msecs_to_jiffies(AHCI_IRQ_RECHECK_MS));
+        
+        left = wait_event_interruptible_timeout(port_dev->ncq_wq,
+                    hweight32(ahci_peek_slot_completion(port_dev) & mask) >= target,
+                    left);
+        if (left < 0)
+            return left;
+    }
+    
+    return 0;
+}
+
+/**
+ * ahci_lld_wait_cmd - AHCI_IOC_WAIT_CMD の処理
+ * @port_dev: ポートデバイス構造体
+ * @wait: 待機条件（入力）と完了情報（出力）
+ *
+ * タイムアウト時は完了情報を回収しない（次回の PROBE/WAIT で報告される）。
+ *
+ * Return: 成功時0、-ETIMEDOUT、シグナル受信時-ERESTARTSYS
+ */
+static int ahci_lld_wait_cmd(struct ahci_port_device *port_dev,
+                             struct ahci_wait_cmd *wait)
+{
+    u32 mask = wait->mask ? wait->mask : 0xFFFFFFFF;
+    int ret;
+    
+    ret = ahci_lld_wait_slots(port_dev, mask,
+                              wait->min_complete ? wait->min_complete : 1,
+                              wait->timeout_ms);
+    if (ret)
+        return ret;
+    
+    ahci_check_slot_completion(port_dev);
+    ahci_lld_collect_sdb(port_dev, &wait->sdb, mask);
+    
+    return 0;
+}
+
+/**
+ * ahci_lld_reap_cmd - 完了済みスロットを回収して解放する
+ * @port_dev: ポートデバイス構造体
+ * @reap: 回収条件（入力）と回収数（出力）
+ *
+ * min_complete 個の完了を待ってから（0 なら待たない）、完了済みスロットを
+ * 最大 max_entries 個 struct ahci_reap_entry としてユーザーの配列に返す。
+ * 返したスロットはバッファごと解放するので、FREE_SLOT は不要。
+ *
+ * Return: 成功時0、負のエラーコード
+ */
+static int ahci_lld_reap_cmd(struct ahci_port_device *port_dev,
+                             struct ahci_reap_cmd *reap)
+{
+    u32 mask = reap->mask ? reap->mask : 0xFFFFFFFF;
+    struct ahci_reap_entry *entries;
+    unsigned long flags;
+    u32 nr = 0;
+    u32 i;
+    int tag;
+    int ret;
+    
+    reap->nr = 0;
+    
+    if (reap->max_entries == 0 || reap->max_entries > 32)
+        return -EINVAL;
+    
+    ret = ahci_lld_wait_slots(port_dev, mask, reap->min_complete, reap->timeout_ms);
+    if (ret)
+        return ret;
+    
+    entries = kcalloc_node(reap->max_entries, sizeof(*entries), GFP_KERNEL, port_dev->node);
+    if (!entries)
+        return -ENOMEM;
+    
+    ahci_check_slot_completion(port_dev);
+    
+    spin_lock_irqsave(&port_dev->slot_lock, flags);
+    for (tag = 0; tag < 32 && nr < reap->max_entries; tag++) {
+        struct ahci_cmd_slot *cmd_slot = &port_dev->slots[tag];
+        
+        if (!(mask & (1U << tag)) || !cmd_slot->completed || cmd_slot->reaping)
+            continue;
+        
+        entries[nr].tag = tag;
+        entries[nr].status = cmd_slot->req.status;
+        entries[nr].error = cmd_slot->req.error;
+        entries[nr].count_out = cmd_slot->req.count_out;
+        entries[nr].lba_out = cmd_slot->req.lba_out;
+        entries[nr].latency_ns = cmd_slot->latency_ns;
+        
+        /* 解放するまで FREE_SLOT やタグの再利用に取られないようにする */
+        cmd_slot->completed = false;
+        cmd_slot->reaping = true;
+        nr++;
+    }
+    spin_unlock_irqrestore(&port_dev->slot_lock, flags);
+    
+    /* 回収したスロットはその場で解放（reaping なので他の経路は解放しない） */
+    for (i = 0; i < nr; i++)
+        ahci_free_slot(port_dev, entries[i].tag);
+    
+    reap->nr = nr;
+    if (nr && copy_to_user((void __user *)reap->entries, entries, nr * sizeof(*entries)))
+        ret = -EFAULT;
+    
+    kfree(entries);
+    return ret;
+}
+
+/**
+ * ahci_lld_poll - NCQ完了と空きスロットの readiness を通知する
+ * @file: ファイル構造体
+ * @wait: poll テーブル
+ *
+ * EPOLLIN:  完了済みで未回収のスロットがある（PROBE/WAIT で回収可能）
+ * EPOLLOUT: 実装されている（CAP.NCS 以下の）スロットに空きがある（ISSUE_CMD を発行可能）
+ *
+ * 完了は SDBS 割り込み、スロット解放は ahci_free_slot() が ncq_wq を起こす。
+ */
+static __poll_t ahci_lld_poll(struct file *file, poll_table *wait)
 {
-    /* 将来実装予定 */
-    return -EINVAL;
+    struct ahci_port_device *port_dev = file->private_data;
+    __poll_t mask = 0;
+    unsigned long flags;
+    u32 implemented;
+    u32 in_use;
+    
+    poll_wait(file, &port_dev->ncq_wq, wait);
+    
+    if (ahci_peek_slot_completion(port_dev))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    
+    spin_lock_irqsave(&port_dev->slot_lock, flags);
+    in_use = (u32)port_dev->slots_in_use;
+    spin_unlock_irqrestore(&port_dev->slot_lock, flags);
+    
+    implemented = GENMASK((ioread32(port_dev->hba->mmio + AHCI_CAP) & AHCI_CAP_NCS) >> 8, 0);
+    if ((in_use & implemented) != implemented)
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    
+    return mask;
 }
 
 static long ahci_lld_ioctl(struct file *file, unsigned int cmd,
@@ -72,24 +363,32 @@ static long ahci_lld_ioctl(struct file *file, unsigned int cmd,
     /* Port Manipulation */
     case AHCI_IOC_PORT_RESET:
         dev_info(port_dev->device, "IOCTL: Port Reset\n");
-        ret = ahci_port_comreset(port_dev);
+        mutex_lock(&port_dev->eh_lock);
+        ret = ahci_port_halt(port_dev, true);
+        mutex_unlock(&port_dev->eh_lock);
         break;
-        
+    
     case AHCI_IOC_PORT_START:
         dev_info(port_dev->device, "IOCTL: Port Start\n");
+        mutex_lock(&port_dev->eh_lock);
         ret = ahci_port_start(port_dev);
+        mutex_unlock(&port_dev->eh_lock);
         break;
-        
+    
     case AHCI_IOC_PORT_STOP:
         dev_info(port_dev->device, "IOCTL: Port Stop\n");
-        ret = ahci_port_stop(port_dev);
+        mutex_lock(&port_dev->eh_lock);
+        ret = ahci_port_halt(port_dev, false);
+        mutex_unlock(&port_dev->eh_lock);
         break;
     
     /* Command Issue */
     case AHCI_IOC_ISSUE_CMD:
     {
         struct ahci_cmd_request req;
-        u8 *data_buf = NULL;
+        struct ahci_dio *dio = NULL;
+        struct iov_iter iter;
+        struct iov_iter *iterp = NULL;
         
         dev_info(port_dev->device, "IOCTL: Issue Command\n");
         
@@ -113,40 +412,44 @@ static long ahci_lld_ioctl(struct file *file, unsigned int cmd,
                 break;
             }
             
-            /* NCQの場合、tag上書き時に前回のスロットを破棄 */
+            /* NCQの場合、tag上書き時に完了済みの前回のスロットを破棄（実行中なら -EBUSY） */
             if (req.flags & AHCI_CMD_FLAG_NCQ) {
                 int tag = req.tag;
                 if (tag >= 0 && tag < 32) {
-                    struct ahci_cmd_slot *slot = &port_dev->slots[tag];
-                    if (slot->buffer) {
-                        dev_dbg(port_dev->device, "Freeing old slot for tag %d before reuse\n", tag);
-                        kfree(slot->buffer);
-                        slot->buffer = NULL;
+                    dev_dbg(port_dev->device, "Freeing old slot for tag %d before reuse\n", tag);
+                    /* スロットを解放（slots_in_useビットをクリア、SGバッファ範囲も返却） */
+                    ret = ahci_port_release_slot(port_dev, tag);
+                    if (ret) {
+                        dev_err(port_dev->device, "Tag %d is still in flight\n", tag);
+                        break;
                     }
-                    /* スロット自体も解放（slots_in_useビットをクリア） */
-                    ahci_free_slot(port_dev, tag);
                 }
             }
             
-            data_buf = kmalloc(req.buffer_len, GFP_KERNEL);
-            if (!data_buf) {
-                ret = -ENOMEM;
+            /* Direct I/O: ユーザーページを直接 DMA（条件を満たさなければバウンス） */
+            /* 登録済みバッファ / SGプールの場合は NULL が返る */
+            dio = ahci_port_dio_map(port_dev, &req);
+            if (IS_ERR(dio)) {
+                ret = PTR_ERR(dio);
                 break;
             }
-            
-            /* Write direction の場合はユーザーバッファからコピー */
-            if (req.flags & AHCI_CMD_FLAG_WRITE) {
-                if (copy_from_user(data_buf, (void __user *)req.buffer, req.buffer_len)) {
-                    dev_err(port_dev->device, "Failed to copy write buffer from user\n");
-                    kfree(data_buf);
-                    ret = -EFAULT;
-                    break;
-                }
-            }
+        }
+        
+        /*
+         * SGバッファ経由の場合はユーザーバッファとSGバッファの間で 128KB ずつ
+         * 直接コピーする（中間のカーネルバッファは確保しない）
+         */
+        if (req.buffer_len > 0 && !dio &&
+            !(req.flags & (AHCI_CMD_FLAG_FIXED | AHCI_CMD_FLAG_POOL))) {
+            ret = import_ubuf((req.flags & AHCI_CMD_FLAG_WRITE) ? ITER_SOURCE : ITER_DEST,
+                              u64_to_user_ptr(req.buffer), req.buffer_len, &iter);
+            if (ret)
+                break;
+            iterp = &iter;
         }
         
         /* コマンド発行（NCQ/Non-NCQ統合） */
-        ret = ahci_port_issue_cmd(port_dev, &req, data_buf);
+        ret = ahci_port_issue_cmd(port_dev, &req, iterp, dio);
         if (ret == 0) {
             if (req.flags & AHCI_CMD_FLAG_NCQ) {
                 /* NCQ: tagだけを返す（データはまだコピーしない） */
@@ -155,28 +458,19 @@ static long ahci_lld_ioctl(struct file *file, unsigned int cmd,
                     ret = -EFAULT;
                 }
             } else {
-                /* Non-NCQ: Read direction の場合はユーザーバッファへコピー */
-                if (!(req.flags & AHCI_CMD_FLAG_WRITE) && req.buffer_len > 0) {
-                    if (copy_to_user((void __user *)req.buffer, data_buf, req.buffer_len)) {
-                        dev_err(port_dev->device, "Failed to copy result to user\n");
-                        ret = -EFAULT;
-                    }
-                }
-                
+                /* Non-NCQ: Read データは ahci_port_issue_cmd() でコピー済み */
                 /* 結果フィールド (status, error, etc) をユーザー空間へコピー */
                 if (copy_to_user((void __user *)arg, &req, sizeof(req))) {
                     dev_err(port_dev->device, "Failed to copy result fields to user\n");
                     ret = -EFAULT;
                 }
                 
-                /* Non-NCQ: バッファをすぐに解放 */
-                if (data_buf)
-                    kfree(data_buf);
+                /* Non-NCQ: Direct I/O をすぐにアンマップ */
+                ahci_port_dio_unmap(port_dev, dio);
             }
         } else {
-            /* エラー時はバッファを解放 */
-            if (data_buf)
-                kfree(data_buf);
+            /* エラー時は Direct I/O をアンマップ */
+            ahci_port_dio_unmap(port_dev, dio);
         }
         break;
     }
@@ -185,40 +479,14 @@ static long ahci_lld_ioctl(struct file *file, unsigned int cmd,
     case AHCI_IOC_PROBE_CMD:
     {
         struct ahci_sdb sdb;
-        unsigned long flags;
-        int tag;
         
         dev_dbg(port_dev->device, "IOCTL: Probe Commands\n");
         
-        memset(&sdb, 0, sizeof(sdb));
-        
         /* Check hardware for newly completed commands */
         ahci_check_slot_completion(port_dev);
         
-        spin_lock_irqsave(&port_dev->slot_lock, flags);
-        
-        /* Read PxSACT (currently active slots) */
-        sdb.sactive = ioread32(port_dev->port_mmio + AHCI_PORT_SACT);
-        
         /* Collect completed slots */
-        for (tag = 0; tag < 32; tag++) {
-            if (port_dev->slots[tag].completed) {
-                /* Mark as completed in SDB */
-                sdb.completed |= (1 << tag);
-                
-                /* Copy status/error from the slot's request structure */
-                sdb.status[tag] = port_dev->slots[tag].req.status;
-                sdb.error[tag] = port_dev->slots[tag].req.error;
-                
-                /* Buffer pointer (user space address) */
-                sdb.buffer[tag] = port_dev->slots[tag].req.buffer;
-                
-                /* Clear completed flag (so it won't be returned again) */
-                port_dev->slots[tag].completed = false;
-            }
-        }
-        
-        spin_unlock_irqrestore(&port_dev->slot_lock, flags);
+        ahci_lld_collect_sdb(port_dev, &sdb, 0xFFFFFFFF);
         
         /* Copy result to user space (status/error only) */
         if (copy_to_user((void __user *)arg, &sdb, sizeof(sdb))) {
@@ -230,6 +498,135 @@ static long ahci_lld_ioctl(struct file *file, unsigned int cmd,
         break;
     }
     
+    /* Wait for Completed Commands (NCQ, blocking) */
+    case AHCI_IOC_WAIT_CMD:
+    {
+        struct ahci_wait_cmd wait;
+        
+        dev_dbg(port_dev->device, "IOCTL: Wait Commands\n");
+        
+        if (copy_from_user(&wait, (void __user *)arg, sizeof(wait))) {
+            ret = -EFAULT;
+            break;
+        }
+        
+        ret = ahci_lld_wait_cmd(port_dev, &wait);
+        if (ret)
+            break;
+        
+        if (copy_to_user((void __user *)arg, &wait, sizeof(wait))) {
+            dev_err(port_dev->device, "Failed to copy wait result to user\n");
+            ret = -EFAULT;
+        }
+        break;
+    }
+    
+    /* Reap Completed Commands (NCQ) */
+    case AHCI_IOC_REAP_CMD:
+    {
+        struct ahci_reap_cmd reap;
+        
+        dev_dbg(port_dev->device, "IOCTL: Reap Commands\n");
+        
+        if (copy_from_user(&reap, (void __user *)arg, sizeof(reap))) {
+            ret = -EFAULT;
+            break;
+        }
+        
+        ret = ahci_lld_reap_cmd(port_dev, &reap);
+        if (ret)
+            break;
+        
+        if (copy_to_user((void __user *)arg, &reap, sizeof(reap))) {
+            dev_err(port_dev->device, "Failed to copy reap result to user\n");
+            ret = -EFAULT;
+        }
+        break;
+    }
+    
+    /* Register Completion eventfd */
+    case AHCI_IOC_SET_EVENTFD:
+    {
+        int efd;
+        
+        if (get_user(efd, (int __user *)arg)) {
+            ret = -EFAULT;
+            break;
+        }
+        
+        dev_dbg(port_dev->device, "IOCTL: Set eventfd %d\n", efd);
+        
+        ret = ahci_port_set_eventfd(port_dev, efd);
+        if (ret == 0)
+            port_dev->eventfd_owner = (efd >= 0) ? file : NULL;
+        break;
+    }
+    
+    /* SQ Ring Doorbell */
+    case AHCI_IOC_SQ_DOORBELL:
+        dev_dbg(port_dev->device, "IOCTL: SQ Doorbell\n");
+        ret = ahci_port_sq_doorbell(port_dev);
+        break;
+    
+    /* SQ Polling Thread */
+    case AHCI_IOC_SQ_THREAD:
+    {
+        __u32 idle_ms;
+        
+        if (get_user(idle_ms, (__u32 __user *)arg)) {
+            ret = -EFAULT;
+            break;
+        }
+        
+        dev_info(port_dev->device, "IOCTL: SQ Thread (idle %u ms)\n", idle_ms);
+        
+        if (idle_ms == 0) {
+            ahci_port_sq_stop_thread(port_dev);
+            ret = 0;
+        } else {
+            ret = ahci_port_sq_start_thread(port_dev, idle_ms);
+            if (ret == 0)
+                port_dev->sq_owner = file;
+        }
+        break;
+    }
+    
+    /* Batch Submit */
+    case AHCI_IOC_SUBMIT_BATCH:
+    {
+        struct ahci_submit_batch batch;
+        
+        if (copy_from_user(&batch, (void __user *)arg, sizeof(batch))) {
+            ret = -EFAULT;
+            break;
+        }
+        
+        dev_info(port_dev->device, "IOCTL: Submit Batch (%u requests)\n", batch.count);
+        
+        ret = ahci_port_submit_batch(port_dev, &batch);
+        if (ret == 0 && copy_to_user((void __user *)arg, &batch, sizeof(batch)))
+            ret = -EFAULT;
+        break;
+    }
+    
+    /* Registered (Fixed) Buffers */
+    case AHCI_IOC_REGISTER_BUFFERS:
+    {
+        struct ahci_buf_register reg;
+        
+        if (copy_from_user(&reg, (void __user *)arg, sizeof(reg))) {
+            ret = -EFAULT;
+            break;
+        }
+        
+        dev_info(port_dev->device, "IOCTL: Register Buffers (%u buffers)\n", reg.nr);
+        
+        ret = ahci_port_register_buffers(port_dev, &reg);
+        if (ret == 0)
+            port_dev->fixed_owner = reg.nr ? file : NULL;
+        break;
+    }
+    
     /* Free Command Slot */
     case AHCI_IOC_FREE_SLOT:
     {
@@ -242,17 +639,8 @@ static long ahci_lld_ioctl(struct file *file, unsigned int cmd,
         
         dev_dbg(port_dev->device, "IOCTL: Free Slot %d\n", slot);
         
-        /* Free slot's buffer if exists */
-        if (slot >= 0 && slot < 32) {
-            struct ahci_cmd_slot *cmd_slot = &port_dev->slots[slot];
-            if (cmd_slot->buffer) {
-                kfree(cmd_slot->buffer);
-                cmd_slot->buffer = NULL;
-            }
-        }
-        
-        ahci_free_slot(port_dev, slot);
-        ret = 0;
+        /* 実行中・カーネル所有のスロットは解放しない（-EBUSY） */
+        ret = ahci_port_release_slot(port_dev, slot);
         break;
     }
     
@@ -271,13 +659,66 @@ static long ahci_lld_ioctl(struct file *file, unsigned int cmd,
     return ret;
 }
 
+/**
+ * ahci_lld_mmap - 完了リング / SQ リング / SGバッファプールをユーザー空間にマップする
+ * @file: ファイル構造体
+ * @vma: マップ先の VMA
+ *
+ * offset AHCI_CQ_RING_OFFSET: struct ahci_cq_ring (1 ページ)
+ * offset AHCI_SQ_RING_OFFSET: struct ahci_sq_ring (1 ページ)
+ * offset AHCI_SG_POOL_OFFSET 以降: SGバッファプール (AHCI_SG_POOL_CHUNK 単位)
+ *
+ * リングは最初の mmap で確保し、ポート削除まで保持する。リングページは
+ * vm_insert_page() でマップするので各マッピングがページの参照を持ち、
+ * ポート削除後も munmap までページは解放されない。
+ */
+static int ahci_lld_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct ahci_port_device *port_dev = file->private_data;
+    unsigned long size = vma->vm_end - vma->vm_start;
+    void *ring;
+    
+    BUILD_BUG_ON(!IS_ALIGNED(AHCI_SQ_RING_OFFSET, PAGE_SIZE));
+    BUILD_BUG_ON(!IS_ALIGNED(AHCI_SG_POOL_OFFSET, PAGE_SIZE));
+    
+    if ((vma->vm_pgoff << PAGE_SHIFT) >= AHCI_SG_POOL_OFFSET)
+        return ahci_port_pool_mmap(port_dev, vma);
+    
+    if (size != PAGE_SIZE)
+        return -EINVAL;
+    
+    ring = ahci_port_get_ring(port_dev, vma->vm_pgoff << PAGE_SHIFT);
+    if (IS_ERR(ring))
+        return PTR_ERR(ring);
+    
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+    
+    return vm_insert_page(vma, vma->vm_start, virt_to_page(ring));
+}
+
+/**
+ * ahci_lld_uring_cmd - IORING_OP_URING_CMD ハンドラ
+ * @ioucmd: io_uring コマンド
+ * @issue_flags: io_uring 発行フラグ
+ */
+static int ahci_lld_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+    struct ahci_port_device *port_dev = ioucmd->file->private_data;
+    
+    return ahci_port_uring_cmd(port_dev, ioucmd, issue_flags);
+}
+
 static struct file_operations ahci_lld_fops = {
     .owner = THIS_MODULE,
     .open = ahci_lld_open,
     .release = ahci_lld_release,
-    .read = ahci_lld_read,
-    .write = ahci_lld_write,
+    .read_iter = ahci_lld_read_iter,
+    .write_iter = ahci_lld_write_iter,
+    .llseek = default_llseek,
     .unlocked_ioctl = ahci_lld_ioctl,
+    .poll = ahci_lld_poll,
+    .mmap = ahci_lld_mmap,
+    .uring_cmd = ahci_lld_uring_cmd,
 };
 
 /* GHCデバイスのファイルオペレーション */
@@ -354,8 +795,27 @@ static ssize_t ahci_ghc_write(struct file *file, const char __user *buf,
 static long ahci_ghc_ioctl(struct file *file, unsigned int cmd,
                             unsigned long arg)
 {
-    /* 将来的にHBAリセットなどの特殊操作を実装 */
-    return -ENOTTY;
+    struct ahci_ghc_device *ghc_dev = file->private_data;
+    struct ahci_ccc_config ccc;
+    
+    switch (cmd) {
+    /* Command Completion Coalescing */
+    case AHCI_IOC_GHC_SET_CCC:
+        if (copy_from_user(&ccc, (void __user *)arg, sizeof(ccc)))
+            return -EFAULT;
+        
+        dev_info(&ghc_dev->hba->pdev->dev, "IOCTL: Set CCC (ports 0x%08x)\n", ccc.ports);
+        return ahci_hba_set_ccc(ghc_dev->hba, &ccc);
+    
+    case AHCI_IOC_GHC_GET_CCC:
+        ahci_hba_get_ccc(ghc_dev->hba, &ccc);
+        if (copy_to_user((void __user *)arg, &ccc, sizeof(ccc)))
+            return -EFAULT;
+        return 0;
+    
+    default:
+        return -ENOTTY;
+    }
 }
 
 static struct file_operations ahci_ghc_fops = {
@@ -367,21 +827,256 @@ static struct file_operations ahci_ghc_fops = {
     .unlocked_ioctl = ahci_ghc_ioctl,
 };
 
+/* sysfs: /sys/class/ahci_lld/ahci_lld_pN/ のSGバッファ・DMA統計 */
+static ssize_t sg_buffers_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_port_device *port_dev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%d\n", READ_ONCE(port_dev->sg_buffer_count));
+}
+static DEVICE_ATTR_RO(sg_buffers);
+
+static ssize_t sg_peak_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_port_device *port_dev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%d\n", READ_ONCE(port_dev->sg_peak));
+}
+static DEVICE_ATTR_RO(sg_peak);
+
+static ssize_t sg_reclaim_events_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_port_device *port_dev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(port_dev->sg_reclaim_events));
+}
+static DEVICE_ATTR_RO(sg_reclaim_events);
+
+static ssize_t sg_reclaimed_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_port_device *port_dev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(port_dev->sg_reclaimed));
+}
+static DEVICE_ATTR_RO(sg_reclaimed);
+
+static ssize_t dma_bounced_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_port_device *port_dev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%lld\n", atomic64_read(&port_dev->dma_bounced));
+}
+static DEVICE_ATTR_RO(dma_bounced);
+
+/* sysfs: 完了待ちモード (irq / poll / hybrid) と学習した平均完了時間 */
+static const char * const ahci_poll_mode_names[] = {
+    [AHCI_POLL_MODE_IRQ] = "irq",
+    [AHCI_POLL_MODE_POLL] = "poll",
+    [AHCI_POLL_MODE_HYBRID] = "hybrid",
+};
+
+static ssize_t poll_mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_port_device *port_dev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%s\n", ahci_poll_mode_names[READ_ONCE(port_dev->poll_mode)]);
+}
+
+static ssize_t poll_mode_store(struct device *dev, struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    struct ahci_port_device *port_dev = dev_get_drvdata(dev);
+    int mode;
+    
+    mode = sysfs_match_string(ahci_poll_mode_names, buf);
+    if (mode < 0)
+        return mode;
+    
+    WRITE_ONCE(port_dev->poll_mode, mode);
+    dev_info(port_dev->device, "Completion wait mode: %s\n", ahci_poll_mode_names[mode]);
+    return count;
+}
+static DEVICE_ATTR_RW(poll_mode);
+
+static ssize_t svc_mean_ns_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_port_device *port_dev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "read %llu write %llu nodata %llu ncq %llu\n",
+                      READ_ONCE(port_dev->svc_mean_ns[AHCI_SVC_READ]),
+                      READ_ONCE(port_dev->svc_mean_ns[AHCI_SVC_WRITE]),
+                      READ_ONCE(port_dev->svc_mean_ns[AHCI_SVC_NODATA]),
+                      READ_ONCE(port_dev->svc_mean_ns[AHCI_SVC_NCQ]));
+}
+static DEVICE_ATTR_RO(svc_mean_ns);
+
+static ssize_t poll_spin_hits_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_port_device *port_dev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(port_dev->poll_spin_hits));
+}
+static DEVICE_ATTR_RO(poll_spin_hits);
+
+static ssize_t poll_sleeps_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_port_device *port_dev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(port_dev->poll_sleeps));
+}
+static DEVICE_ATTR_RO(poll_sleeps);
+
+static struct attribute *ahci_port_attrs[] = {
+    &dev_attr_sg_buffers.attr,
+    &dev_attr_sg_peak.attr,
+    &dev_attr_sg_reclaim_events.attr,
+    &dev_attr_sg_reclaimed.attr,
+    &dev_attr_dma_bounced.attr,
+    &dev_attr_poll_mode.attr,
+    &dev_attr_svc_mean_ns.attr,
+    &dev_attr_poll_spin_hits.attr,
+    &dev_attr_poll_sleeps.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(ahci_port);
+
+/* sysfs: /sys/class/ahci_lld/ahci_lld_ghc/ の Command Completion Coalescing 設定 */
+static ssize_t ahci_ghc_ccc_store(struct device *dev, const char *buf, size_t count,
+                                  unsigned int base, u32 max, size_t field)
+{
+    struct ahci_ghc_device *ghc_dev = dev_get_drvdata(dev);
+    struct ahci_ccc_config ccc;
+    u32 val;
+    int ret;
+    
+    ret = kstrtou32(buf, base, &val);
+    if (ret)
+        return ret;
+    if (val > max)
+        return -EINVAL;
+    
+    /* 読み出した現在の設定の 1 フィールドだけを変更する */
+    ahci_hba_get_ccc(ghc_dev->hba, &ccc);
+    switch (field) {
+    case offsetof(struct ahci_ccc_config, ports):
+        ccc.ports = val;
+        break;
+    case offsetof(struct ahci_ccc_config, timeout_ms):
+        ccc.timeout_ms = val;
+        break;
+    case offsetof(struct ahci_ccc_config, completions):
+        ccc.completions = val;
+        break;
+    }
+    
+    ret = ahci_hba_set_ccc(ghc_dev->hba, &ccc);
+    return ret ? ret : count;
+}
+
+static ssize_t ccc_ports_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_ghc_device *ghc_dev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "0x%08x\n", READ_ONCE(ghc_dev->hba->ccc_ports));
+}
+
+static ssize_t ccc_ports_store(struct device *dev, struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    return ahci_ghc_ccc_store(dev, buf, count, 0, U32_MAX,
+                              offsetof(struct ahci_ccc_config, ports));
+}
+static DEVICE_ATTR_RW(ccc_ports);
+
+static ssize_t ccc_timeout_ms_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_ghc_device *ghc_dev = dev_get_drvdata(dev);
+    struct ahci_ccc_config ccc;
+    
+    ahci_hba_get_ccc(ghc_dev->hba, &ccc);
+    return sysfs_emit(buf, "%u\n", ccc.timeout_ms);
+}
+
+static ssize_t ccc_timeout_ms_store(struct device *dev, struct device_attribute *attr,
+                                    const char *buf, size_t count)
+{
+    return ahci_ghc_ccc_store(dev, buf, count, 10, U16_MAX,
+                              offsetof(struct ahci_ccc_config, timeout_ms));
+}
+static DEVICE_ATTR_RW(ccc_timeout_ms);
+
+static ssize_t ccc_completions_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_ghc_device *ghc_dev = dev_get_drvdata(dev);
+    struct ahci_ccc_config ccc;
+    
+    ahci_hba_get_ccc(ghc_dev->hba, &ccc);
+    return sysfs_emit(buf, "%u\n", ccc.completions);
+}
+
+static ssize_t ccc_completions_store(struct device *dev, struct device_attribute *attr,
+                                     const char *buf, size_t count)
+{
+    return ahci_ghc_ccc_store(dev, buf, count, 10, U8_MAX,
+                              offsetof(struct ahci_ccc_config, completions));
+}
+static DEVICE_ATTR_RW(ccc_completions);
+
+static ssize_t ccc_irq_bit_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_ghc_device *ghc_dev = dev_get_drvdata(dev);
+    struct ahci_ccc_config ccc;
+    
+    ahci_hba_get_ccc(ghc_dev->hba, &ccc);
+    return sysfs_emit(buf, "%u\n", ccc.irq_bit);
+}
+static DEVICE_ATTR_RO(ccc_irq_bit);
+
+static ssize_t ccc_interrupts_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ahci_ghc_device *ghc_dev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(ghc_dev->hba->ccc_interrupts));
+}
+static DEVICE_ATTR_RO(ccc_interrupts);
+
+static struct attribute *ahci_ghc_attrs[] = {
+    &dev_attr_ccc_ports.attr,
+    &dev_attr_ccc_timeout_ms.attr,
+    &dev_attr_ccc_completions.attr,
+    &dev_attr_ccc_irq_bit.attr,
+    &dev_attr_ccc_interrupts.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(ahci_ghc);
+
 /* ポートデバイスの作成 */
 static int ahci_create_port_device(struct ahci_hba *hba, int port_no)
 {
     struct ahci_port_device *port_dev;
     int ret;
     
-    port_dev = kzalloc(sizeof(*port_dev), GFP_KERNEL);
+    port_dev = kzalloc_node(sizeof(*port_dev), GFP_KERNEL, hba->node);
     if (!port_dev)
         return -ENOMEM;
     
     port_dev->port_no = port_no;
     port_dev->hba = hba;
+    port_dev->node = hba->node;
     port_dev->port_mmio = hba->mmio + AHCI_PORT_OFFSET(port_no);
     port_dev->devno = MKDEV(ahci_lld_major, port_no);
     
+    /* 同期オブジェクトの初期化（割り込みハンドラから参照される） */
+    spin_lock_init(&port_dev->slot_lock);
+    init_completion(&port_dev->cmd_done);
+    init_waitqueue_head(&port_dev->ncq_wq);
+    INIT_WORK(&port_dev->complete_work, ahci_port_complete_work);
+    INIT_WORK(&port_dev->eh_work, ahci_port_eh_work);
+    mutex_init(&port_dev->eh_lock);
+    mutex_init(&port_dev->sq_lock);
+    mutex_init(&port_dev->fixed_lock);
+    mutex_init(&port_dev->rw_lock);
+    
     /* cdev初期化と追加 */
     cdev_init(&port_dev->cdev, &ahci_lld_fops);
     port_dev->cdev.owner = THIS_MODULE;
@@ -394,9 +1089,9 @@ static int ahci_create_port_device(struct ahci_hba *hba, int port_no)
     }
     
     /* デバイスノード作成 */
-    port_dev->device = device_create(ahci_lld_class, &hba->pdev->dev,
-                                      port_dev->devno, NULL,
-                                      "ahci_lld_p%d", port_no);
+    port_dev->device = device_create_with_groups(ahci_lld_class, &hba->pdev->dev,
+                                                  port_dev->devno, port_dev, ahci_port_groups,
+                                                  "ahci_lld_p%d", port_no);
     if (IS_ERR(port_dev->device)) {
         ret = PTR_ERR(port_dev->device);
         dev_err(&hba->pdev->dev, "Failed to create device for port %d\n", port_no);
@@ -442,9 +1137,26 @@ static void ahci_destroy_port_device(struct ahci_hba *hba, int port_no)
     if (!port_dev)
         return;
     
-    /* DMAバッファの解放 */
+    /* SQ ポーリングスレッドを停止（コマンド領域を使わなくなる） */
+    ahci_port_sq_stop_thread(port_dev);
+    
+    /* 割り込みは解放済み。エラーリカバリ（完了ワークを積む）を先に止める */
+    cancel_work_sync(&port_dev->eh_work);
+    
+    /* 残っている完了処理（SGバッファからのコピー）を待つ */
+    cancel_work_sync(&port_dev->complete_work);
+    
+    /* DMAバッファの解放（以降はスレッド・ワーカーから参照されない） */
     ahci_port_free_dma_buffers(port_dev);
     
+    if (port_dev->completion_eventfd)
+        eventfd_ctx_put(port_dev->completion_eventfd);
+    
+    ahci_port_free_rings(port_dev);
+    
+    if (ahci_port_unregister_buffers(port_dev))
+        dev_warn(port_dev->device, "Fixed buffers still in use, leaking them\n");
+    
     device_destroy(ahci_lld_class, port_dev->devno);
     cdev_del(&port_dev->cdev);
     kfree(port_dev);
@@ -459,7 +1171,7 @@ static int ahci_create_ghc_device(struct ahci_hba *hba)
     struct ahci_ghc_device *ghc_dev;
     int ret;
     
-    ghc_dev = kzalloc(sizeof(*ghc_dev), GFP_KERNEL);
+    ghc_dev = kzalloc_node(sizeof(*ghc_dev), GFP_KERNEL, hba->node);
     if (!ghc_dev)
         return -ENOMEM;
     
@@ -479,8 +1191,9 @@ static int ahci_create_ghc_device(struct ahci_hba *hba)
     }
     
     /* デバイスノード作成 */
-    ghc_dev->device = device_create(ahci_lld_class, &hba->pdev->dev,
-                                     ghc_dev->devno, NULL, "ahci_lld_ghc");
+    ghc_dev->device = device_create_with_groups(ahci_lld_class, &hba->pdev->dev,
+                                                 ghc_dev->devno, ghc_dev, ahci_ghc_groups,
+                                                 "ahci_lld_ghc");
     if (IS_ERR(ghc_dev->device)) {
         ret = PTR_ERR(ghc_dev->device);
         dev_err(&hba->pdev->dev, "Failed to create GHC device\n");
@@ -521,12 +1234,15 @@ static int ahci_lld_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
     
     dev_info(&pdev->dev, "AHCI LLD probe start\n");
     
-    /* HBA構造体の割り当て */
-    hba = kzalloc(sizeof(*hba), GFP_KERNEL);
+    /* HBA構造体の割り当て（以降の割り当てはすべて HBA が接続された NUMA ノード上） */
+    hba = kzalloc_node(sizeof(*hba), GFP_KERNEL, dev_to_node(&pdev->dev));
     if (!hba)
         return -ENOMEM;
     
     hba->pdev = pdev;
+    hba->node = dev_to_node(&pdev->dev);
+    dev_info(&pdev->dev, "NUMA node: %d\n", hba->node);
+    mutex_init(&hba->ccc_lock);
     pci_set_drvdata(pdev, hba);
     
     /* PCIデバイスの有効化 */
@@ -557,6 +1273,26 @@ static int ahci_lld_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
     hba->mmio_size = pci_resource_len(pdev, 5);
     dev_info(&pdev->dev, "MMIO mapped at %p, size: %zu\n", hba->mmio, hba->mmio_size);
     
+    /*
+     * DMA マスク: CAP.S64A なら 64-bit。設定しないと 32-bit 扱いになり、
+     * 4GB を超えるページへの DMA がすべて swiotlb でバウンスされる
+     */
+    if (ioread32(hba->mmio + AHCI_CAP) & AHCI_CAP_S64A) {
+        ret = dma_set_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(64));
+        if (!ret)
+            hba->dma_64bit = true;
+        else
+            dev_warn(&pdev->dev, "64-bit DMA mask rejected (%d), falling back to 32-bit\n", ret);
+    }
+    if (!hba->dma_64bit) {
+        ret = dma_set_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(32));
+        if (ret) {
+            dev_err(&pdev->dev, "No usable DMA configuration\n");
+            goto err_unmap;
+        }
+    }
+    dev_info(&pdev->dev, "DMA mask: %d-bit\n", hba->dma_64bit ? 64 : 32);
+    
     /* HBAリセットとAHCIモード有効化 */
     ret = ahci_hba_reset(hba);
     if (ret)
@@ -595,6 +1331,17 @@ static int ahci_lld_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
     hba->n_ports = n_ports;
     dev_info(&pdev->dev, "Successfully registered %d port devices\n", n_ports);
     
+    /* 割り込みの登録（失敗時はポーリングで動作を継続） */
+    ret = ahci_hba_setup_irq(hba);
+    if (ret)
+        dev_warn(&pdev->dev, "Interrupts unavailable, falling back to polling\n");
+    
+    /* blk-mq ディスクの登録（blk_frontend=1 の場合のみ、失敗してもポートは残す） */
+    for (i = 0; i < AHCI_MAX_PORTS; i++) {
+        if (hba->ports[i] && ahci_port_blk_add(hba->ports[i]))
+            dev_warn(&pdev->dev, "Port %d: blk-mq frontend not registered\n", i);
+    }
+    
     return 0;
     
 err_cleanup_ports:
@@ -622,6 +1369,15 @@ static void ahci_lld_remove(struct pci_dev *pdev)
     
     dev_info(&pdev->dev, "AHCI LLD remove start\n");
     
+    /* blk-mq ディスクを削除（完了割り込みが必要なため割り込み解放前に行う） */
+    for (i = 0; i < AHCI_MAX_PORTS; i++) {
+        if (hba->ports[i])
+            ahci_port_blk_remove(hba->ports[i]);
+    }
+    
+    /* 割り込みを解放（ポート破棄前に行う） */
+    ahci_hba_free_irq(hba);
+    
     /* GHCデバイスを破棄 */
     ahci_destroy_ghc_device(hba);
     
@@ -26,7 +26,7 @@
  * 5. Enable FIS reception (PxCMD.FRE = 1)
  *    - Wait for PxCMD.FR = 1 (hardware acknowledges FIS receive enabled)
  * 6. Enable port interrupts (PxIE)
- *    - Enable DHRS (D2H Register FIS), error, and port change interrupts
+ *    - Enable DHRS/PSS/SDBS/DPS, error, and port change interrupts
  * 7. Clear PxIS to remove any pending interrupts
  *
  * Prerequisites:
@@ -108,10 +108,8 @@ int ahci_port_init(struct ahci_port_device *port)
         return -ETIMEDOUT;
     
     /* Step 5: 割り込みを有効化 */
-    /* D2H Register FIS, Device error, Port Connect Change などを有効化 */
-    iowrite32(AHCI_PORT_INT_DHRS | AHCI_PORT_INT_ERROR | 
-              AHCI_PORT_INT_PCS | AHCI_PORT_INT_PRCS,
-              port_mmio + AHCI_PORT_IE);
+    /* D2H Register FIS, PIO Setup, Set Device Bits, Device error, Port Connect Change などを有効化 */
+    iowrite32(ahci_port_irq_mask(port), port_mmio + AHCI_PORT_IE);
     
     /* PxIS をクリア */
     iowrite32(0xFFFFFFFF, port_mmio + AHCI_PORT_IS);
@@ -381,7 +379,7 @@ EXPORT_SYMBOL_GPL(ahci_port_stop);
  * 2. Enable FIS reception (PxCMD.FRE = 1)
  *    - Wait for PxCMD.FR = 1 (hardware confirms FIS receive running)
  *    - Timeout after 500ms if FR doesn't set
- * 3. Clear PxIS to remove any pending interrupts
+ * 3. Clear PxIS to remove any pending interrupts and program PxIE
  * 4. Set PxCMD.ST = 1 (Start)
  *    - Enables command list processing
  *    - Port begins accepting commands from command list
@@ -390,6 +388,8 @@ EXPORT_SYMBOL_GPL(ahci_port_stop);
  *    - Wait for BSY (Busy) and DRQ (Data Request) bits to clear
  *    - Timeout after 1 second
  *
+ * Thaws NCQ (see ahci_port_ncq_freeze()) once PxCMD.ST is set.
+ *
  * After successful start, the port is ready to accept ATA commands.
  *
  * Return: 0 on success, negative error code on failure
@@ -416,6 +416,7 @@ int ahci_port_start(struct ahci_port_device *port)
     cmd = ioread32(port_mmio + AHCI_PORT_CMD);
     if (cmd & AHCI_PORT_CMD_ST) {
         dev_info(port->device, "Port is already started\n");
+        ahci_port_ncq_thaw(port);
         return 0;
     }
     
@@ -436,14 +437,18 @@ int ahci_port_start(struct ahci_port_device *port)
         dev_info(port->device, "FIS receive enabled\n");
     }
     
-    /* PxIS をクリア */
+    /* PxIS をクリアして割り込みを有効化 */
     iowrite32(0xFFFFFFFF, port_mmio + AHCI_PORT_IS);
+    iowrite32(ahci_port_irq_mask(port), port_mmio + AHCI_PORT_IE);
     
     /* Step 3: PxCMD.ST を有効化（コマンド処理を開始） */
     cmd = ioread32(port_mmio + AHCI_PORT_CMD);
     cmd |= AHCI_PORT_CMD_ST;
     iowrite32(cmd, port_mmio + AHCI_PORT_CMD);
     
+    /* NCQ コマンドの発行と完了検出を再開 */
+    ahci_port_ncq_thaw(port);
+    
     dev_info(port->device, "Port started (PxCMD=0x%08x)\n",
              ioread32(port_mmio + AHCI_PORT_CMD));
     
@@ -468,3 +473,149 @@ int ahci_port_start(struct ahci_port_device *port)
     return 0;
 }
 EXPORT_SYMBOL_GPL(ahci_port_start);
+
+/**
+ * ahci_port_halt - Stop or reset a port and fail its outstanding NCQ commands
+ * @port: Port device structure
+ * @reset: Perform COMRESET instead of a plain stop
+ *
+ * Clearing PxCMD.ST clears PxSACT/PxCI for commands the device has not
+ * finished. The port is frozen first so that those slots are not reported
+ * as successful, and failed with ahci_port_ncq_fail() once the HBA has
+ * stopped processing the command list. Used by AHCI_IOC_PORT_STOP and
+ * AHCI_IOC_PORT_RESET.
+ *
+ * Context: eh_lock held
+ * Return: 0 on success, negative error code on failure
+ */
+int ahci_port_halt(struct ahci_port_device *port, bool reset)
+{
+    u32 outstanding;
+    int ret;
+    
+    outstanding = ahci_port_ncq_freeze(port);
+    
+    ret = reset ? ahci_port_comreset(port) : ahci_port_stop(port);
+    if (ret) {
+        /* HBA がまだ DMA 中の可能性があるのでスロットは返さない */
+        dev_err(port->device, "Port did not stop, NCQ slots 0x%08x left outstanding\n",
+                outstanding);
+        return ret;
+    }
+    
+    ahci_port_ncq_fail(port, outstanding);
+    return 0;
+}
+EXPORT_SYMBOL_GPL(ahci_port_halt);
+
+/**
+ * __ahci_port_recover - Reset and restart the port, failing outstanding NCQ commands
+ * @port: Port device structure
+ *
+ * On a task file error the HBA stops processing the command list and the
+ * device aborts its queue and refuses new NCQ commands until it is reset
+ * (or its NCQ error log is read). COMRESET clears both; the slots
+ * outstanding at that point are failed with -EIO and the port is started
+ * again. Slots that finished before the error keep their result.
+ *
+ * Context: eh_lock held
+ * Return: 0 on success, negative error code if the port could not be restarted
+ */
+static int __ahci_port_recover(struct ahci_port_device *port)
+{
+    void __iomem *port_mmio = port->port_mmio;
+    unsigned long flags;
+    u32 outstanding;
+    int ret;
+    
+    dev_err(port->device, "NCQ error recovery (PxSACT=0x%08x PxCI=0x%08x PxTFD=0x%08x PxSERR=0x%08x)\n",
+            ioread32(port_mmio + AHCI_PORT_SACT), ioread32(port_mmio + AHCI_PORT_CI),
+            ioread32(port_mmio + AHCI_PORT_TFD), ioread32(port_mmio + AHCI_PORT_SERR));
+    
+    outstanding = ahci_port_ncq_freeze(port);
+    
+    /* COMRESET は PxCMD.ST を落としてから行われる（PxSERR もクリアされる） */
+    ret = ahci_port_comreset(port);
+    if (ret) {
+        dev_err(port->device, "Recovery failed, port did not stop\n");
+        return ret;
+    }
+    
+    ahci_port_ncq_fail(port, outstanding);
+    
+    /* 報告済みのエラーを後続のコマンドに持ち越さない */
+    spin_lock_irqsave(&port->slot_lock, flags);
+    port->irq_status &= ~AHCI_PORT_INT_ERROR;
+    port->eh_pending = false;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    ret = ahci_port_start(port);
+    if (ret)
+        dev_err(port->device, "Recovery failed, port did not restart\n");
+    else
+        dev_info(port->device, "Port recovered\n");
+    
+    return ret;
+}
+
+/**
+ * ahci_port_recover - Recover the port after an NCQ command failed or timed out
+ * @port: Port device structure
+ * @slot: Slot whose issuer saw the error (released by the caller), or -1
+ *
+ * Does nothing if @slot has already been handled by another recovery
+ * (or, with @slot < 0, if no NCQ command is outstanding).
+ *
+ * Return: 0 on success or if nothing had to be done, negative error code
+ *         if the port could not be restarted
+ */
+int ahci_port_recover(struct ahci_port_device *port, int slot)
+{
+    unsigned long flags;
+    u32 outstanding;
+    int ret = 0;
+    
+    mutex_lock(&port->eh_lock);
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    outstanding = port->slots_issued & ~port->slots_completed;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    if (slot >= 0)
+        outstanding &= 1U << slot;
+    if (outstanding)
+        ret = __ahci_port_recover(port);
+    
+    mutex_unlock(&port->eh_lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(ahci_port_recover);
+
+/**
+ * ahci_port_eh_work - Error handler work
+ * @work: port->eh_work
+ *
+ * Queued by ahci_port_handle_irq() on an error interrupt with NCQ
+ * commands outstanding, so that kernel-owned commands (kiocb, io_uring,
+ * blk-mq, SQ ring) are completed even if nobody waits for them.
+ */
+void ahci_port_eh_work(struct work_struct *work)
+{
+    struct ahci_port_device *port = container_of(work, struct ahci_port_device, eh_work);
+    unsigned long flags;
+    bool pending;
+    
+    mutex_lock(&port->eh_lock);
+    
+    /* 発行元が先にリカバリした場合は何もしない */
+    spin_lock_irqsave(&port->slot_lock, flags);
+    pending = port->eh_pending && (port->slots_issued & ~port->slots_completed);
+    port->eh_pending = false;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    if (pending)
+        __ahci_port_recover(port);
+    
+    mutex_unlock(&port->eh_lock);
+}
+EXPORT_SYMBOL_GPL(ahci_port_eh_work);
@@ -58,6 +58,15 @@
 #define AHCI_GHC_IE     (1 << 1)   /* Interrupt Enable */
 #define AHCI_GHC_HR     (1 << 0)   /* HBA Reset */
 
+/* CCC_CTL - Command Completion Coalescing Control (AHCI 1.3.1 Section 3.1.6) */
+#define AHCI_CCC_CTL_TV_SHIFT   16
+#define AHCI_CCC_CTL_TV         (0xFFFFU << 16) /* Timeout Value (ms) */
+#define AHCI_CCC_CTL_CC_SHIFT   8
+#define AHCI_CCC_CTL_CC         (0xFF << 8)     /* Command Completions */
+#define AHCI_CCC_CTL_INT_SHIFT  3
+#define AHCI_CCC_CTL_INT        (0x1F << 3)     /* Interrupt (IS bit used for CCC, RO) */
+#define AHCI_CCC_CTL_EN         (1 << 0)        /* Enable */
+
 /* CAP2 - Host Capabilities Extended ビットマスク */
 #define AHCI_CAP2_DESO  (1 << 5)   /* DevSleep Entrance from Slumber Only */
 #define AHCI_CAP2_SADM  (1 << 4)   /* Supports Aggressive Device Sleep Management */
@@ -105,6 +114,10 @@
 #define ATA_CMD_WRITE_FPDMA_QUEUED  0x61    /* WRITE FPDMA QUEUED (NCQ) */
 #define ATA_CMD_READ_SECTORS_EXT    0x24    /* READ SECTORS EXT (PIO) */
 #define ATA_CMD_WRITE_SECTORS_EXT   0x34    /* WRITE SECTORS EXT (PIO) */
+#define ATA_CMD_SET_FEATURES        0xEF    /* SET FEATURES */
+
+/* SET FEATURES subcommands (Features register) */
+#define ATA_SET_FEATURES_WC_OFF     0x82    /* Disable volatile write cache */
 
 /* ATA Status Register bits (returned in D2H FIS) */
 #define ATA_STATUS_BSY      0x80    /* Busy */
@@ -113,9 +126,24 @@
 #define ATA_STATUS_DRQ      0x08    /* Data Request */
 #define ATA_STATUS_ERR      0x01    /* Error */
 
+/* ATA Error Register bits */
+#define ATA_ERR_ABRT        0x04    /* Command aborted */
+
 /* ATA Device Register bits */
 #define ATA_DEV_LBA         0x40    /* LBA mode (bit 6) */
 
+/* IDENTIFY DEVICE data (256 words) */
+#define ATA_IDENTIFY_SIZE           512
+#define ATA_ID_NCQ_DEPTH            75      /* Queue depth - 1 (bits 4:0) */
+#define ATA_ID_CMD_SET_1            82      /* Command sets supported */
+#define ATA_ID_CMD_SET_1_WCACHE     (1 << 5)    /* Volatile write cache */
+#define ATA_ID_CMD_SET_EN_1         85      /* Command sets enabled */
+#define ATA_ID_SATA_CAP             76      /* SATA capabilities */
+#define ATA_ID_SATA_CAP_NCQ         (1 << 8)    /* Supports NCQ */
+#define ATA_ID_CMD_SET_2            83      /* Command sets supported */
+#define ATA_ID_CMD_SET_2_LBA48      (1 << 10)   /* 48-bit Address feature set */
+#define ATA_ID_LBA48_SECTORS        100     /* Words 100-103: max LBA + 1 (48-bit) */
+
 /* ========================================================================
  * Port Interrupt Status/Enable Registers
  * ======================================================================== */
@@ -142,6 +170,16 @@
 #define AHCI_PORT_INT_ERROR  (AHCI_PORT_INT_TFES | AHCI_PORT_INT_HBFS | \
                               AHCI_PORT_INT_HBDS | AHCI_PORT_INT_IFS)
 
+/* ドライバが PxIE で有効化する割り込み */
+#define AHCI_PORT_INT_DEFAULT (AHCI_PORT_INT_DHRS | AHCI_PORT_INT_PSS | \
+                               AHCI_PORT_INT_SDBS | AHCI_PORT_INT_DPS | \
+                               AHCI_PORT_INT_ERROR | AHCI_PORT_INT_PCS | \
+                               AHCI_PORT_INT_PRCS)
+
+/* CCC 対象ポートで PxIE から外す完了割り込み（CCC 割り込みでまとめて処理） */
+#define AHCI_PORT_INT_CCC_MASKED (AHCI_PORT_INT_DHRS | AHCI_PORT_INT_PSS | \
+                                  AHCI_PORT_INT_SDBS | AHCI_PORT_INT_DPS)
+
 /* PxCMD - Port Command and Status ビットマスク */
 #define AHCI_PORT_CMD_ICC   (0x0F << 28)  /* Interface Communication Control */
 #define AHCI_PORT_CMD_ASP   (1 << 27)  /* Aggressive Slumber / Partial */
@@ -0,0 +1,649 @@
+/*
+ * AHCI Low Level Driver - Submission / Completion Rings
+ *
+ * mmap されるリングページの管理と、SQ リングからの NCQ コマンド一括発行
+ * （doorbell ioctl / SQ ポーリングスレッド）、バッチ発行 ioctl、
+ * io_uring パススルーを担当
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/kthread.h>
+#include <linux/topology.h>
+#include <linux/sched.h>
+#include <linux/sched/mm.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/io_uring/cmd.h>
+#include "ahci_lld.h"
+
+/**
+ * ahci_port_alloc_ring_page - Allocate a zeroed ring page once
+ * @ringp: Ring pointer in the port structure
+ * @node: NUMA node to allocate on (the HBA's node)
+ *
+ * If two mmap() calls race, the page installed first is used.
+ *
+ * Return: Ring page, or NULL on allocation failure
+ */
+static void *ahci_port_alloc_ring_page(void **ringp, int node)
+{
+    struct page *page;
+    unsigned long addr;
+    
+    if (READ_ONCE(*ringp))
+        return *ringp;
+    
+    page = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO, 0);
+    if (!page)
+        return NULL;
+    addr = (unsigned long)page_address(page);
+    
+    if (cmpxchg(ringp, NULL, (void *)addr) != NULL)
+        free_page(addr);
+    
+    return *ringp;
+}
+
+/**
+ * ahci_port_get_ring - Get the ring page mapped at an mmap offset
+ * @port: Port device structure
+ * @offset: mmap offset (AHCI_CQ_RING_OFFSET or AHCI_SQ_RING_OFFSET)
+ *
+ * Rings are allocated on first use and kept until the port is destroyed,
+ * so existing mappings stay valid.
+ *
+ * Return: Ring page on success, ERR_PTR() on failure
+ */
+void *ahci_port_get_ring(struct ahci_port_device *port, unsigned long offset)
+{
+    switch (offset) {
+    case AHCI_CQ_RING_OFFSET:
+    {
+        struct ahci_cq_ring *ring;
+        
+        ring = ahci_port_alloc_ring_page((void **)&port->cq_ring, port->node);
+        if (!ring)
+            return ERR_PTR(-ENOMEM);
+        ring->entries = AHCI_CQ_RING_ENTRIES;
+        return ring;
+    }
+    
+    case AHCI_SQ_RING_OFFSET:
+    {
+        struct ahci_sq_ring *ring;
+        
+        ring = ahci_port_alloc_ring_page((void **)&port->sq_ring, port->node);
+        if (!ring)
+            return ERR_PTR(-ENOMEM);
+        ring->entries = AHCI_SQ_RING_ENTRIES;
+        return ring;
+    }
+    
+    default:
+        return ERR_PTR(-EINVAL);
+    }
+}
+EXPORT_SYMBOL_GPL(ahci_port_get_ring);
+
+/**
+ * ahci_port_free_rings - Drop the port's references to the ring pages
+ * @port: Port device structure
+ *
+ * Called when the port is destroyed. A process may still have a ring
+ * mapped; ahci_lld_mmap() inserts the pages with vm_insert_page(), so
+ * each mapping holds its own page reference and the page is only freed
+ * on the last munmap.
+ */
+void ahci_port_free_rings(struct ahci_port_device *port)
+{
+    if (port->cq_ring) {
+        free_page((unsigned long)port->cq_ring);
+        port->cq_ring = NULL;
+    }
+    
+    if (port->sq_ring) {
+        free_page((unsigned long)port->sq_ring);
+        port->sq_ring = NULL;
+    }
+}
+EXPORT_SYMBOL_GPL(ahci_port_free_rings);
+
+/**
+ * ahci_port_prep_user_ncq - Prepare one NCQ request from user space for issue
+ * @port: Port device structure
+ * @req: Request (already copied into kernel memory)
+ *
+ * Same as AHCI_IOC_ISSUE_CMD for NCQ commands, except that PxSACT/PxCI are
+ * not written. The caller marks the slot (from_ring / ioucmd) so that it
+ * is released on completion, then fires it.
+ *
+ * Return: 0 on success, -EBUSY if the tag is still in use, other negative
+ *         error code if the request is invalid
+ */
+static int ahci_port_prep_user_ncq(struct ahci_port_device *port,
+                                   struct ahci_cmd_request *req)
+{
+    struct ahci_dio *dio = NULL;
+    struct iov_iter iter;
+    struct iov_iter *iterp = NULL;
+    int ret;
+    
+    if (!(req->flags & AHCI_CMD_FLAG_NCQ) || req->tag >= 32)
+        return -EINVAL;
+    
+    /* タグ使用中なら以降の SQE は完了待ち */
+    if (test_bit(req->tag, &port->slots_in_use))
+        return -EBUSY;
+    
+    if (req->buffer_len > 0) {
+        if (req->buffer_len > AHCI_SG_BUFFER_SIZE * AHCI_SG_BUFFER_COUNT)
+            return -EINVAL;
+        
+        dio = ahci_port_dio_map(port, req);
+        if (IS_ERR(dio))
+            return PTR_ERR(dio);
+    }
+    
+    /* SGバッファ経由: ユーザーバッファとSGバッファの間で直接コピーする */
+    if (req->buffer_len > 0 && !dio &&
+        !(req->flags & (AHCI_CMD_FLAG_FIXED | AHCI_CMD_FLAG_POOL))) {
+        ret = import_ubuf((req->flags & AHCI_CMD_FLAG_WRITE) ? ITER_SOURCE : ITER_DEST,
+                          u64_to_user_ptr(req->buffer), req->buffer_len, &iter);
+        if (ret)
+            return ret;
+        iterp = &iter;
+    }
+    
+    ret = ahci_port_prep_ncq(port, req, iterp, dio);
+    if (ret) {
+        ahci_port_dio_unmap(port, dio);
+        return ret;
+    }
+    
+    return 0;
+}
+
+/**
+ * ahci_port_sq_submit - Issue all pending SQ entries
+ * @port: Port device structure
+ *
+ * Prepares every entry between head and tail, then issues them with a
+ * single PxSACT and a single PxCI write. Processing stops at an entry
+ * whose tag is still in use; it is retried on the next doorbell. Invalid
+ * entries are consumed and completed with status/error 0xFF.
+ *
+ * Must be called with the submitter's address space (ioctl or sq_thread).
+ *
+ * Return: Number of consumed SQ entries, or negative error code
+ */
+int ahci_port_sq_submit(struct ahci_port_device *port)
+{
+    struct ahci_sq_ring *ring = port->sq_ring;
+    unsigned long flags;
+    u32 head, tail;
+    u32 tags = 0;
+    int consumed;
+    
+    if (!ring)
+        return -ENXIO;
+    
+    mutex_lock(&port->sq_lock);
+    
+    head = port->sq_head;
+    tail = smp_load_acquire(&ring->tail);
+    
+    /* ユーザーが壊した tail は無視 */
+    if (tail - head > AHCI_SQ_RING_ENTRIES)
+        tail = head;
+    
+    while (head != tail) {
+        struct ahci_cmd_request req;
+        int ret;
+        
+        /* ユーザーが書き換えても影響しないようにコピーしてから使う */
+        req = ring->sqes[head & (AHCI_SQ_RING_ENTRIES - 1)];
+        
+        ret = ahci_port_prep_user_ncq(port, &req);
+        if (ret == -EBUSY)
+            break;
+        
+        head++;
+        
+        if (ret) {
+            struct ahci_cq_entry entry = {
+                .tag = req.tag,
+                .status = 0xFF,
+                .error = 0xFF,
+            };
+            
+            dev_err(port->device, "SQ entry rejected (tag %u, %d)\n", req.tag, ret);
+            ahci_port_post_completion(port, &entry);
+            continue;
+        }
+        
+        spin_lock_irqsave(&port->slot_lock, flags);
+        port->slots[req.tag].from_ring = true;
+        spin_unlock_irqrestore(&port->slot_lock, flags);
+        
+        tags |= (1U << req.tag);
+    }
+    
+    /* まとめて発行: PxSACT / PxCI を1回ずつ書き込む */
+    if (tags)
+        ahci_port_fire_ncq(port, tags);
+    
+    consumed = head - port->sq_head;
+    port->sq_head = head;
+    smp_store_release(&ring->head, head);
+    
+    mutex_unlock(&port->sq_lock);
+    
+    if (consumed)
+        dev_dbg(port->device, "SQ: consumed %d entries, issued tags 0x%08x\n", consumed, tags);
+    
+    return consumed;
+}
+EXPORT_SYMBOL_GPL(ahci_port_sq_submit);
+
+/**
+ * ahci_port_sq_doorbell - Handle AHCI_IOC_SQ_DOORBELL
+ * @port: Port device structure
+ *
+ * Submits the pending SQ entries from the caller's context, or wakes up
+ * the SQ polling thread if one is running.
+ *
+ * Return: Number of consumed SQ entries (0 if handed to the thread),
+ *         or negative error code
+ */
+int ahci_port_sq_doorbell(struct ahci_port_device *port)
+{
+    if (!port->sq_ring)
+        return -ENXIO;
+    
+    mutex_lock(&port->sq_lock);
+    if (port->sq_thread) {
+        wake_up_process(port->sq_thread);
+        mutex_unlock(&port->sq_lock);
+        return 0;
+    }
+    mutex_unlock(&port->sq_lock);
+    
+    return ahci_port_sq_submit(port);
+}
+EXPORT_SYMBOL_GPL(ahci_port_sq_doorbell);
+
+/**
+ * ahci_port_submit_batch - Handle AHCI_IOC_SUBMIT_BATCH
+ * @port: Port device structure
+ * @batch: Batch descriptor (already copied into kernel memory, out fields updated)
+ *
+ * Prepares up to 32 NCQ requests and issues them with a single PxSACT and
+ * a single PxCI write. Requests with AHCI_CMD_FLAG_AUTO_TAG get the lowest
+ * free tag below CAP.NCS + 1, which is also encoded in Count bits 7:3. Preparation stops at
+ * the first failing request; the ones before it are still issued.
+ *
+ * The issued slots behave like AHCI_IOC_ISSUE_CMD NCQ slots (PROBE/WAIT,
+ * FREE_SLOT). The assigned tags are written back to the request array.
+ *
+ * Return: 0 if at least one request was issued, negative error code of
+ *         the first request otherwise
+ */
+int ahci_port_submit_batch(struct ahci_port_device *port, struct ahci_submit_batch *batch)
+{
+    struct ahci_cmd_request __user *ureqs = (void __user *)batch->reqs;
+    struct ahci_cmd_request *reqs;
+    u32 tags = 0;
+    u32 i;
+    int depth;
+    int ret = 0;
+    
+    batch->submitted = 0;
+    batch->tags = 0;
+    
+    if (batch->count == 0 || batch->count > 32)
+        return -EINVAL;
+    
+    reqs = memdup_user(ureqs, batch->count * sizeof(*reqs));
+    if (IS_ERR(reqs))
+        return PTR_ERR(reqs);
+    
+    /* HBA が実装しているコマンドスロット数（CAP.NCS + 1）を超える tag は使わない */
+    depth = ((ioread32(port->hba->mmio + AHCI_CAP) & AHCI_CAP_NCS) >> 8) + 1;
+    
+    for (i = 0; i < batch->count; i++) {
+        struct ahci_cmd_request *req = &reqs[i];
+        
+        if (req->flags & AHCI_CMD_FLAG_AUTO_TAG) {
+            unsigned long busy = port->slots_in_use;
+            int tag = find_first_zero_bit(&busy, depth);
+            
+            if (tag >= depth) {
+                ret = -EBUSY;
+                break;
+            }
+            req->tag = tag;
+            req->count = (req->count & ~0xF8) | (tag << 3);
+        }
+        
+        ret = ahci_port_prep_user_ncq(port, req);
+        if (ret)
+            break;
+        
+        tags |= (1U << req->tag);
+    }
+    
+    /* まとめて発行: PxSACT / PxCI を1回ずつ書き込む */
+    if (tags)
+        ahci_port_fire_ncq(port, tags);
+    
+    batch->submitted = i;
+    batch->tags = tags;
+    
+    dev_dbg(port->device, "Batch: issued %u of %u requests, tags 0x%08x (%d)\n",
+            i, batch->count, tags, ret);
+    
+    /* 発行済み分の tag を返す */
+    if (i > 0 && copy_to_user(ureqs, reqs, i * sizeof(*reqs)))
+        dev_err(port->device, "Failed to copy assigned tags to user\n");
+    
+    kfree(reqs);
+    
+    return i > 0 ? 0 : ret;
+}
+EXPORT_SYMBOL_GPL(ahci_port_submit_batch);
+
+/**
+ * ahci_port_sq_submit_as - Submit SQ entries with the submitter's mm
+ * @port: Port device structure
+ *
+ * The mm is only pinned for the duration of the submission, so that the
+ * thread does not keep the submitter's address space (and thereby the
+ * mapping of this device) alive after it exits.
+ *
+ * Return: Number of consumed SQ entries, or negative error code
+ */
+static int ahci_port_sq_submit_as(struct ahci_port_device *port)
+{
+    struct mm_struct *mm = port->sq_mm;
+    int ret;
+    
+    if (!mmget_not_zero(mm))
+        return -ESRCH;
+    
+    kthread_use_mm(mm);
+    ret = ahci_port_sq_submit(port);
+    kthread_unuse_mm(mm);
+    mmput(mm);
+    
+    return ret;
+}
+
+/**
+ * ahci_port_sq_thread_fn - SQ polling thread
+ * @data: Port device structure
+ *
+ * Polls the SQ ring tail and submits new entries. After sq_idle without
+ * new entries it sets AHCI_SQ_NEED_WAKEUP and sleeps until the doorbell
+ * is rung. While an entry is blocked on a busy tag it rechecks every tick.
+ */
+static int ahci_port_sq_thread_fn(void *data)
+{
+    struct ahci_port_device *port = data;
+    struct ahci_sq_ring *ring = port->sq_ring;
+    unsigned long idle_end = jiffies + port->sq_idle;
+    
+    while (!kthread_should_stop()) {
+        if (ahci_port_sq_submit_as(port) > 0) {
+            idle_end = jiffies + port->sq_idle;
+            cond_resched();
+            continue;
+        }
+        
+        if (time_before(jiffies, idle_end)) {
+            cond_resched();
+            continue;
+        }
+        
+        /* アイドル: NEED_WAKEUP を立ててから tail を再確認してスリープ */
+        set_current_state(TASK_INTERRUPTIBLE);
+        WRITE_ONCE(ring->flags, ring->flags | AHCI_SQ_NEED_WAKEUP);
+        smp_mb();
+        
+        if (kthread_should_stop()) {
+            __set_current_state(TASK_RUNNING);
+            break;
+        }
+        
+        if (smp_load_acquire(&ring->tail) == port->sq_head)
+            schedule();
+        else
+            schedule_timeout(1);  /* タグ使用中の SQE が残っている */
+        
+        __set_current_state(TASK_RUNNING);
+        WRITE_ONCE(ring->flags, ring->flags & ~AHCI_SQ_NEED_WAKEUP);
+        idle_end = jiffies + port->sq_idle;
+    }
+    
+    return 0;
+}
+
+/**
+ * ahci_port_sq_start_thread - Start the SQ polling thread
+ * @port: Port device structure
+ * @idle_ms: Idle time before the thread sleeps
+ *
+ * The thread submits on behalf of the calling process (its mm is used to
+ * copy write data from the user buffers). It is created on the HBA's NUMA
+ * node and allowed to run only on that node's CPUs.
+ *
+ * Return: 0 on success, negative error code on failure
+ */
+int ahci_port_sq_start_thread(struct ahci_port_device *port, u32 idle_ms)
+{
+    struct task_struct *thread;
+    int ret = 0;
+    
+    if (!port->sq_ring)
+        return -ENXIO;
+    
+    mutex_lock(&port->sq_lock);
+    
+    /* sq_mm が残っている間は停止処理中 */
+    if (port->sq_thread || port->sq_mm) {
+        ret = -EBUSY;
+        goto out;
+    }
+    
+    port->sq_mm = current->mm;
+    mmgrab(port->sq_mm);
+    port->sq_idle = msecs_to_jiffies(idle_ms);
+    
+    thread = kthread_create_on_node(ahci_port_sq_thread_fn, port, port->node,
+                                    "ahci_lld_sq%d", port->port_no);
+    if (IS_ERR(thread)) {
+        ret = PTR_ERR(thread);
+        mmdrop(port->sq_mm);
+        port->sq_mm = NULL;
+        goto out;
+    }
+    if (port->node != NUMA_NO_NODE)
+        set_cpus_allowed_ptr(thread, cpumask_of_node(port->node));
+    wake_up_process(thread);
+    
+    port->sq_thread = thread;
+    dev_info(port->device, "SQ thread started (idle %u ms)\n", idle_ms);
+    
+out:
+    mutex_unlock(&port->sq_lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(ahci_port_sq_start_thread);
+
+/**
+ * ahci_port_sq_stop_thread - Stop the SQ polling thread
+ * @port: Port device structure
+ *
+ * Does nothing if no thread is running.
+ */
+void ahci_port_sq_stop_thread(struct ahci_port_device *port)
+{
+    struct task_struct *thread;
+    struct mm_struct *mm;
+    
+    /* スレッドは sq_lock を取るので、停止はロック外で行う */
+    mutex_lock(&port->sq_lock);
+    thread = port->sq_thread;
+    port->sq_thread = NULL;
+    port->sq_owner = NULL;
+    mutex_unlock(&port->sq_lock);
+    
+    if (!thread)
+        return;
+    
+    kthread_stop(thread);
+    
+    /* sq_mm はスレッド終了まで参照されるので、停止後に解放 */
+    mutex_lock(&port->sq_lock);
+    mm = port->sq_mm;
+    port->sq_mm = NULL;
+    mutex_unlock(&port->sq_lock);
+    
+    mmdrop(mm);
+    
+    if (port->sq_ring)
+        WRITE_ONCE(port->sq_ring->flags, 0);
+    
+    dev_info(port->device, "SQ thread stopped\n");
+}
+EXPORT_SYMBOL_GPL(ahci_port_sq_stop_thread);
+
+/* io_uring コマンドの pdu に保存する情報 */
+struct ahci_uring_pdu {
+    struct ahci_port_device *port;
+    int tag;
+};
+
+/**
+ * ahci_port_uring_task_cb - Finish an io_uring passthrough command
+ * @ioucmd: io_uring command
+ * @issue_flags: io_uring issue flags
+ *
+ * Runs as task work of the submitting task, so read data is copied straight
+ * from the SG buffers to the user buffer. The slot is released before the
+ * CQE is posted.
+ */
+static void ahci_port_uring_task_cb(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+    struct ahci_uring_pdu *pdu = (struct ahci_uring_pdu *)ioucmd->pdu;
+    struct ahci_port_device *port = pdu->port;
+    struct ahci_cmd_slot *cmd_slot = &port->slots[pdu->tag];
+    void __user *user_buffer;
+    struct ahci_dio *dio;
+    struct iov_iter iter;
+    unsigned long flags;
+    u32 buffer_len;
+    bool is_write;
+    bool bounce;
+    u8 status, error;
+    ssize_t res = 0;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    bounce = cmd_slot->bounce;
+    buffer_len = cmd_slot->buffer_len;
+    user_buffer = (void __user *)cmd_slot->req.buffer;
+    is_write = cmd_slot->is_write;
+    status = cmd_slot->req.status;
+    error = cmd_slot->req.error;
+    dio = cmd_slot->dio;
+    cmd_slot->ioucmd = NULL;
+    cmd_slot->dio = NULL;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    ahci_port_dio_unmap(port, dio);
+    
+    if (!is_write && bounce && buffer_len > 0) {
+        res = import_ubuf(ITER_DEST, user_buffer, buffer_len, &iter);
+        if (res == 0)
+            res = ahci_port_sg_copy_to_iter(port, cmd_slot->sg_start_idx, &iter, buffer_len);
+    }
+    
+    ahci_free_slot(port, pdu->tag);
+    
+    if (res == 0 && (status & ATA_STATUS_ERR))
+        res = -EIO;
+    
+    io_uring_cmd_done(ioucmd, res, AHCI_URING_RES2(pdu->tag, status, error), issue_flags);
+}
+
+/**
+ * ahci_port_uring_complete - Hand a completed io_uring slot to its task
+ * @port: Port device structure
+ * @slot: Completed slot number
+ *
+ * Context: slot_lock held (called from ahci_port_complete_ncq())
+ */
+void ahci_port_uring_complete(struct ahci_port_device *port, int slot)
+{
+    io_uring_cmd_complete_in_task(port->slots[slot].ioucmd, ahci_port_uring_task_cb);
+}
+EXPORT_SYMBOL_GPL(ahci_port_uring_complete);
+
+/**
+ * ahci_port_uring_cmd - Issue an NCQ command from IORING_OP_URING_CMD
+ * @port: Port device structure
+ * @ioucmd: io_uring command (sqe->cmd holds a struct ahci_cmd_request)
+ * @issue_flags: io_uring issue flags
+ *
+ * The request is handled like an SQ ring entry: the slot is released when
+ * the command completes and the result is posted as a CQE, so no
+ * PROBE/FREE_SLOT calls are needed.
+ *
+ * Preparing a data transfer may sleep (page pinning, sg_lock/fixed_lock,
+ * DMA pool allocation, copying from the user buffer), so with
+ * IO_URING_F_NONBLOCK such a request returns -EAGAIN and io_uring
+ * reissues it from an io-wq worker.
+ *
+ * Return: -EIOCBQUEUED once issued, negative error code otherwise
+ */
+int ahci_port_uring_cmd(struct ahci_port_device *port, struct io_uring_cmd *ioucmd,
+                        unsigned int issue_flags)
+{
+    struct ahci_uring_pdu *pdu = (struct ahci_uring_pdu *)ioucmd->pdu;
+    struct ahci_cmd_request req;
+    unsigned long flags;
+    int ret;
+    
+    BUILD_BUG_ON(sizeof(struct ahci_uring_pdu) > sizeof(ioucmd->pdu));
+    
+    if (ioucmd->cmd_op != AHCI_URING_CMD_ISSUE)
+        return -ENOTTY;
+    
+    /* struct ahci_cmd_request (64 bytes) は 128 バイト SQE にしか入らない */
+    if (!(issue_flags & IO_URING_F_SQE128))
+        return -EINVAL;
+    
+    memcpy(&req, io_uring_sqe_cmd(ioucmd->sqe), sizeof(req));
+    
+    /* データ転送の準備は sleep しうるので io-wq で再発行させる */
+    if ((issue_flags & IO_URING_F_NONBLOCK) && req.buffer_len > 0)
+        return -EAGAIN;
+    
+    ret = ahci_port_prep_user_ncq(port, &req);
+    if (ret)
+        return ret;
+    
+    pdu->port = port;
+    pdu->tag = req.tag;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    port->slots[req.tag].ioucmd = ioucmd;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    ahci_port_fire_ncq(port, 1U << req.tag);
+    
+    return -EIOCBQUEUED;
+}
+EXPORT_SYMBOL_GPL(ahci_port_uring_cmd);
@@ -5,6 +5,13 @@
 #include <linux/kernel.h>
 #include <linux/spinlock.h>
 #include <linux/bitmap.h>
+#include <linux/wait.h>
+#include <linux/eventfd.h>
+#include <linux/workqueue.h>
+#include <linux/sched/mm.h>
+#include <linux/kthread.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
 #include "ahci_lld.h"
 #include "ahci_lld_fis.h"
 
@@ -44,41 +51,140 @@ int ahci_alloc_slot(struct ahci_port_device *port)
 EXPORT_SYMBOL_GPL(ahci_alloc_slot);
 
 /**
- * ahci_free_slot - Free an allocated command slot
+ * ahci_slot_busy - Check whether a slot's buffers may still be in use
+ * @port: Port device structure
+ * @slot: Slot number (in use)
+ *
+ * A slot is busy while it is being prepared (claimed, not yet issued),
+ * while it is issued and not yet completed (the HBA may still be doing
+ * DMA), while the completion worker finishes it, and for its whole
+ * lifetime if a kernel completer owns it (kiocb, io_uring, blk-mq, SQ
+ * ring, AHCI_IOC_REAP_CMD), since that completer releases the slot itself.
+ *
+ * Context: slot_lock held
+ */
+static bool ahci_slot_busy(struct ahci_port_device *port, int slot)
+{
+    struct ahci_cmd_slot *cmd_slot = &port->slots[slot];
+    
+    if (!test_bit(slot, &port->slots_issued) || !test_bit(slot, &port->slots_completed))
+        return true;
+    
+    return cmd_slot->finish_pending || cmd_slot->finishing || cmd_slot->iocb ||
+           cmd_slot->ioucmd || cmd_slot->rq || cmd_slot->from_ring || cmd_slot->reaping;
+}
+
+/**
+ * __ahci_free_slot - Free a command slot
  * @port: Port device structure
  * @slot: Slot number to free
+ * @check_busy: Refuse slots that ahci_slot_busy() reports (user space requests)
+ *
+ * Return: 0 on success or if the slot was not in use, -EBUSY if
+ *         @check_busy is set and the slot is busy
  */
-void ahci_free_slot(struct ahci_port_device *port, int slot)
+static int __ahci_free_slot(struct ahci_port_device *port, int slot, bool check_busy)
 {
+    struct ahci_cmd_table *large_tbl;
+    dma_addr_t large_tbl_dma;
+    struct ahci_dio *dio;
+    struct mm_struct *mm;
     unsigned long flags;
-    
-    if (slot < 0 || slot >= 32) {
-        dev_err(port->device, "Invalid slot number: %d\n", slot);
-        return;
-    }
+    int sg_start, sg_count;
+    int pool_start, pool_count;
     
     spin_lock_irqsave(&port->slot_lock, flags);
     
     if (!test_bit(slot, &port->slots_in_use)) {
         dev_warn(port->device, "Slot %d is not in use\n", slot);
         spin_unlock_irqrestore(&port->slot_lock, flags);
-        return;
+        return 0;
+    }
+    
+    if (check_busy && ahci_slot_busy(port, slot)) {
+        spin_unlock_irqrestore(&port->slot_lock, flags);
+        dev_dbg(port->device, "Slot %d is busy, not freeing it\n", slot);
+        return -EBUSY;
     }
     
     /* Clear slot */
     clear_bit(slot, &port->slots_in_use);
     clear_bit(slot, &port->slots_completed);
+    clear_bit(slot, &port->slots_issued);
     atomic_dec(&port->active_slots);
     
     /* Clear slot information */
+    mm = port->slots[slot].mm;
+    dio = port->slots[slot].dio;
+    sg_start = port->slots[slot].sg_start_idx;
+    sg_count = port->slots[slot].sg_count;
+    pool_start = port->slots[slot].pool_start;
+    pool_count = port->slots[slot].pool_count;
+    large_tbl = port->slots[slot].large_tbl;
+    large_tbl_dma = port->slots[slot].large_tbl_dma;
     memset(&port->slots[slot], 0, sizeof(port->slots[slot]));
     
     spin_unlock_irqrestore(&port->slot_lock, flags);
     
+    /* このスロット専用のSGバッファ範囲、プールの参照と large Command Table を返却 */
+    ahci_port_sg_free(port, sg_start, sg_count);
+    ahci_port_pool_put(port, pool_start, pool_count);
+    ahci_port_put_cmd_table(port, large_tbl, large_tbl_dma);
+    
+    if (mm)
+        mmdrop(mm);
+    
+    /* 完了処理前に解放された Direct I/O スロット */
+    ahci_port_dio_unmap(port, dio);
+    
+    /* 空きスロット待ち (EPOLLOUT) を起こす */
+    wake_up(&port->ncq_wq);
+    
     dev_dbg(port->device, "Freed slot %d\n", slot);
+    return 0;
+}
+
+/**
+ * ahci_free_slot - Free an allocated command slot
+ * @port: Port device structure
+ * @slot: Slot number to free
+ *
+ * The caller must own the slot: the HBA is no longer processing it and
+ * no completer is going to touch it.
+ */
+void ahci_free_slot(struct ahci_port_device *port, int slot)
+{
+    if (slot < 0 || slot >= 32) {
+        dev_err(port->device, "Invalid slot number: %d\n", slot);
+        return;
+    }
+    
+    __ahci_free_slot(port, slot, false);
 }
 EXPORT_SYMBOL_GPL(ahci_free_slot);
 
+/**
+ * ahci_port_release_slot - Free a slot on behalf of user space
+ * @port: Port device structure
+ * @slot: Slot number to free
+ *
+ * Used by AHCI_IOC_FREE_SLOT and by AHCI_IOC_ISSUE_CMD when a tag is
+ * reused. Only completed slots of AHCI_IOC_ISSUE_CMD/SUBMIT_BATCH can be
+ * freed; freeing an in-flight slot would release buffers the HBA is
+ * still writing into (see ahci_slot_busy()).
+ *
+ * Return: 0 on success or if the slot was not in use, -EINVAL for an
+ *         invalid slot number, -EBUSY if the slot is busy
+ */
+int ahci_port_release_slot(struct ahci_port_device *port, int slot)
+{
+    if (slot < 0 || slot >= 32)
+        return -EINVAL;
+    
+    return __ahci_free_slot(port, slot, true);
+}
+EXPORT_SYMBOL_GPL(ahci_port_release_slot);
+
 /**
  * ahci_mark_slot_completed - Mark a slot as completed
  * @port: Port device structure
@@ -112,88 +218,505 @@ void ahci_mark_slot_completed(struct ahci_port_device *port, int slot, int resul
 EXPORT_SYMBOL_GPL(ahci_mark_slot_completed);
 
 /**
- * ahci_check_slot_completion - Check if command slots have completed
+ * ahci_port_fill_cqe - Build a completion entry from a completed slot
  * @port: Port device structure
+ * @slot: Completed slot number
+ * @cqe: Entry to fill
  *
- * Polls PxSACT register to detect completed NCQ commands.
- * Updates slot completion status accordingly.
- * This is only used for NCQ (asynchronous) commands.
+ * Context: slot_lock held
+ */
+static void ahci_port_fill_cqe(struct ahci_port_device *port, int slot,
+                               struct ahci_cq_entry *cqe)
+{
+    struct ahci_cmd_slot *cmd_slot = &port->slots[slot];
+    
+    cqe->tag = slot;
+    cqe->status = cmd_slot->req.status;
+    cqe->error = cmd_slot->req.error;
+    cqe->reserved = 0;
+    cqe->bytes = cmd_slot->buffer_len;
+    cqe->latency_ns = cmd_slot->latency_ns;
+}
+
+/**
+ * ahci_port_post_cqe - Append a completion entry to the mmap'd ring
+ * @port: Port device structure
+ * @entry: Completion entry
  *
- * Return: Bitmap of newly completed slots
+ * Does nothing if no ring has been mapped. If user space has not consumed
+ * enough entries the completion is dropped and counted in ring->overflow
+ * (it is still reported by AHCI_IOC_PROBE_CMD unless it was submitted
+ * through the SQ ring).
+ *
+ * Context: slot_lock held
  */
-u32 ahci_check_slot_completion(struct ahci_port_device *port)
+static void ahci_port_post_cqe(struct ahci_port_device *port,
+                               const struct ahci_cq_entry *entry)
+{
+    struct ahci_cq_ring *ring = port->cq_ring;
+    u32 head;
+    
+    if (!ring)
+        return;
+    
+    /* head はユーザーが書き込む */
+    head = smp_load_acquire(&ring->head);
+    if (port->cq_tail - head >= AHCI_CQ_RING_ENTRIES) {
+        WRITE_ONCE(ring->overflow, ++port->cq_overflow);
+        return;
+    }
+    
+    ring->cqes[port->cq_tail & (AHCI_CQ_RING_ENTRIES - 1)] = *entry;
+    
+    /* エントリの内容を tail 更新より先に見せる */
+    smp_store_release(&ring->tail, ++port->cq_tail);
+}
+
+/**
+ * ahci_port_post_completion - Post a completion entry and notify user space
+ * @port: Port device structure
+ * @entry: Completion entry
+ *
+ * Used for completions that are not (or no longer) backed by a slot:
+ * SQ ring commands whose slot has already been released, and SQ entries
+ * rejected before being issued.
+ */
+void ahci_port_post_completion(struct ahci_port_device *port,
+                               const struct ahci_cq_entry *entry)
 {
-    void __iomem *port_mmio = port->port_mmio;
     unsigned long flags;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    
+    ahci_port_post_cqe(port, entry);
+    
+    if (port->completion_eventfd)
+        eventfd_signal(port->completion_eventfd);
+    
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+}
+EXPORT_SYMBOL_GPL(ahci_port_post_completion);
+
+/**
+ * ahci_port_slot_ready - Make a completed slot reportable
+ * @port: Port device structure
+ * @slot: Completed slot number
+ *
+ * Called once the result (and read data) of a slot is visible to user
+ * space: marks it for AHCI_IOC_PROBE_CMD, posts it to the completion ring
+ * and signals the registered eventfd.
+ *
+ * Context: slot_lock held
+ */
+static void ahci_port_slot_ready(struct ahci_port_device *port, int slot)
+{
+    struct ahci_cq_entry entry;
+    
+    port->slots[slot].completed = true;
+    
+    ahci_port_fill_cqe(port, slot, &entry);
+    ahci_port_post_cqe(port, &entry);
+    
+    if (port->completion_eventfd)
+        eventfd_signal(port->completion_eventfd);
+}
+
+/**
+ * ahci_slot_copy_to_user - Copy read data from the SG buffers to the issuer's buffer
+ * @port: Port device structure
+ * @cmd_slot: Slot information
+ * @to: User buffer
+ * @len: Length in bytes
+ *
+ * The data is streamed one SG buffer at a time, without an intermediate
+ * kernel buffer. From process context (PROBE/WAIT) the caller's address
+ * space is used as before. From the completion worker the issuer's mm
+ * captured at issue time is borrowed with kthread_use_mm().
+ *
+ * Return: 0 on success, -EFAULT on failure
+ */
+static int ahci_slot_copy_to_user(struct ahci_port_device *port, struct ahci_cmd_slot *cmd_slot,
+                                  void __user *to, size_t len)
+{
+    struct mm_struct *mm = cmd_slot->mm;
+    struct iov_iter iter;
+    int ret;
+    
+    ret = import_ubuf(ITER_DEST, to, len, &iter);
+    if (ret)
+        return ret;
+    
+    if (!(current->flags & PF_KTHREAD))
+        return ahci_port_sg_copy_to_iter(port, cmd_slot->sg_start_idx, &iter, len);
+    
+    /* 発行元プロセスが既に終了している */
+    if (!mm || !mmget_not_zero(mm))
+        return -EFAULT;
+    
+    kthread_use_mm(mm);
+    ret = ahci_port_sg_copy_to_iter(port, cmd_slot->sg_start_idx, &iter, len);
+    kthread_unuse_mm(mm);
+    mmput(mm);
+    
+    return ret;
+}
+
+/**
+ * ahci_port_finish_slot - Hand a finished NCQ slot to its completer
+ * @port: Port device structure
+ * @slot: Slot whose result has just been recorded
+ *
+ * Slots without read data become reportable immediately; reads are flagged
+ * finish_pending and become reportable once ahci_check_slot_completion()
+ * copied the data to user space, either from PROBE/WAIT or from the
+ * completion worker. Slots submitted through the SQ ring are always
+ * finished by the worker, which releases them before posting their
+ * completion entry. Reads into a registered buffer are synced for the CPU
+ * before they are reported.
+ *
+ * Context: slot_lock held
+ * Return: true if the slot is owned by the blk-mq frontend; the caller
+ *         passes it to ahci_port_blk_complete() after dropping slot_lock
+ */
+static bool ahci_port_finish_slot(struct ahci_port_device *port, int slot)
+{
+    struct ahci_cmd_slot *cmd_slot = &port->slots[slot];
+    
+    cmd_slot->latency_ns = ktime_to_ns(ktime_sub(ktime_get(), cmd_slot->issue_time));
+    
+    set_bit(slot, &port->slots_completed);
+    port->ncq_completed++;
+    
+    /* 登録済みバッファへの READ: CPU 側から見えるように同期 */
+    if (cmd_slot->fixed && !cmd_slot->is_write && cmd_slot->buffer_len > 0)
+        ahci_port_fixed_sync_for_cpu(port, slot);
+    
+    /*
+     * io_uring: 発行元タスクで仕上げて CQE を返す
+     * READ データのコピー、Direct I/O のアンマップと SQ リング発行分の解放は
+     * プロセスコンテキストで行う
+     */
+    if (cmd_slot->rq) {
+        /* blk-mq: slot_lock を外してから blk_mq_complete_request() */
+        return true;
+    } else if (cmd_slot->ioucmd) {
+        ahci_port_uring_complete(port, slot);
+    } else if (cmd_slot->from_ring || cmd_slot->dio ||
+        (!cmd_slot->is_write && cmd_slot->bounce && cmd_slot->buffer_len > 0)) {
+        cmd_slot->finish_pending = true;
+        /* HBA の NUMA ノード上の CPU で仕上げる */
+        queue_work_node(port->node, system_unbound_wq, &port->complete_work);
+    } else {
+        ahci_port_slot_ready(port, slot);
+    }
+    
+    return false;
+}
+
+/**
+ * ahci_port_harvest_ncq - Record the result of slots cleared from PxSACT
+ * @port: Port device structure
+ * @blk_completed: Bitmap of blk-mq slots to complete after unlocking (output)
+ *
+ * The device only clears the PxSACT bit of a command that completed
+ * successfully; a failed command keeps its bit and raises an error
+ * interrupt, and it is failed by the error path (ahci_port_ncq_fail()).
+ * The SDB FIS is shared by every slot completed in one pass, so its
+ * status is not copied: a cleared slot reports DRDY with no error.
+ *
+ * PxSACT is read under slot_lock so that a value read before the port
+ * was frozen is never applied afterwards: stopping the port clears
+ * PxSACT for commands that did not finish.
+ *
+ * Context: slot_lock held, port not frozen
+ * Return: Bitmap of newly completed slots
+ */
+static u32 ahci_port_harvest_ncq(struct ahci_port_device *port, u32 *blk_completed)
+{
     u32 sact;
     u32 newly_completed = 0;
     int slot;
     
     /* Read PxSACT register (NCQ active slots) */
-    sact = ioread32(port_mmio + AHCI_PORT_SACT);
+    sact = ioread32(port->port_mmio + AHCI_PORT_SACT);
+    
+    for (slot = 0; slot < 32; slot++) {
+        struct ahci_cmd_slot *cmd_slot = &port->slots[slot];
+        
+        /* Skip if slot has not been issued to the device yet */
+        if (!test_bit(slot, &port->slots_issued))
+            continue;
+        
+        /* Skip if already marked completed (reported or not) */
+        if (test_bit(slot, &port->slots_completed))
+            continue;
+        
+        /* NCQ slot is still active (PxSACT bit set) */
+        if (sact & (1U << slot))
+            continue;
+        
+        /* PxSACT から消えた = 成功（SDB FIS の status は他のスロットと共有） */
+        cmd_slot->req.status = ATA_STATUS_DRDY;
+        cmd_slot->req.error = 0;
+        cmd_slot->req.device_out = 0;  /* SDB FIS doesn't have device */
+        
+        /* SDB FIS doesn't contain LBA/count, keep original values */
+        cmd_slot->req.lba_out = cmd_slot->req.lba;
+        cmd_slot->req.count_out = cmd_slot->req.count;
+        cmd_slot->result = 0;
+        
+        newly_completed |= (1U << slot);
+        if (ahci_port_finish_slot(port, slot))
+            *blk_completed |= (1U << slot);
+        
+        dev_dbg(port->device, "Slot %d completed: status=0x%02x error=0x%02x (SACT=0x%08x)\n",
+                slot, cmd_slot->req.status, cmd_slot->req.error, sact);
+    }
+    
+    return newly_completed;
+}
+
+/**
+ * ahci_port_complete_ncq - Detect NCQ slots finished by the device
+ * @port: Port device structure
+ *
+ * Compares PxSACT with the issued slots and records success for every
+ * slot whose PxSACT bit has been cleared, then hands the slots to
+ * their completers (see ahci_port_finish_slot()). Slots owned by the
+ * blk-mq frontend are handed to ahci_port_blk_complete() after slot_lock
+ * has been dropped.
+ *
+ * Does nothing while the port is frozen (stopped or being recovered):
+ * outstanding slots are then failed by ahci_port_ncq_fail().
+ *
+ * The registered eventfd (if any) is signalled once per slot when it
+ * becomes reportable.
+ *
+ * Never sleeps, so it is called both from the interrupt handler (SDBS) and
+ * from process context.
+ *
+ * Return: Bitmap of newly completed slots
+ */
+u32 ahci_port_complete_ncq(struct ahci_port_device *port)
+{
+    unsigned long flags;
+    u32 newly_completed = 0;
+    u32 blk_completed = 0;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    if (!port->ncq_frozen)
+        newly_completed = ahci_port_harvest_ncq(port, &blk_completed);
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    if (blk_completed)
+        ahci_port_blk_complete(port, blk_completed);
+    
+    return newly_completed;
+}
+EXPORT_SYMBOL_GPL(ahci_port_complete_ncq);
+
+/**
+ * ahci_port_ncq_freeze - Stop NCQ completion detection before stopping the port
+ * @port: Port device structure
+ *
+ * Records the slots that have already finished, then freezes the port:
+ * PxSACT is no longer trusted (clearing PxCMD.ST clears it) and slots
+ * fired while frozen are failed at once by ahci_port_fire_ncq().
+ * The port is thawed by ahci_port_start().
+ *
+ * Return: Bitmap of slots still outstanding; the caller fails them with
+ *         ahci_port_ncq_fail() once PxCMD.CR has cleared
+ */
+u32 ahci_port_ncq_freeze(struct ahci_port_device *port)
+{
+    unsigned long flags;
+    u32 blk_completed = 0;
+    u32 outstanding;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    if (!port->ncq_frozen)
+        ahci_port_harvest_ncq(port, &blk_completed);
+    port->ncq_frozen = true;
+    outstanding = port->slots_issued & ~port->slots_completed;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    if (blk_completed)
+        ahci_port_blk_complete(port, blk_completed);
+    
+    return outstanding;
+}
+EXPORT_SYMBOL_GPL(ahci_port_ncq_freeze);
+
+/**
+ * ahci_port_ncq_thaw - Resume NCQ completion detection
+ * @port: Port device structure (PxCMD.ST set)
+ */
+void ahci_port_ncq_thaw(struct ahci_port_device *port)
+{
+    unsigned long flags;
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    port->ncq_frozen = false;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+}
+EXPORT_SYMBOL_GPL(ahci_port_ncq_thaw);
+
+/**
+ * ahci_port_ncq_fail - Fail NCQ slots that the device will never complete
+ * @port: Port device structure
+ * @tags: Slots to fail (slots that completed in the meantime are skipped)
+ *
+ * Used after an error stopped the port, when the port is stopped or reset
+ * with commands outstanding, and for slots fired on a frozen port. The HBA
+ * must no longer process the slots (PxCMD.CR clear or never written to
+ * PxCI). Each slot completes with ATA status DRDY|ERR and error ABRT, so
+ * that every completer (PROBE/REAP, completion ring, kiocb, io_uring,
+ * blk-mq) reports -EIO. Slots whose issuer is still waiting in
+ * ahci_port_issue_cmd() are only taken off the device; the issuer sees
+ * that and returns an error.
+ */
+void ahci_port_ncq_fail(struct ahci_port_device *port, u32 tags)
+{
+    unsigned long flags;
+    u32 blk_completed = 0;
+    int slot;
     
     spin_lock_irqsave(&port->slot_lock, flags);
     
+    tags &= port->slots_issued & ~port->slots_completed;
     for (slot = 0; slot < 32; slot++) {
-        u32 slot_bit = (1 << slot);
+        struct ahci_cmd_slot *cmd_slot = &port->slots[slot];
         
-        /* Skip if slot is not in use */
-        if (!test_bit(slot, &port->slots_in_use))
+        if (!(tags & (1U << slot)))
             continue;
         
-        /* Skip if already marked completed */
-        if (port->slots[slot].completed)
+        /* 発行元が待機中: デバイスから外すだけにし、発行元がエラーとして解放する */
+        if (cmd_slot->waiter) {
+            clear_bit(slot, &port->slots_issued);
+            continue;
+        }
+        
+        cmd_slot->req.status = ATA_STATUS_DRDY | ATA_STATUS_ERR;
+        cmd_slot->req.error = ATA_ERR_ABRT;
+        cmd_slot->req.device_out = 0;
+        cmd_slot->req.lba_out = cmd_slot->req.lba;
+        cmd_slot->req.count_out = cmd_slot->req.count;
+        cmd_slot->result = -EIO;
+        
+        if (ahci_port_finish_slot(port, slot))
+            blk_completed |= (1U << slot);
+    }
+    
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    if (tags)
+        dev_err(port->device, "Failed NCQ slots 0x%08x\n", tags);
+    
+    if (blk_completed)
+        ahci_port_blk_complete(port, blk_completed);
+    
+    wake_up(&port->ncq_wq);
+}
+EXPORT_SYMBOL_GPL(ahci_port_ncq_fail);
+
+/**
+ * ahci_check_slot_completion - Check if command slots have completed
+ * @port: Port device structure
+ *
+ * Polls PxSACT register to detect completed NCQ commands (the interrupt
+ * handler may already have done so), then copies the read data of the
+ * completed slots to user space. A slot is only marked completed after
+ * its data has been copied.
+ * This is only used for NCQ (asynchronous) commands.
+ *
+ * Must be called from process context (PROBE/WAIT or the completion worker).
+ *
+ * Return: Bitmap of newly completed slots
+ */
+u32 ahci_check_slot_completion(struct ahci_port_device *port)
+{
+    unsigned long flags;
+    u32 newly_completed;
+    int slot;
+    
+    newly_completed = ahci_port_complete_ncq(port);
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    
+    for (slot = 0; slot < 32; slot++) {
+        struct ahci_cmd_slot *cmd_slot = &port->slots[slot];
+        void __user *user_buffer;
+        size_t copy_len;
+        bool failed = false;
+        
+        if (!cmd_slot->finish_pending)
             continue;
         
-        /* Check if NCQ slot has completed (PxSACT bit cleared) */
-        if (!(sact & slot_bit)) {
-            /* NCQ: Read SDB (Set Device Bits) FIS */
-            struct fis_set_dev_bits *sdb_fis;
-            void *buffer_to_copy = NULL;
-            void __user *user_buffer = NULL;
-            size_t copy_len = 0;
+        /*
+         * Prepare copy parameters while holding lock. finishing keeps the
+         * slot busy (no FREE_SLOT/REAP) while the lock is dropped below.
+         */
+        cmd_slot->finish_pending = false;
+        cmd_slot->finishing = true;
+        user_buffer = (void __user *)cmd_slot->req.buffer;
+        copy_len = cmd_slot->buffer_len;
+        
+        /* Copy data to user after releasing lock (failed slots have no data) */
+        if (!cmd_slot->is_write && cmd_slot->bounce && copy_len > 0 && cmd_slot->result == 0) {
+            spin_unlock_irqrestore(&port->slot_lock, flags);
+            /* SGバッファ範囲はスロット解放まで他のコマンドに使われない */
+            failed = ahci_slot_copy_to_user(port, cmd_slot, user_buffer, copy_len) != 0;
+            if (failed)
+                dev_err(port->device, "Failed to copy data to user for slot %d\n", slot);
+            spin_lock_irqsave(&port->slot_lock, flags);
+        }
+        
+        if (failed) {
+            cmd_slot->req.status = 0xFF;
+            cmd_slot->req.error = 0xFF;
+        }
+        
+        /* Direct I/O: DMA アンマップ後にデータがユーザーから見える */
+        if (cmd_slot->dio) {
+            struct ahci_dio *dio = cmd_slot->dio;
             
-            sdb_fis = (struct fis_set_dev_bits *)((u8 *)port->fis_area + AHCI_RX_FIS_SDB);
+            cmd_slot->dio = NULL;
+            spin_unlock_irqrestore(&port->slot_lock, flags);
+            ahci_port_dio_unmap(port, dio);
+            spin_lock_irqsave(&port->slot_lock, flags);
+        }
+        
+        /* read_iter/write_iter の非同期 kiocb: スロットを解放してから完了を通知 */
+        if (cmd_slot->iocb) {
+            struct kiocb *iocb = cmd_slot->iocb;
+            long res = (cmd_slot->req.status & ATA_STATUS_ERR) ? -EIO : cmd_slot->buffer_len;
             
-            /* SDB FIS contains the actual status value */
-            port->slots[slot].req.status = sdb_fis->status;
-            port->slots[slot].req.error = sdb_fis->error;
-            port->slots[slot].req.device_out = 0;  /* SDB FIS doesn't have device */
+            cmd_slot->iocb = NULL;
+            spin_unlock_irqrestore(&port->slot_lock, flags);
             
-            /* SDB FIS doesn't contain LBA/count, keep original values */
-            port->slots[slot].req.lba_out = port->slots[slot].req.lba;
-            port->slots[slot].req.count_out = port->slots[slot].req.count;
+            ahci_free_slot(port, slot);
+            iocb->ki_complete(iocb, res);
             
-            /* Prepare copy parameters while holding lock */
-            if (!port->slots[slot].is_write && port->slots[slot].buffer && 
-                port->slots[slot].buffer_len > 0) {
-                buffer_to_copy = port->slots[slot].buffer;
-                user_buffer = (void __user *)port->slots[slot].req.buffer;
-                copy_len = port->slots[slot].buffer_len;
-            }
+            spin_lock_irqsave(&port->slot_lock, flags);
+            continue;
+        }
+        
+        /* SQ リング発行分: スロットを解放してから完了エントリを載せる */
+        if (cmd_slot->from_ring) {
+            struct ahci_cq_entry entry;
             
-            set_bit(slot, &port->slots_completed);
-            port->slots[slot].completed = true;
-            port->slots[slot].result = 0;
-            port->ncq_completed++;
-            newly_completed |= slot_bit;
+            ahci_port_fill_cqe(port, slot, &entry);
+            spin_unlock_irqrestore(&port->slot_lock, flags);
             
-            dev_dbg(port->device, "Slot %d completed: status=0x%02x error=0x%02x (SACT=0x%08x)\n",
-                    slot, port->slots[slot].req.status, port->slots[slot].req.error, sact);
+            ahci_free_slot(port, slot);
+            ahci_port_post_completion(port, &entry);
             
-            /* Copy data to user after releasing lock */
-            if (buffer_to_copy) {
-                spin_unlock_irqrestore(&port->slot_lock, flags);
-                if (copy_to_user(user_buffer, buffer_to_copy, copy_len)) {
-                    dev_err(port->device, "Failed to copy data to user for slot %d\n", slot);
-                    spin_lock_irqsave(&port->slot_lock, flags);
-                    port->slots[slot].req.status = 0xFF;
-                    port->slots[slot].req.error = 0xFF;
-                } else {
-                    spin_lock_irqsave(&port->slot_lock, flags);
-                }
-            }
+            spin_lock_irqsave(&port->slot_lock, flags);
+            continue;
         }
+        
+        cmd_slot->finishing = false;
+        ahci_port_slot_ready(port, slot);
     }
     
     spin_unlock_irqrestore(&port->slot_lock, flags);
@@ -201,3 +724,96 @@ u32 ahci_check_slot_completion(struct ahci_port_device *port)
     return newly_completed;
 }
 EXPORT_SYMBOL_GPL(ahci_check_slot_completion);
+
+/**
+ * ahci_port_complete_work - Completion worker
+ * @work: port->complete_work
+ *
+ * Queued when the device completes NCQ reads, SQ ring commands or async
+ * read_iter/write_iter kiocbs, so that read data is copied to the issuer's
+ * buffer, SQ ring and kiocb slots are released and the completions are
+ * posted (completion ring / ki_complete()) without waiting for a PROBE/WAIT
+ * call.
+ */
+void ahci_port_complete_work(struct work_struct *work)
+{
+    struct ahci_port_device *port = container_of(work, struct ahci_port_device,
+                                                 complete_work);
+    
+    ahci_check_slot_completion(port);
+}
+EXPORT_SYMBOL_GPL(ahci_port_complete_work);
+
+/**
+ * ahci_port_set_eventfd - Register an eventfd for NCQ completion notification
+ * @port: Port device structure
+ * @fd: eventfd file descriptor, or negative to unregister
+ *
+ * Replaces the eventfd signalled by ahci_port_complete_ncq(). The previous
+ * eventfd (if any) is released.
+ *
+ * Return: 0 on success, negative error code on failure
+ */
+int ahci_port_set_eventfd(struct ahci_port_device *port, int fd)
+{
+    struct eventfd_ctx *ctx = NULL;
+    struct eventfd_ctx *old;
+    unsigned long flags;
+    
+    if (fd >= 0) {
+        ctx = eventfd_ctx_fdget(fd);
+        if (IS_ERR(ctx))
+            return PTR_ERR(ctx);
+    }
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    old = port->completion_eventfd;
+    port->completion_eventfd = ctx;
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    if (old)
+        eventfd_ctx_put(old);
+    
+    dev_info(port->device, "Completion eventfd %s\n", ctx ? "registered" : "unregistered");
+    return 0;
+}
+EXPORT_SYMBOL_GPL(ahci_port_set_eventfd);
+
+/**
+ * ahci_peek_slot_completion - Get slots with a completion waiting to be reported
+ * @port: Port device structure
+ *
+ * Returns the slots that are either already marked completed (or waiting
+ * for their read data to be copied) but not yet reported by
+ * AHCI_IOC_PROBE_CMD, or whose PxSACT bit has been cleared by
+ * the device (PxSACT is ignored while the port is frozen, see
+ * ahci_port_ncq_freeze()). Unlike ahci_check_slot_completion() this has no side effects
+ * and never sleeps, so it can be used as a wait_event() condition.
+ *
+ * Return: Bitmap of slots with a pending completion
+ */
+u32 ahci_peek_slot_completion(struct ahci_port_device *port)
+{
+    unsigned long flags;
+    u32 sact;
+    u32 pending = 0;
+    int slot;
+    
+    sact = ioread32(port->port_mmio + AHCI_PORT_SACT);
+    
+    spin_lock_irqsave(&port->slot_lock, flags);
+    
+    for (slot = 0; slot < 32; slot++) {
+        if (port->slots[slot].completed || port->slots[slot].finish_pending)
+            pending |= (1U << slot);
+        else if (!port->ncq_frozen && test_bit(slot, &port->slots_issued) &&
+                 !test_bit(slot, &port->slots_completed) &&
+                 !(sact & (1U << slot)))
+            pending |= (1U << slot);
+    }
+    
+    spin_unlock_irqrestore(&port->slot_lock, flags);
+    
+    return pending;
+}
+EXPORT_SYMBOL_GPL(ahci_peek_slot_completion);
@@ -0,0 +1,120 @@
+/*
+ * test_blk.c - blk-mq ブロックデバイス (/dev/ahci_lld0n) テスト
+ *
+ * 前提: insmod ahci_lld.ko blk_frontend=1
+ *
+ * テスト内容:
+ * 1. O_DIRECT で /dev/ahci_lld0n を開き、容量を確認
+ * 2. 256 セクタを超える 1MB を pwrite で書き込み (Features 15:8 を使う)
+ * 3. pread で読み戻して比較
+ * 4. 4KB のランダム読み込みを 1024 回 (ブロック層のタグ = NCQ タグ)
+ * 5. /dev/ahci_lld_p0 が -EBUSY で開けないことを確認
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define BLK_PATH "/dev/ahci_lld0n"
+#define PORT_PATH "/dev/ahci_lld_p0"
+#define SECTOR_SIZE 512
+#define XFER_SIZE (1024 * 1024)
+#define TEST_OFFSET (100 * SECTOR_SIZE)
+#define RANDOM_READS 1024
+
+int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
+{
+    unsigned char *orig, *wbuf, *rbuf;
+    unsigned long long size;
+    int fd, pfd;
+    int i, ret = 1;
+
+    printf("blk-mq Frontend Test\n");
+    printf("====================\n\n");
+
+    fd = open(BLK_PATH, O_RDWR | O_DIRECT);
+    if (fd < 0) {
+        perror(BLK_PATH);
+        return 1;
+    }
+
+    if (ioctl(fd, BLKGETSIZE64, &size) < 0) {
+        perror("ioctl BLKGETSIZE64");
+        close(fd);
+        return 1;
+    }
+    printf("%s: %llu sectors\n", BLK_PATH, size / SECTOR_SIZE);
+
+    if (posix_memalign((void **)&orig, 4096, XFER_SIZE) ||
+        posix_memalign((void **)&wbuf, 4096, XFER_SIZE) ||
+        posix_memalign((void **)&rbuf, 4096, XFER_SIZE)) {
+        perror("posix_memalign");
+        close(fd);
+        return 1;
+    }
+
+    /* 元のデータを退避 */
+    if (pread(fd, orig, XFER_SIZE, TEST_OFFSET) != XFER_SIZE) {
+        perror("pread (save)");
+        goto out;
+    }
+
+    for (i = 0; i < XFER_SIZE; i++)
+        wbuf[i] = (unsigned char)(i * 7 + (i >> 9));
+
+    if (pwrite(fd, wbuf, XFER_SIZE, TEST_OFFSET) != XFER_SIZE) {
+        perror("pwrite");
+        goto out_restore;
+    }
+    memset(rbuf, 0, XFER_SIZE);
+    if (pread(fd, rbuf, XFER_SIZE, TEST_OFFSET) != XFER_SIZE) {
+        perror("pread");
+        goto out_restore;
+    }
+    if (memcmp(wbuf, rbuf, XFER_SIZE)) {
+        printf("  1MB round trip: data mismatch\n");
+        goto out_restore;
+    }
+    printf("1MB write/read round trip OK\n");
+
+    srand(1);
+    for (i = 0; i < RANDOM_READS; i++) {
+        off_t off = ((off_t)rand() % (size / 4096)) * 4096;
+
+        if (pread(fd, rbuf, 4096, off) != 4096) {
+            perror("pread (random)");
+            goto out_restore;
+        }
+    }
+    printf("%d random 4KB reads OK\n", RANDOM_READS);
+
+    pfd = open(PORT_PATH, O_RDWR);
+    if (pfd >= 0 || errno != EBUSY) {
+        printf("  %s: expected EBUSY while the disk is registered\n", PORT_PATH);
+        if (pfd >= 0)
+            close(pfd);
+        goto out_restore;
+    }
+    ret = 0;
+
+out_restore:
+    if (pwrite(fd, orig, XFER_SIZE, TEST_OFFSET) != XFER_SIZE) {
+        perror("pwrite (restore)");
+        ret = 1;
+    }
+out:
+    free(orig);
+    free(wbuf);
+    free(rbuf);
+    close(fd);
+
+    printf("\n====================\n");
+    printf(ret == 0 ? "All tests PASSED\n" : "Some tests FAILED\n");
+    return ret;
+}
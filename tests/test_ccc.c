@@ -0,0 +1,222 @@
+/*
+ * test_ccc.c - Command Completion Coalescing (CCC) テスト
+ *
+ * テスト内容:
+ * 1. /dev/ahci_lld_ghc で AHCI_IOC_GHC_GET_CCC を実行し、現在の設定を表示
+ * 2. ポート0を CCC 対象 (completions=8, timeout=1ms) に設定
+ * 3. 32 個の 4KB 非同期読み込み (NCQ) を 8 回発行し、すべて完了することと
+ *    CCC 割り込みが発生したことを確認
+ * 4. 未実装ポートや completions=0 が EINVAL になることを確認
+ * 5. 元の設定に戻す
+ *
+ * CAP.CCCS が 0 の HBA では EOPNOTSUPP となり、テストはスキップされる。
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#include "../ahci_lld_ioctl.h"
+
+#define GHC_PATH "/dev/ahci_lld_ghc"
+#define DEVICE_PATH "/dev/ahci_lld_p0"
+#define SECTOR_SIZE 512
+#define IO_SIZE 4096
+#define QUEUE_DEPTH 32
+#define ROUNDS 8
+#define LBA_RANGE (1024 * 1024)
+
+static int io_setup(unsigned nr, aio_context_t *ctx)
+{
+    return syscall(SYS_io_setup, nr, ctx);
+}
+
+static int io_destroy(aio_context_t ctx)
+{
+    return syscall(SYS_io_destroy, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+    return syscall(SYS_io_submit, ctx, nr, iocbpp);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr, struct io_event *events)
+{
+    return syscall(SYS_io_getevents, ctx, min_nr, nr, events, NULL);
+}
+
+static int run_round(aio_context_t ctx, int fd, unsigned char *bufs)
+{
+    struct iocb iocbs[QUEUE_DEPTH];
+    struct iocb *iocbp[QUEUE_DEPTH];
+    struct io_event events[QUEUE_DEPTH];
+    int i, n, done;
+
+    memset(iocbs, 0, sizeof(iocbs));
+    for (i = 0; i < QUEUE_DEPTH; i++) {
+        iocbs[i].aio_fildes = fd;
+        iocbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+        iocbs[i].aio_buf = (__u64)(unsigned long)(bufs + i * IO_SIZE);
+        iocbs[i].aio_nbytes = IO_SIZE;
+        iocbs[i].aio_offset = (__s64)(rand() % LBA_RANGE) * SECTOR_SIZE;
+        iocbs[i].aio_data = i;
+        iocbp[i] = &iocbs[i];
+    }
+
+    n = io_submit(ctx, QUEUE_DEPTH, iocbp);
+    if (n != QUEUE_DEPTH) {
+        printf("  io_submit returned %d\n", n);
+        return -1;
+    }
+
+    for (done = 0; done < QUEUE_DEPTH; done += n) {
+        n = io_getevents(ctx, 1, QUEUE_DEPTH - done, events);
+        if (n <= 0) {
+            perror("io_getevents");
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            if ((long long)events[i].res != IO_SIZE) {
+                printf("  iocb %llu: res=%lld\n", (unsigned long long)events[i].data,
+                       (long long)events[i].res);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
+{
+    struct ahci_ccc_config orig, cfg, bad;
+    aio_context_t ctx = 0;
+    unsigned char *bufs;
+    unsigned long long before;
+    int gfd, fd;
+    int i, ret = 1;
+
+    printf("Command Completion Coalescing Test\n");
+    printf("==================================\n\n");
+
+    gfd = open(GHC_PATH, O_RDWR);
+    if (gfd < 0) {
+        perror(GHC_PATH);
+        return 1;
+    }
+
+    if (ioctl(gfd, AHCI_IOC_GHC_GET_CCC, &orig) < 0) {
+        perror("ioctl GHC_GET_CCC");
+        close(gfd);
+        return 1;
+    }
+    printf("Current: ports=0x%08x completions=%u timeout=%ums irq_bit=%u interrupts=%llu\n",
+           orig.ports, orig.completions, orig.timeout_ms, orig.irq_bit,
+           (unsigned long long)orig.interrupts);
+
+    fd = open(DEVICE_PATH, O_RDWR | O_DIRECT);
+    if (fd < 0) {
+        perror("open");
+        close(gfd);
+        return 1;
+    }
+
+    if (ioctl(fd, AHCI_IOC_PORT_RESET) < 0 || ioctl(fd, AHCI_IOC_PORT_START) < 0) {
+        perror("port reset/start");
+        close(fd);
+        close(gfd);
+        return 1;
+    }
+
+    if (posix_memalign((void **)&bufs, 4096, QUEUE_DEPTH * IO_SIZE)) {
+        perror("posix_memalign");
+        close(fd);
+        close(gfd);
+        return 1;
+    }
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.ports = 1 << 0;
+    cfg.completions = 8;
+    cfg.timeout_ms = 1;
+    if (ioctl(gfd, AHCI_IOC_GHC_SET_CCC, &cfg) < 0) {
+        if (errno == EOPNOTSUPP) {
+            printf("HBA does not support CCC (CAP.CCCS=0), skipped\n");
+            ret = 0;
+        } else {
+            perror("ioctl GHC_SET_CCC");
+        }
+        goto out;
+    }
+    if (ioctl(gfd, AHCI_IOC_GHC_GET_CCC, &cfg) < 0) {
+        perror("ioctl GHC_GET_CCC");
+        goto out_restore;
+    }
+    printf("Enabled: ports=0x%08x completions=%u timeout=%ums irq_bit=%u\n",
+           cfg.ports, cfg.completions, cfg.timeout_ms, cfg.irq_bit);
+    if (cfg.ports != 1 || cfg.completions != 8 || cfg.timeout_ms != 1) {
+        printf("  GET does not match SET\n");
+        goto out_restore;
+    }
+    before = cfg.interrupts;
+
+    if (io_setup(QUEUE_DEPTH, &ctx) < 0) {
+        perror("io_setup");
+        goto out_restore;
+    }
+
+    srand(1);
+    for (i = 0; i < ROUNDS; i++) {
+        if (run_round(ctx, fd, bufs) < 0) {
+            io_destroy(ctx);
+            goto out_restore;
+        }
+    }
+    io_destroy(ctx);
+
+    if (ioctl(gfd, AHCI_IOC_GHC_GET_CCC, &cfg) < 0) {
+        perror("ioctl GHC_GET_CCC");
+        goto out_restore;
+    }
+    printf("%d reads completed, %llu CCC interrupts\n", ROUNDS * QUEUE_DEPTH,
+           (unsigned long long)(cfg.interrupts - before));
+    if (cfg.interrupts == before) {
+        printf("  no CCC interrupt was serviced\n");
+        goto out_restore;
+    }
+
+    bad = cfg;
+    bad.ports = 0x80000000;
+    if (ioctl(gfd, AHCI_IOC_GHC_SET_CCC, &bad) == 0 || errno != EINVAL) {
+        /* ポート31が実装されている HBA では EINVAL にならない */
+        printf("  port 31: not rejected (implemented?)\n");
+    }
+    bad = cfg;
+    bad.completions = 0;
+    if (ioctl(gfd, AHCI_IOC_GHC_SET_CCC, &bad) == 0 || errno != EINVAL) {
+        printf("  completions=0: expected EINVAL\n");
+        goto out_restore;
+    }
+    printf("Invalid configuration rejected with EINVAL\n");
+    ret = 0;
+
+out_restore:
+    if (ioctl(gfd, AHCI_IOC_GHC_SET_CCC, &orig) < 0) {
+        perror("ioctl GHC_SET_CCC (restore)");
+        ret = 1;
+    }
+out:
+    free(bufs);
+    close(fd);
+    close(gfd);
+
+    printf("\n==================================\n");
+    printf(ret == 0 ? "All tests PASSED\n" : "Some tests FAILED\n");
+    return ret;
+}
@@ -0,0 +1,115 @@
+/*
+ * test_large_xfer.c - SGバッファ経由の大容量転送 (ストリーミングコピー) テスト
+ *
+ * テスト内容:
+ * 1. 4バイト境界に揃っていないユーザーバッファ (Direct I/O 対象外) を用意
+ * 2. 16MB + 1.5KB (128KB の端数を含む) を WRITE DMA EXT で書き込み
+ * 3. 同じ範囲を READ DMA EXT で読み戻して比較
+ *
+ * ドライバはユーザーバッファとSGバッファの間で 128KB ずつ直接コピーし、
+ * buffer_len 分のカーネルバッファは確保しない。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "../ahci_lld_ioctl.h"
+
+#define DEVICE_PATH "/dev/ahci_lld_p0"
+#define SECTOR_SIZE 512
+#define XFER_SECTORS (32768 + 3)
+#define XFER_SIZE (XFER_SECTORS * SECTOR_SIZE)
+#define TEST_LBA 100
+
+static int issue(int fd, __u8 command, void *buf, int write)
+{
+    struct ahci_cmd_request req;
+
+    memset(&req, 0, sizeof(req));
+    req.command = command;
+    req.device = 0x40;                          // LBA mode
+    req.lba = TEST_LBA;
+    req.count = XFER_SECTORS;
+    req.buffer = (__u64)(unsigned long)buf;
+    req.buffer_len = XFER_SIZE;
+    req.flags = write ? AHCI_CMD_FLAG_WRITE : 0;
+    req.timeout_ms = 10000;
+
+    if (ioctl(fd, AHCI_IOC_ISSUE_CMD, &req) < 0) {
+        perror("ioctl AHCI_IOC_ISSUE_CMD");
+        return -1;
+    }
+    if (req.status & 0x01) {
+        printf("  command 0x%02x failed: status=0x%02x error=0x%02x\n",
+               command, req.status, req.error);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
+{
+    unsigned char *wbuf_base, *rbuf_base;
+    unsigned char *wbuf, *rbuf;
+    int fd;
+    int i, ret = 1;
+
+    printf("Large Transfer Test\n");
+    printf("===================\n\n");
+
+    fd = open(DEVICE_PATH, O_RDWR);
+    if (fd < 0) {
+        perror("open");
+        return 1;
+    }
+
+    if (ioctl(fd, AHCI_IOC_PORT_RESET) < 0 || ioctl(fd, AHCI_IOC_PORT_START) < 0) {
+        perror("port reset/start");
+        close(fd);
+        return 1;
+    }
+
+    wbuf_base = malloc(XFER_SIZE + 1);
+    rbuf_base = malloc(XFER_SIZE + 1);
+    if (!wbuf_base || !rbuf_base) {
+        perror("malloc");
+        goto out;
+    }
+
+    /* 4バイト境界からずらして Direct I/O ではなくSGバッファ経由にする */
+    wbuf = wbuf_base + 1;
+    rbuf = rbuf_base + 1;
+    for (i = 0; i < XFER_SIZE; i++)
+        wbuf[i] = (unsigned char)(i * 7 + (i >> 17));
+    memset(rbuf, 0, XFER_SIZE);
+
+    printf("Writing %d bytes...\n", XFER_SIZE);
+    if (issue(fd, 0x35, wbuf, 1) < 0)           // WRITE DMA EXT
+        goto out;
+
+    printf("Reading %d bytes...\n", XFER_SIZE);
+    if (issue(fd, 0x25, rbuf, 0) < 0)           // READ DMA EXT
+        goto out;
+
+    for (i = 0; i < XFER_SIZE; i++) {
+        if (rbuf[i] != wbuf[i]) {
+            printf("  mismatch at offset 0x%x: wrote 0x%02x, read 0x%02x\n",
+                   i, wbuf[i], rbuf[i]);
+            goto out;
+        }
+    }
+    printf("All %d bytes match\n", XFER_SIZE);
+    ret = 0;
+
+out:
+    free(wbuf_base);
+    free(rbuf_base);
+    close(fd);
+
+    printf("\n===================\n");
+    printf(ret == 0 ? "All tests PASSED\n" : "Some tests FAILED\n");
+    return ret;
+}
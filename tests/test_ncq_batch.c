@@ -0,0 +1,113 @@
+/*
+ * test_ncq_batch.c - NCQバッチ発行 (AHCI_IOC_SUBMIT_BATCH) テスト
+ *
+ * テスト内容:
+ * 1. 32個のNCQ READを AUTO_TAG で1回のioctlで発行
+ * 2. 割り当てられたtagが重複していないことを確認
+ * 3. AHCI_IOC_WAIT_CMD で全完了を待機
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "../ahci_lld_ioctl.h"
+
+#define DEVICE_PATH "/dev/ahci_lld_p0"
+#define SECTOR_SIZE 512
+#define TEST_LBA 0x3000
+#define NUM_CMDS 32
+
+int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
+{
+    struct ahci_cmd_request reqs[NUM_CMDS];
+    struct ahci_submit_batch batch;
+    struct ahci_wait_cmd wait;
+    unsigned char *buffers[NUM_CMDS] = { NULL };
+    __u32 seen = 0;
+    int fd;
+    int i, ret = 1;
+
+    printf("NCQ Batch Submit Test\n");
+    printf("=====================\n\n");
+
+    fd = open(DEVICE_PATH, O_RDWR);
+    if (fd < 0) {
+        perror("open");
+        return 1;
+    }
+
+    if (ioctl(fd, AHCI_IOC_PORT_RESET) < 0 || ioctl(fd, AHCI_IOC_PORT_START) < 0) {
+        perror("port reset/start");
+        close(fd);
+        return 1;
+    }
+
+    memset(reqs, 0, sizeof(reqs));
+    for (i = 0; i < NUM_CMDS; i++) {
+        buffers[i] = malloc(SECTOR_SIZE);
+        if (!buffers[i]) {
+            perror("malloc");
+            goto cleanup;
+        }
+
+        reqs[i].command = 0x60;     // READ FPDMA QUEUED
+        reqs[i].features = 1;       // Sector count
+        reqs[i].device = 0x40;      // LBA mode
+        reqs[i].lba = TEST_LBA + i * 8;
+        reqs[i].flags = AHCI_CMD_FLAG_NCQ | AHCI_CMD_FLAG_AUTO_TAG;
+        reqs[i].buffer = (__u64)buffers[i];
+        reqs[i].buffer_len = SECTOR_SIZE;
+    }
+
+    memset(&batch, 0, sizeof(batch));
+    batch.count = NUM_CMDS;
+    batch.reqs = (__u64)reqs;
+
+    if (ioctl(fd, AHCI_IOC_SUBMIT_BATCH, &batch) < 0) {
+        perror("ioctl AHCI_IOC_SUBMIT_BATCH");
+        goto cleanup;
+    }
+    printf("Submitted %u requests, tags=0x%08x\n", batch.submitted, batch.tags);
+
+    for (i = 0; i < (int)batch.submitted; i++) {
+        if (seen & (1U << reqs[i].tag)) {
+            printf("  Duplicate tag %u\n", reqs[i].tag);
+            goto cleanup;
+        }
+        seen |= (1U << reqs[i].tag);
+    }
+    if (seen != batch.tags) {
+        printf("  Tag mismatch (reqs=0x%08x batch=0x%08x)\n", seen, batch.tags);
+        goto cleanup;
+    }
+
+    memset(&wait, 0, sizeof(wait));
+    wait.mask = batch.tags;
+    wait.min_complete = batch.submitted;
+    wait.timeout_ms = 5000;
+
+    if (ioctl(fd, AHCI_IOC_WAIT_CMD, &wait) < 0) {
+        perror("ioctl AHCI_IOC_WAIT_CMD");
+        goto cleanup;
+    }
+    printf("Completed 0x%08x\n", wait.sdb.completed);
+
+    if (batch.submitted == NUM_CMDS && wait.sdb.completed == batch.tags)
+        ret = 0;
+
+cleanup:
+    for (i = 0; i < 32; i++) {
+        if (seen & (1U << i))
+            ioctl(fd, AHCI_IOC_FREE_SLOT, &i);
+    }
+    for (i = 0; i < NUM_CMDS; i++)
+        free(buffers[i]);
+    close(fd);
+
+    printf("\n=====================\n");
+    printf(ret == 0 ? "All tests PASSED\n" : "Some tests FAILED\n");
+    return ret;
+}
@@ -166,39 +166,40 @@ int main(void)
         }
         
         /* Check for completions */
-        struct ahci_sdb sdb;
-        memset(&sdb, 0, sizeof(sdb));
+        struct ahci_reap_entry entries[NCQ_DEPTH];
+        struct ahci_reap_cmd reap;
+        memset(&reap, 0, sizeof(reap));
+        reap.mask = active_slot_mask;
+        reap.max_entries = NCQ_DEPTH;
+        reap.entries = (uint64_t)entries;
         
-        ret = ioctl(fd, AHCI_IOC_PROBE_CMD, &sdb);
+        /* Reap completed slots (slots are freed by the driver) */
+        ret = ioctl(fd, AHCI_IOC_REAP_CMD, &reap);
         if (ret < 0) {
-            perror("PROBE_CMD failed");
+            perror("REAP_CMD failed");
             break;
         }
         
         /* Process completed slots */
-        if (sdb.completed) {
-            int slot;
-            for (slot = 0; slot < NCQ_DEPTH; slot++) {
-                if (sdb.completed & (1 << slot)) {
-                    if (active_slot_mask & (1 << slot)) {
-                        /* Verify completion */
-                        if (sdb.status[slot] != 0x40) {
-                            printf("\nSlot %d: Error! Status=0x%02x Error=0x%02x\n",
-                                   slot, sdb.status[slot], sdb.error[slot]);
-                        }
-                        
-                        /* Note: Kernel buffer freed automatically on next Issue or FREE_SLOT */
-                        
-                        active_slot_mask &= ~(1 << slot);
-                        active_slots--;
-                        completed_count++;
-                        
-                        if (completed_count % 10 == 0) {
-                            printf("Issued: %d/%d, Active: %d, Completed: %d\r",
-                                   issued_count, NUM_OPERATIONS, active_slots, completed_count);
-                            fflush(stdout);
-                        }
-                    }
+        {
+            uint32_t i;
+            for (i = 0; i < reap.nr; i++) {
+                int slot = entries[i].tag;
+                
+                /* Verify completion */
+                if (entries[i].status != 0x40) {
+                    printf("\nSlot %d: Error! Status=0x%02x Error=0x%02x\n",
+                           slot, entries[i].status, entries[i].error);
+                }
+                
+                active_slot_mask &= ~(1 << slot);
+                active_slots--;
+                completed_count++;
+                
+                if (completed_count % 10 == 0) {
+                    printf("Issued: %d/%d, Active: %d, Completed: %d\r",
+                           issued_count, NUM_OPERATIONS, active_slots, completed_count);
+                    fflush(stdout);
                 }
             }
         }
@@ -0,0 +1,142 @@
+/*
+ * test_ncq_ring.c - mmap完了リングテスト
+ *
+ * テスト内容:
+ * 1. 完了リングをmmap
+ * 2. eventfdを登録し、8つのNCQ READを発行
+ * 3. eventfdで起床し、リングからシステムコールなしで完了を回収
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include "../ahci_lld_ioctl.h"
+
+#define DEVICE_PATH "/dev/ahci_lld_p0"
+#define SECTOR_SIZE 512
+#define TEST_LBA 0x2000
+#define NUM_CMDS 8
+
+int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
+{
+    struct ahci_cq_ring *ring;
+    struct ahci_cmd_request req;
+    unsigned char *buffers[NUM_CMDS] = { NULL };
+    __u32 issued = 0, reaped = 0;
+    __u32 head;
+    int fd, efd;
+    int i, ret = 1;
+
+    printf("NCQ Completion Ring Test\n");
+    printf("========================\n\n");
+
+    fd = open(DEVICE_PATH, O_RDWR);
+    if (fd < 0) {
+        perror("open");
+        return 1;
+    }
+
+    if (ioctl(fd, AHCI_IOC_PORT_RESET) < 0 || ioctl(fd, AHCI_IOC_PORT_START) < 0) {
+        perror("port reset/start");
+        close(fd);
+        return 1;
+    }
+
+    ring = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, AHCI_CQ_RING_OFFSET);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return 1;
+    }
+    printf("Ring mapped: entries=%u head=%u tail=%u\n", ring->entries, ring->head, ring->tail);
+
+    efd = eventfd(0, 0);
+    if (efd < 0 || ioctl(fd, AHCI_IOC_SET_EVENTFD, &efd) < 0) {
+        perror("eventfd");
+        goto out_unmap;
+    }
+
+    for (i = 0; i < NUM_CMDS; i++) {
+        buffers[i] = malloc(SECTOR_SIZE);
+        if (!buffers[i]) {
+            perror("malloc");
+            goto cleanup;
+        }
+
+        memset(&req, 0, sizeof(req));
+        req.command = 0x60;         // READ FPDMA QUEUED
+        req.features = 1;           // Sector count
+        req.device = 0x40;          // LBA mode
+        req.lba = TEST_LBA + i * 8;
+        req.count = (i << 3);       // NCQ tag (bits 7:3)
+        req.tag = i;
+        req.flags = AHCI_CMD_FLAG_NCQ;
+        req.buffer = (__u64)buffers[i];
+        req.buffer_len = SECTOR_SIZE;
+        req.timeout_ms = 5000;
+
+        if (ioctl(fd, AHCI_IOC_ISSUE_CMD, &req) < 0) {
+            perror("ioctl AHCI_IOC_ISSUE_CMD");
+            goto cleanup;
+        }
+        issued |= (1U << req.tag);
+    }
+
+    /* eventfd で起床してリングから回収 */
+    head = ring->head;
+    while (reaped != issued) {
+        struct pollfd pfd = { .fd = efd, .events = POLLIN };
+        uint64_t count;
+        __u32 tail;
+
+        if (poll(&pfd, 1, 5000) <= 0) {
+            printf("  Timeout (reaped=0x%08x issued=0x%08x)\n", reaped, issued);
+            goto cleanup;
+        }
+        if (read(efd, &count, sizeof(count)) != sizeof(count)) {
+            perror("read eventfd");
+            goto cleanup;
+        }
+
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct ahci_cq_entry *cqe = &ring->cqes[head & (ring->entries - 1)];
+
+            printf("  Tag %2u: status=0x%02x error=0x%02x bytes=%u latency=%llu ns\n",
+                   cqe->tag, cqe->status, cqe->error, cqe->bytes,
+                   (unsigned long long)cqe->latency_ns);
+            reaped |= (1U << cqe->tag);
+            head++;
+        }
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    }
+
+    printf("\nReaped 0x%08x, overflow=%u\n", reaped, ring->overflow);
+    ret = 0;
+
+cleanup:
+    for (i = 0; i < NUM_CMDS; i++) {
+        if (issued & (1U << i))
+            ioctl(fd, AHCI_IOC_FREE_SLOT, &i);
+        free(buffers[i]);
+    }
+    i = -1;
+    ioctl(fd, AHCI_IOC_SET_EVENTFD, &i);
+out_unmap:
+    if (efd >= 0)
+        close(efd);
+    munmap(ring, sysconf(_SC_PAGESIZE));
+    close(fd);
+
+    printf("\n========================\n");
+    printf(ret == 0 ? "All tests PASSED\n" : "Some tests FAILED\n");
+    return ret;
+}
@@ -0,0 +1,162 @@
+/*
+ * test_ncq_wait.c - NCQ完了待ち (AHCI_IOC_WAIT_CMD) テスト
+ *
+ * テスト内容:
+ * 1. 4つのNCQ READを発行
+ * 2. AHCI_IOC_WAIT_CMD で全完了をスリープ待機（PROBEのスピンなし）
+ * 3. 未使用スロットのみを指定した場合に即座に戻ることを確認
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include "../ahci_lld_ioctl.h"
+
+#define DEVICE_PATH "/dev/ahci_lld_p0"
+#define SECTOR_SIZE 512
+#define TEST_LBA 0x1000
+#define NUM_CMDS 4
+
+static double elapsed_ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 +
+           (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* NCQ READ発行 → WAIT_CMD で完了待ち */
+static int test_wait_all(int fd)
+{
+    struct ahci_cmd_request req;
+    struct ahci_wait_cmd wait;
+    struct timespec start, end;
+    unsigned char *buffers[NUM_CMDS] = { NULL };
+    __u32 issued = 0;
+    int i, ret = -1;
+
+    printf("[Test 1] Issue %d NCQ reads and wait for all\n", NUM_CMDS);
+
+    for (i = 0; i < NUM_CMDS; i++) {
+        buffers[i] = malloc(SECTOR_SIZE);
+        if (!buffers[i]) {
+            perror("malloc");
+            goto cleanup;
+        }
+
+        memset(&req, 0, sizeof(req));
+        req.command = 0x60;         // READ FPDMA QUEUED
+        req.features = 1;           // Sector count
+        req.device = 0x40;          // LBA mode
+        req.lba = TEST_LBA + i * 8;
+        req.count = (i << 3);       // NCQ tag (bits 7:3)
+        req.tag = i;
+        req.flags = AHCI_CMD_FLAG_NCQ;
+        req.buffer = (__u64)buffers[i];
+        req.buffer_len = SECTOR_SIZE;
+        req.timeout_ms = 5000;
+
+        if (ioctl(fd, AHCI_IOC_ISSUE_CMD, &req) < 0) {
+            perror("ioctl AHCI_IOC_ISSUE_CMD");
+            goto cleanup;
+        }
+        issued |= (1U << req.tag);
+    }
+
+    memset(&wait, 0, sizeof(wait));
+    wait.mask = issued;
+    wait.min_complete = NUM_CMDS;
+    wait.timeout_ms = 5000;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ioctl(fd, AHCI_IOC_WAIT_CMD, &wait) < 0) {
+        perror("ioctl AHCI_IOC_WAIT_CMD");
+        goto cleanup;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("  Wait returned after %.3f ms: sactive=0x%08x completed=0x%08x\n",
+           elapsed_ms(&start, &end), wait.sdb.sactive, wait.sdb.completed);
+
+    for (i = 0; i < NUM_CMDS; i++) {
+        if (wait.sdb.completed & (1U << i))
+            printf("    Tag %d: status=0x%02x error=0x%02x\n",
+                   i, wait.sdb.status[i], wait.sdb.error[i]);
+    }
+
+    if ((wait.sdb.completed & issued) != issued) {
+        printf("  Not all tags reported (expected 0x%08x)\n", issued);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0; i < NUM_CMDS; i++) {
+        if (issued & (1U << i))
+            ioctl(fd, AHCI_IOC_FREE_SLOT, &i);
+        free(buffers[i]);
+    }
+    return ret;
+}
+
+/* 使用中スロットがなければ即座に戻る */
+static int test_wait_idle(int fd)
+{
+    struct ahci_wait_cmd wait;
+
+    printf("\n[Test 2] Wait on idle slots returns immediately\n");
+
+    memset(&wait, 0, sizeof(wait));
+    wait.mask = 0x80000000;     // Slot 31 (not in use)
+    wait.min_complete = 1;
+    wait.timeout_ms = 5000;
+
+    if (ioctl(fd, AHCI_IOC_WAIT_CMD, &wait) < 0) {
+        perror("ioctl AHCI_IOC_WAIT_CMD");
+        return -1;
+    }
+
+    printf("  completed=0x%08x\n", wait.sdb.completed);
+    return wait.sdb.completed == 0 ? 0 : -1;
+}
+
+int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
+{
+    int fd;
+    int ret = 0;
+
+    printf("NCQ Wait Command Test\n");
+    printf("=====================\n\n");
+
+    fd = open(DEVICE_PATH, O_RDWR);
+    if (fd < 0) {
+        perror("open");
+        return 1;
+    }
+
+    if (ioctl(fd, AHCI_IOC_PORT_RESET) < 0 || ioctl(fd, AHCI_IOC_PORT_START) < 0) {
+        perror("port reset/start");
+        close(fd);
+        return 1;
+    }
+
+    if (test_wait_all(fd) < 0) {
+        fprintf(stderr, "Test 1 failed\n");
+        ret = 1;
+    }
+
+    if (test_wait_idle(fd) < 0) {
+        fprintf(stderr, "Test 2 failed\n");
+        ret = 1;
+    }
+
+    close(fd);
+
+    printf("\n=====================\n");
+    printf(ret == 0 ? "All tests PASSED\n" : "Some tests FAILED\n");
+    return ret;
+}